@@ -0,0 +1,475 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+//
+// Checks that echo, RPC and fan-out workloads over tcp::Socket allocate nothing
+// per message once warmed up. The decode workload is RPC whose server splits
+// each request into pmr strings and builds its response from them, all drawn
+// from a per-connection tcp::Arena that is reset once the response is sent.
+//
+// The global allocation and deallocation functions are replaced so that, while
+// tracking, every allocation on any thread is counted and its call stack kept.
+// Each workload runs its warm-up untracked, so one-time costs such as
+// per-thread instrumentation buffers are excluded. Any allocation in the
+// tracked window is reported with its resolved call stack and fails the run,
+// so this can gate a build. Only operator new is interposed; the library does
+// not call malloc directly.
+//
+// Options:
+//   --messages N      Tracked messages per workload (default 100000)
+//   --warmup N        Untracked messages per workload (default 10000)
+//   --size N          Echo payload in bytes (default 64)
+//   --subscribers N   Fan-out connections (default 16)
+//   --port N          Loopback port to listen on (default 45006)
+//   --json            Print results as JSON lines
+#include "../Common/Benchmark.hpp"
+
+#include <tcp/arena.hpp>
+#include <tcp/tcp.hpp>
+
+#include <DbgHelp.h>
+#pragma comment(lib, "Dbghelp.lib")
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+constexpr std::size_t kDepth{16};
+constexpr std::size_t kMaxSites{32};
+
+/// @brief Distinct call stack that allocated while tracking
+struct Site
+{
+	std::array<void*, kDepth> frames{};
+	std::size_t depth{};
+	std::uint64_t allocations{};
+	std::uint64_t bytes{};
+};
+
+/// @brief Allocations of the tracked window
+/// @note Constant-initialised, so usable by allocations made before main
+struct Tracker
+{
+	std::atomic<bool> tracking{};
+	std::atomic<std::uint64_t> allocations{};
+	std::atomic<std::uint64_t> bytes{};
+	std::atomic_flag lock{};
+	std::array<Site, kMaxSites> sites{};
+	std::size_t siteCount{};
+	std::uint64_t unrecorded{}; ///< Allocations from sites beyond kMaxSites
+};
+constinit Tracker gTracker{};
+/// @brief Set while capturing, so allocations made by the capture itself are not recorded
+thread_local bool tCapturing{};
+
+void record(std::size_t const size) noexcept
+{
+	gTracker.allocations.fetch_add(1, std::memory_order_relaxed);
+	gTracker.bytes.fetch_add(size, std::memory_order_relaxed);
+	if (tCapturing)
+		return;
+
+	tCapturing = true;
+	Site captured{};
+	captured.depth = ::CaptureStackBackTrace(2, kDepth, captured.frames.data(), nullptr); // Skip record and operator new
+
+	while (gTracker.lock.test_and_set(std::memory_order_acquire))
+		std::this_thread::yield();
+	auto const end = gTracker.sites.begin() + std::ptrdiff_t(gTracker.siteCount);
+	auto const site = std::find_if(gTracker.sites.begin(), end,
+								   [&](Site const &site) { return site.depth == captured.depth && site.frames == captured.frames; });
+	if (site != end)
+	{
+		++site->allocations;
+		site->bytes += size;
+	}
+	else if (gTracker.siteCount != kMaxSites)
+	{
+		captured.allocations = 1;
+		captured.bytes = size;
+		gTracker.sites[gTracker.siteCount++] = captured;
+	}
+	else
+		++gTracker.unrecorded;
+	gTracker.lock.clear(std::memory_order_release);
+	tCapturing = false;
+}
+
+[[nodiscard]] void *allocate(std::size_t const size) noexcept
+{
+	if (gTracker.tracking.load(std::memory_order_relaxed))
+		record(size);
+	return std::malloc(size ? size : 1);
+}
+[[nodiscard]] void *allocate(std::size_t const size, std::align_val_t const alignment) noexcept
+{
+	if (gTracker.tracking.load(std::memory_order_relaxed))
+		record(size);
+	auto const align = static_cast<std::size_t>(alignment);
+#ifdef _MSC_VER
+	return ::_aligned_malloc(size ? size : 1, align);
+#else
+	return std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) / align * align);
+#endif  // _MSC_VER
+}
+void deallocate(void *const pointer) noexcept
+{
+	std::free(pointer);
+}
+void deallocate(void *const pointer, std::align_val_t) noexcept
+{
+#ifdef _MSC_VER
+	::_aligned_free(pointer);
+#else
+	std::free(pointer);
+#endif  // _MSC_VER
+}
+}  // namespace
+
+void *operator new(std::size_t const size)
+{
+	if (void *const pointer = allocate(size))
+		return pointer;
+	throw std::bad_alloc{};
+}
+void *operator new[](std::size_t const size)
+{
+	return operator new(size);
+}
+void *operator new(std::size_t const size, std::align_val_t const alignment)
+{
+	if (void *const pointer = allocate(size, alignment))
+		return pointer;
+	throw std::bad_alloc{};
+}
+void *operator new[](std::size_t const size, std::align_val_t const alignment)
+{
+	return operator new(size, alignment);
+}
+void *operator new(std::size_t const size, std::nothrow_t const&) noexcept { return allocate(size); }
+void *operator new[](std::size_t const size, std::nothrow_t const&) noexcept { return allocate(size); }
+void *operator new(std::size_t const size, std::align_val_t const alignment, std::nothrow_t const&) noexcept { return allocate(size, alignment); }
+void *operator new[](std::size_t const size, std::align_val_t const alignment, std::nothrow_t const&) noexcept { return allocate(size, alignment); }
+
+void operator delete(void *const pointer) noexcept { deallocate(pointer); }
+void operator delete[](void *const pointer) noexcept { deallocate(pointer); }
+void operator delete(void *const pointer, std::size_t) noexcept { deallocate(pointer); }
+void operator delete[](void *const pointer, std::size_t) noexcept { deallocate(pointer); }
+void operator delete(void *const pointer, std::align_val_t const alignment) noexcept { deallocate(pointer, alignment); }
+void operator delete[](void *const pointer, std::align_val_t const alignment) noexcept { deallocate(pointer, alignment); }
+void operator delete(void *const pointer, std::size_t, std::align_val_t const alignment) noexcept { deallocate(pointer, alignment); }
+void operator delete[](void *const pointer, std::size_t, std::align_val_t const alignment) noexcept { deallocate(pointer, alignment); }
+void operator delete(void *const pointer, std::nothrow_t const&) noexcept { deallocate(pointer); }
+void operator delete[](void *const pointer, std::nothrow_t const&) noexcept { deallocate(pointer); }
+void operator delete(void *const pointer, std::align_val_t const alignment, std::nothrow_t const&) noexcept { deallocate(pointer, alignment); }
+void operator delete[](void *const pointer, std::align_val_t const alignment, std::nothrow_t const&) noexcept { deallocate(pointer, alignment); }
+
+namespace {
+/// @brief Begin a tracked window, discarding anything previously recorded
+void startTracking() noexcept
+{
+	while (gTracker.lock.test_and_set(std::memory_order_acquire))
+		std::this_thread::yield();
+	gTracker.allocations.store(0, std::memory_order_relaxed);
+	gTracker.bytes.store(0, std::memory_order_relaxed);
+	gTracker.siteCount = 0;
+	gTracker.unrecorded = 0;
+	gTracker.lock.clear(std::memory_order_release);
+	gTracker.tracking.store(true, std::memory_order_seq_cst);
+}
+void stopTracking() noexcept
+{
+	gTracker.tracking.store(false, std::memory_order_seq_cst);
+}
+
+/// @brief Print the recorded call stacks with symbol names and lines where available
+void printSites()
+{
+	HANDLE const process = ::GetCurrentProcess();
+	static bool const symbols = ::SymInitialize(process, nullptr, TRUE) != FALSE;
+
+	for (std::size_t i{}; i != gTracker.siteCount; ++i)
+	{
+		Site const &site = gTracker.sites[i];
+		std::printf("  %llu allocations, %llu bytes at:\n", static_cast<unsigned long long>(site.allocations),
+					static_cast<unsigned long long>(site.bytes));
+		for (std::size_t frame{}; frame != site.depth; ++frame)
+		{
+			alignas(SYMBOL_INFO) char storage[sizeof(SYMBOL_INFO) + 256]{};
+			auto *const symbol = reinterpret_cast<SYMBOL_INFO*>(storage);
+			symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+			symbol->MaxNameLen = 256;
+			IMAGEHLP_LINE64 line{};
+			line.SizeOfStruct = sizeof(line);
+			DWORD64 displacement{};
+			DWORD lineDisplacement{};
+
+			auto const address = reinterpret_cast<DWORD64>(site.frames[frame]);
+			if (!symbols || !::SymFromAddr(process, address, &displacement, symbol))
+				std::printf("    %p\n", site.frames[frame]);
+			else if (::SymGetLineFromAddr64(process, address, &lineDisplacement, &line))
+				std::printf("    %s (%s:%lu)\n", symbol->Name, line.FileName, static_cast<unsigned long>(line.LineNumber));
+			else
+				std::printf("    %s+0x%llx\n", symbol->Name, static_cast<unsigned long long>(displacement));
+		}
+	}
+	if (gTracker.unrecorded)
+		std::printf("  %llu allocations from further sites\n", static_cast<unsigned long long>(gTracker.unrecorded));
+}
+
+struct Counts
+{
+	std::size_t warmup;
+	std::size_t messages;
+};
+
+constexpr std::size_t kFieldSize{24}; ///< Beyond the small-string buffer, so every field allocates
+
+/// @brief Fixed-size round trips
+bool echo(tcp::Socket &client, tcp::Socket &server, Counts const counts, std::size_t const size)
+{
+	std::size_t const total = counts.warmup + counts.messages;
+	bool echoed{true};
+	std::thread thread{[&]
+	{
+		std::vector<char> buffer(size);
+		for (std::size_t i{}; i != total && echoed; ++i)
+			echoed = bench::receiveAll(server, buffer.data(), buffer.size()) &&
+					 bench::sendAll(server, buffer.data(), buffer.size());
+	}};
+
+	std::vector<char> buffer(size, 'x');
+	bool completed{true};
+	for (std::size_t i{}; i != total && completed; ++i)
+	{
+		if (i == counts.warmup)
+			startTracking();
+		completed = bench::sendAll(client, buffer.data(), buffer.size()) &&
+					bench::receiveAll(client, buffer.data(), buffer.size());
+	}
+	stopTracking();
+
+	client.close();
+	thread.join();
+	return completed && echoed;
+}
+
+/// @brief Variable-size requests answered by responses of a different size
+bool rpc(tcp::Socket &client, tcp::Socket &server, Counts const counts)
+{
+	std::size_t const total = counts.warmup + counts.messages;
+	bool served{true};
+	std::thread thread{[&]
+	{
+		std::vector<char> buffer(sizeof(bench::RpcHeader) + bench::kRpcMaxSize);
+		for (std::size_t i{}; i != total && served; ++i)
+		{
+			bench::RpcHeader header{};
+			served = bench::receiveAll(server, &header, sizeof(header)) && header.size <= bench::kRpcMaxSize &&
+					 bench::receiveAll(server, buffer.data() + sizeof(header), header.size);
+			if (!served)
+				break;
+
+			header.size = header.size / 2 + 8;
+			std::memcpy(buffer.data(), &header, sizeof(header));
+			served = bench::sendAll(server, buffer.data(), sizeof(header) + header.size);
+		}
+	}};
+
+	std::vector<char> buffer(sizeof(bench::RpcHeader) + bench::kRpcMaxSize, 'x');
+	bool completed{true};
+	for (std::size_t i{}; i != total && completed; ++i)
+	{
+		if (i == counts.warmup)
+			startTracking();
+
+		bench::RpcHeader header{static_cast<std::uint32_t>(i), bench::kRpcSizes[i % bench::kRpcSizes.size()]};
+		std::memcpy(buffer.data(), &header, sizeof(header));
+		completed = bench::sendAll(client, buffer.data(), sizeof(header) + header.size) &&
+					bench::receiveAll(client, &header, sizeof(header)) &&
+					header.id == static_cast<std::uint32_t>(i) && header.size <= bench::kRpcMaxSize &&
+					bench::receiveAll(client, buffer.data() + sizeof(header), header.size);
+	}
+	stopTracking();
+
+	client.close();
+	thread.join();
+	return completed && served;
+}
+
+/// @brief RPC whose server decodes requests into containers on a per-connection arena
+bool decode(tcp::Socket &client, tcp::Socket &server, Counts const counts)
+{
+	std::size_t const total = counts.warmup + counts.messages;
+	bool served{true};
+	std::thread thread{[&]
+	{
+		tcp::Arena arena{};
+		std::vector<char> buffer(sizeof(bench::RpcHeader) + bench::kRpcMaxSize);
+		for (std::size_t i{}; i != total && served; ++i)
+		{
+			bench::RpcHeader header{};
+			served = bench::receiveAll(server, &header, sizeof(header)) && header.size <= bench::kRpcMaxSize &&
+					 bench::receiveAll(server, buffer.data() + sizeof(header), header.size);
+			if (!served)
+				break;
+
+			// Fields in reverse order make the response
+			std::pmr::vector<std::pmr::string> fields{&arena};
+			for (std::size_t offset{}; offset < header.size; offset += kFieldSize)
+				fields.emplace_back(buffer.data() + sizeof(header) + offset, std::min<std::size_t>(kFieldSize, header.size - offset));
+			std::pmr::string response{&arena};
+			for (auto field = fields.rbegin(); field != fields.rend(); ++field)
+				response += *field;
+
+			header.size = static_cast<std::uint32_t>(response.size());
+			std::memcpy(buffer.data(), &header, sizeof(header));
+			std::memcpy(buffer.data() + sizeof(header), response.data(), response.size());
+			served = bench::sendAll(server, buffer.data(), sizeof(header) + header.size);
+			arena.reset();
+		}
+	}};
+
+	std::vector<char> buffer(sizeof(bench::RpcHeader) + bench::kRpcMaxSize, 'x');
+	bool completed{true};
+	for (std::size_t i{}; i != total && completed; ++i)
+	{
+		if (i == counts.warmup)
+			startTracking();
+
+		std::uint32_t const size = bench::kRpcSizes[i % bench::kRpcSizes.size()];
+		bench::RpcHeader header{static_cast<std::uint32_t>(i), size};
+		std::memcpy(buffer.data(), &header, sizeof(header));
+		completed = bench::sendAll(client, buffer.data(), sizeof(header) + header.size) &&
+					bench::receiveAll(client, &header, sizeof(header)) &&
+					header.id == static_cast<std::uint32_t>(i) && header.size == size &&
+					bench::receiveAll(client, buffer.data() + sizeof(header), header.size);
+	}
+	stopTracking();
+
+	client.close();
+	thread.join();
+	return completed && served;
+}
+
+/// @brief One publisher sending every message to each subscriber in turn
+bool fanOut(std::vector<tcp::Socket> &publishers, std::vector<tcp::Socket> &subscribers, Counts const counts)
+{
+	std::size_t const total = counts.warmup + counts.messages;
+	bool received{true};
+	std::thread thread{[&]
+	{
+		// Read in publishing order, which is never behind the publisher
+		for (std::uint64_t round{}; round != total && received; ++round)
+			for (tcp::Socket const &subscriber : subscribers)
+			{
+				std::uint64_t sequence{};
+				if (!bench::receiveAll(subscriber, &sequence, sizeof(sequence)) || sequence != round)
+				{
+					received = false;
+					break;
+				}
+			}
+	}};
+
+	bool published{true};
+	for (std::uint64_t round{}; round != total && published; ++round)
+	{
+		if (round == counts.warmup)
+			startTracking();
+		for (tcp::Socket const &publisher : publishers)
+			published = published && bench::sendAll(publisher, &round, sizeof(round));
+	}
+	stopTracking();
+
+	for (tcp::Socket &publisher : publishers)
+		publisher.close();
+	thread.join();
+	return published && received;
+}
+
+int benchmark(bench::Options const &options)
+{
+	auto const port = options.number<std::uint16_t>("port", 45006);
+	Counts const counts{options.number<std::size_t>("warmup", 10'000), options.number<std::size_t>("messages", 100'000)};
+	auto const subscribers = std::max<std::size_t>(1, options.number<std::size_t>("subscribers", 16));
+
+	tcp::Socket const listener = bench::listen(port);
+	if (!listener)
+	{
+		std::printf("failed to listen\n");
+		return 1;
+	}
+	auto const connect = [&](tcp::Socket &client, tcp::Socket &server)
+	{
+		return bench::connect(listener, port, client, server) &&
+			   bench::configure(client, bench::Mode::Blocking) && bench::configure(server, bench::Mode::Blocking);
+	};
+
+	int result{};
+	auto const check = [&](char const *name, bool const completed, std::uint64_t const messages)
+	{
+		std::uint64_t const allocations = gTracker.allocations.load(std::memory_order_relaxed);
+		bench::Report{options}.add("workload", name).add("messages", messages).add("allocations", allocations)
+			.add("allocs/msg", messages ? double(allocations) / double(messages) : 0.0)
+			.add("bytes", gTracker.bytes.load(std::memory_order_relaxed))
+			.add("result", !completed ? "failed" : allocations ? "allocates" : "ok").print();
+		printSites();
+		if (!completed || allocations)
+			result = 1;
+	};
+
+	{
+		tcp::Socket client{}, server{};
+		bool const connected = connect(client, server);
+		check("echo", connected && echo(client, server, counts, std::max<std::size_t>(1, options.number<std::size_t>("size", 64))),
+			  counts.messages);
+	}
+	{
+		tcp::Socket client{}, server{};
+		bool const connected = connect(client, server);
+		check("rpc", connected && rpc(client, server, counts), counts.messages);
+	}
+	{
+		tcp::Socket client{}, server{};
+		bool const connected = connect(client, server);
+		check("decode", connected && decode(client, server, counts), counts.messages);
+	}
+	{
+		// Rounds scaled down so the workload delivers about as many messages as the others
+		Counts const rounds{std::max<std::size_t>(1, counts.warmup / subscribers),
+							std::max<std::size_t>(1, counts.messages / subscribers)};
+		std::vector<tcp::Socket> publishers(subscribers), accepted(subscribers);
+		bool connected{true};
+		for (std::size_t i{}; i != subscribers && connected; ++i)
+			connected = connect(publishers[i], accepted[i]);
+		check("fan-out", connected && fanOut(publishers, accepted, rounds), rounds.messages * subscribers);
+	}
+	return result;
+}
+}  // namespace
+
+int main(int const argc, char const *const *argv)
+{
+	bench::Options const options{argc, argv};
+	if (!tcp::startup())
+		return 1;
+
+	// Sockets are scoped within benchmark which ensures their dtors are called
+	// prior to tcp::shutdown
+	int const result = benchmark(options);
+
+	tcp::shutdown();
+	return result;
+}
@@ -0,0 +1,312 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+//
+// Echo over the sender/receiver interface of tcp/async.hpp. A single loop
+// thread serves every connection and another drives every client, where
+// blocking sockets would take a thread per connection.
+//
+// Each client exchange is whenAll(send, receive), so the response is awaited
+// while the request is still going out. Clients connect through syncWait, and
+// the server accepts on its loop.
+//
+// At the end, the server's pending accept and receives are stopped while their
+// connections are still open; the time for all of them to complete is reported.
+//
+// Options:
+//   --connections N      Concurrent connections (default 64)
+//   --size N             Message size in bytes (default 64)
+//   --seconds N          Measured duration (default 1)
+//   --port N             Loopback port to listen on (default 45011)
+//   --json               Print results as JSON lines
+#include "../Common/Benchmark.hpp"
+
+#include <tcp/async.hpp>
+#include <tcp/clock.hpp>
+#include <tcp/histogram.hpp>
+#include <tcp/tcp.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <span>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+namespace {
+/// @brief Receiver running a function once scheduled on a loop
+template<class Function> struct Run
+{
+	void setValue() noexcept { function(); }
+	void setError(int) noexcept {}
+	void setStopped() noexcept {}
+
+	Function function;
+};
+
+/// @brief Server side of one connection, receiving and sending back whatever arrives
+struct EchoSession
+{
+	struct Received
+	{
+		void setValue(std::size_t const bytes) noexcept
+		{
+			if (bytes == 0)
+				return; // Peer closed
+			session->m_pending = {session->m_buffer.data(), bytes};
+			session->send();
+		}
+		void setError(int) noexcept {}
+		void setStopped() noexcept { ++session->m_stopped; }
+		[[nodiscard]] std::stop_token stopToken() const noexcept { return session->m_stopToken; }
+
+		EchoSession *session;
+	};
+	struct Sent
+	{
+		void setValue(std::size_t const bytes) noexcept
+		{
+			session->m_pending = session->m_pending.subspan(bytes);
+			session->m_pending.empty() ? session->receive() : session->send();
+		}
+		void setError(int) noexcept {}
+		void setStopped() noexcept { ++session->m_stopped; }
+		[[nodiscard]] std::stop_token stopToken() const noexcept { return session->m_stopToken; }
+
+		EchoSession *session;
+	};
+
+	EchoSession(tcp::async::Loop &loop, tcp::Socket socket, std::size_t const size, std::stop_token stopToken, std::size_t &stopped):
+		m_loop{loop}, m_socket{std::move(socket)}, m_buffer(size), m_stopToken{std::move(stopToken)}, m_stopped{stopped} {}
+
+	void receive() noexcept
+	{
+		m_receiving.start(tcp::async::receive(m_loop, m_socket, m_buffer.data(), m_buffer.size()), Received{this});
+	}
+	void send() noexcept
+	{
+		m_sending.start(tcp::async::send(m_loop, m_socket, m_pending.data(), m_pending.size()), Sent{this});
+	}
+
+private:
+	tcp::async::Loop &m_loop;
+	tcp::Socket m_socket;
+	std::vector<char> m_buffer;
+	std::span<char> m_pending{};
+	std::stop_token m_stopToken;
+	std::size_t &m_stopped; ///< Operations ended by stop, shared by the acceptor
+	tcp::async::Slot<tcp::async::ReceiveSender, Received> m_receiving{};
+	tcp::async::Slot<tcp::async::SendSender, Sent> m_sending{};
+};
+
+/// @brief Accepts connections on the server loop until stopped
+struct Acceptor
+{
+	struct Accepted
+	{
+		void setValue(tcp::Socket socket, tcp::Endpoint) noexcept
+		{
+			socket.setNoDelay();
+			auto &session = *acceptor->sessions.emplace_back(std::make_unique<EchoSession>(
+				acceptor->loop, std::move(socket), acceptor->size, acceptor->stopping.get_token(), acceptor->stopped));
+			session.receive();
+			acceptor->accept();
+		}
+		void setError(int) noexcept {}
+		void setStopped() noexcept { ++acceptor->stopped; }
+		[[nodiscard]] std::stop_token stopToken() const noexcept { return acceptor->stopping.get_token(); }
+
+		Acceptor *acceptor;
+	};
+
+	void accept() noexcept { accepting.start(tcp::async::accept(loop, listener), Accepted{this}); }
+
+	tcp::async::Loop &loop;
+	tcp::Socket const &listener;
+	std::size_t size;
+	std::vector<std::unique_ptr<EchoSession>> sessions{};
+	std::stop_source stopping{};
+	std::size_t stopped{}; ///< Operations ended by stop
+	tcp::async::Slot<tcp::async::AcceptSender, Accepted> accepting{};
+};
+
+/// @brief Client side of one connection, timing request-response exchanges
+struct ClientSession
+{
+	using Exchange = tcp::async::WhenAllSender<tcp::async::SendSender, tcp::async::ReceiveSender>;
+	struct Exchanged
+	{
+		void setValue(std::size_t const sent, std::size_t const received) noexcept { session->finish(sent, received); }
+		void setError(int) noexcept { session->m_failed = true; }
+		void setStopped() noexcept {}
+
+		ClientSession *session;
+	};
+	struct Received
+	{
+		void setValue(std::size_t const received) noexcept { session->finish(session->m_request.size(), received); }
+		void setError(int) noexcept { session->m_failed = true; }
+		void setStopped() noexcept {}
+
+		ClientSession *session;
+	};
+
+	ClientSession(tcp::async::Loop &loop, tcp::Socket socket, std::size_t const size, std::atomic<bool> const &running):
+		m_loop{loop}, m_socket{std::move(socket)}, m_request(size, 'x'), m_response(size), m_running{running} {}
+
+	[[nodiscard]] tcp::Socket const &socket() const noexcept { return m_socket; }
+	[[nodiscard]] tcp::Histogram const &latency() const noexcept { return m_latency; }
+	[[nodiscard]] bool failed() const noexcept { return m_failed; }
+
+	void exchange() noexcept
+	{
+		m_begin = tcp::Clock::nanoseconds();
+		m_received = 0;
+		m_exchanging.start(tcp::async::whenAll(tcp::async::send(m_loop, m_socket, m_request.data(), m_request.size()),
+											   tcp::async::receive(m_loop, m_socket, m_response.data(), m_response.size())),
+						   Exchanged{this});
+	}
+
+private:
+	void finish(std::size_t const sent, std::size_t const received) noexcept
+	{
+		// Messages are small enough to be sent whole; responses may arrive in parts
+		if (sent != m_request.size() || received == 0)
+		{
+			m_failed = true;
+			return;
+		}
+		if ((m_received += received) < m_response.size())
+		{
+			m_receiving.start(tcp::async::receive(m_loop, m_socket, m_response.data() + m_received, m_response.size() - m_received), Received{this});
+			return;
+		}
+		m_latency.record(static_cast<std::uint64_t>(tcp::Clock::nanoseconds() - m_begin));
+		if (m_running.load(std::memory_order_relaxed))
+			exchange();
+	}
+
+	tcp::async::Loop &m_loop;
+	tcp::Socket m_socket;
+	std::vector<char> m_request;
+	std::vector<char> m_response;
+	std::atomic<bool> const &m_running;
+	tcp::Histogram m_latency{};
+	std::int64_t m_begin{};
+	std::size_t m_received{};
+	bool m_failed{};
+	tcp::async::Slot<Exchange, Exchanged> m_exchanging{};
+	tcp::async::Slot<tcp::async::ReceiveSender, Received> m_receiving{};
+};
+
+int benchmark(bench::Options const &options)
+{
+	auto const port = options.number<std::uint16_t>("port", 45011);
+	auto const connections = std::max<std::size_t>(1, options.number<std::size_t>("connections", 64));
+	auto const size = std::max<std::size_t>(1, options.number<std::size_t>("size", 64));
+
+	tcp::async::Loop server{}, client{};
+	tcp::Socket const listener = bench::listen(port);
+	if (!server || !client || !listener || !listener.setShouldBlock(false))
+	{
+		std::printf("failed to listen\n");
+		return 1;
+	}
+
+	Acceptor acceptor{server, listener, size};
+	std::atomic<bool> running{true};
+	std::vector<std::unique_ptr<ClientSession>> sessions{};
+	std::thread serverThread{[&] { server.run(); }};
+	std::thread clientThread{[&] { client.run(); }};
+
+	// Acceptor and session state belong to the loop threads, so work on it is scheduled there
+	auto accept = [&acceptor] { acceptor.accept(); };
+	auto begin = [&sessions]
+	{
+		for (auto const &session : sessions)
+			session->exchange();
+	};
+	tcp::async::Slot<tcp::async::ScheduleSender, Run<decltype(accept)>> accepting{};
+	tcp::async::Slot<tcp::async::ScheduleSender, Run<decltype(begin)>> beginning{};
+	accepting.start(server.scheduler().schedule(), Run{accept});
+
+	tcp::Endpoint const endpoint{INADDR_LOOPBACK, port};
+	bool connected{true};
+	for (std::size_t i{}; connected && i != connections; ++i)
+	{
+		tcp::Socket socket = tcp::Socket::create();
+		connected = socket && socket.setShouldBlock(false) && socket.setNoDelay() &&
+					tcp::async::syncWait(tcp::async::connect(client, socket, endpoint)).has_value();
+		if (connected)
+			sessions.push_back(std::make_unique<ClientSession>(client, std::move(socket), size, running));
+	}
+
+	double seconds{}, cpu{}, stopping{};
+	if (connected)
+	{
+		std::int64_t const start = tcp::Clock::nanoseconds();
+		cpu = bench::cpuSeconds();
+		beginning.start(client.scheduler().schedule(), Run{begin});
+		std::this_thread::sleep_for(std::chrono::duration<double>{options.number("seconds", 1.0)});
+
+		// Sessions finish their exchange in flight and then stay idle
+		running.store(false);
+		static_cast<void>(tcp::async::syncWait(client.scheduler().schedule()));
+		seconds = double(tcp::Clock::nanoseconds() - start) / 1e9;
+		cpu = bench::cpuSeconds() - cpu;
+
+		// Cancellations run on the server loop ahead of work scheduled after them
+		std::int64_t const stop = tcp::Clock::nanoseconds();
+		acceptor.stopping.request_stop();
+		static_cast<void>(tcp::async::syncWait(server.scheduler().schedule()));
+		stopping = double(tcp::Clock::nanoseconds() - stop) / 1e3;
+	}
+
+	client.stop();
+	server.stop();
+	clientThread.join();
+	serverThread.join();
+	if (!connected)
+	{
+		std::printf("failed to connect\n");
+		return 1;
+	}
+
+	tcp::Histogram latency{};
+	bool failed{};
+	for (auto const &session : sessions)
+	{
+		latency.merge(session->latency());
+		failed |= session->failed();
+	}
+	bench::Report{options}.add("connections", std::uint64_t{connections})
+		.add("msg/s", double(latency.count()) / seconds)
+		.add("p50_us", double(latency.percentile(50.0)) / 1000.0)
+		.add("p99_us", double(latency.percentile(99.0)) / 1000.0)
+		.add("io_threads", std::uint64_t{2})
+		.add("cpu_cores", cpu / seconds)
+		.add("stopped", std::uint64_t{acceptor.stopped})
+		.add("stop_us", stopping)
+		.print();
+	return failed ? 1 : 0;
+}
+}  // namespace
+
+int main(int const argc, char const *const *argv)
+{
+	bench::Options const options{argc, argv};
+	if (!tcp::startup())
+		return 1;
+	tcp::Clock::calibrate();
+
+	// Sockets are scoped within benchmark which ensures their dtors are called
+	// prior to tcp::shutdown
+	int const result = benchmark(options);
+
+	tcp::shutdown();
+	return result;
+}
@@ -0,0 +1,526 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+//
+// The same echo, RPC and bulk workloads run over every I/O backend, as one
+// comparison table of rate, latency and processor use.
+//
+// Backends:
+//   blocking   Blocking tcp::Socket calls
+//   spin       Non-blocking sockets retried immediately on would-block
+//   poll       Non-blocking sockets that wait in Socket::wait on would-block
+//   rio        tcp::Ring, one submission syscall per operation, sleeping for completions
+//   rio-batch  tcp::Ring with deferred submission, sleeping for completions
+//   rio-polled tcp::Ring with deferred submission, spinning for completions
+//   memory     In-process pipes with socket-like buffering; a ceiling without the kernel
+//
+// Each workload is driven by one client thread against one serving thread.
+// Processor use is the whole process over the measured window, in cores.
+//
+// Options:
+//   --backends LIST      Comma-separated backends, or all (default)
+//   --workloads LIST     Comma-separated echo, rpc and bulk, or all (default)
+//   --size N             Echo payload in bytes (default 64)
+//   --chunk N            Bulk send size in bytes (default 65536)
+//   --seconds N          Measured duration per cell (default 1)
+//   --warmup-seconds N   Unmeasured duration per cell (default 0.2)
+//   --port N             Loopback port to listen on, and N+1 for rio (default 45007)
+//   --json               Print results as JSON lines
+//
+// Build with TCP_ENABLE_SYSCALL_COUNTING, e.g. msbuild /p:TcpSyscallCounting=true,
+// to also report socket calls per message.
+#include "../Common/Benchmark.hpp"
+
+#include <tcp/clock.hpp>
+#include <tcp/histogram.hpp>
+#include <tcp/pool.hpp>
+#include <tcp/ring.hpp>
+#include <tcp/tcp.hpp>
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+enum class Backend
+{
+	Blocking,
+	Spin,
+	Poll,
+	Rio,
+	RioBatch,
+	RioPolled,
+	Memory,
+};
+constexpr std::array kBackends{Backend::Blocking, Backend::Spin, Backend::Poll,
+							   Backend::Rio, Backend::RioBatch, Backend::RioPolled, Backend::Memory};
+[[nodiscard]] constexpr char const *name(Backend const backend) noexcept
+{
+	constexpr std::array kNames{"blocking", "spin", "poll", "rio", "rio-batch", "rio-polled", "memory"};
+	return kNames[std::size_t(backend)];
+}
+[[nodiscard]] constexpr bool ring(Backend const backend) noexcept
+{
+	return backend == Backend::Rio || backend == Backend::RioBatch || backend == Backend::RioPolled;
+}
+
+/// @brief Test whether a comma-separated option selects a name
+[[nodiscard]] bool selected(bench::Options const &options, std::string_view const option, std::string_view const name) noexcept
+{
+	std::string_view list = options.text(option, "all");
+	if (list == "all")
+		return true;
+	while (!list.empty())
+	{
+		std::size_t const separator = std::min(list.find(','), list.size());
+		if (list.substr(0, separator) == name)
+			return true;
+		list.remove_prefix(std::min(separator + 1, list.size()));
+	}
+	return false;
+}
+
+/// @brief One end of a connection under test; transfers are all-or-nothing
+struct Side
+{
+	virtual ~Side() = default;
+
+	/// @return False on error or if closed
+	virtual bool send(void const *data, std::size_t size) = 0;
+	/// @return False on error or if the peer closed
+	virtual bool receive(void *data, std::size_t size) = 0;
+	virtual void close() = 0;
+};
+
+struct SocketSide final: Side
+{
+	SocketSide(tcp::Socket socket, Backend const backend) noexcept: m_socket{std::move(socket)}, m_backend{backend} {}
+
+	bool send(void const *const data, std::size_t size) override
+	{
+		auto const *bytes = static_cast<char const*>(data);
+		while (size)
+		{
+			std::size_t const sent = m_socket.send(bytes, size);
+			if (sent == static_cast<std::size_t>(SOCKET_ERROR))
+			{
+				if (!bench::wouldBlock() || (m_backend == Backend::Poll && !m_socket.wait(POLLWRNORM)))
+					return false;
+				continue;
+			}
+			bytes += sent;
+			size -= sent;
+		}
+		return true;
+	}
+	bool receive(void *const data, std::size_t size) override
+	{
+		auto *bytes = static_cast<char*>(data);
+		while (size)
+		{
+			std::size_t const received = m_socket.receive(bytes, size);
+			if (received == static_cast<std::size_t>(SOCKET_ERROR))
+			{
+				if (!bench::wouldBlock() || (m_backend == Backend::Poll && !m_socket.wait(POLLRDNORM)))
+					return false;
+				continue;
+			}
+			if (received == 0)
+				return false;
+			bytes += received;
+			size -= received;
+		}
+		return true;
+	}
+	void close() override { m_socket.close(); }
+
+private:
+	tcp::Socket m_socket;
+	Backend m_backend;
+};
+
+/// @brief Socket driven through its own ring and pool, one operation in flight at a time
+struct RingSide final: Side
+{
+	RingSide(tcp::Socket socket, Backend const backend) noexcept:
+		m_ring{tcp::Ring::create({.entries = 2,
+								  .wait = backend == Backend::RioPolled ? tcp::Ring::Wait::Polled : tcp::Ring::Wait::Notified,
+								  .submit = backend == Backend::Rio ? tcp::Ring::Submit::Immediate : tcp::Ring::Submit::Deferred})},
+		m_socket{std::move(socket)}
+	{
+		if (m_ring)
+			m_queue = m_ring.attach(m_socket);
+	}
+
+	[[nodiscard]] explicit operator bool() const noexcept { return m_buffer != tcp::BufferPool::kNone && m_queue; }
+
+	bool send(void const *const data, std::size_t size) override
+	{
+		auto const *bytes = static_cast<char const*>(data);
+		while (size)
+		{
+			auto const count = static_cast<std::uint32_t>(std::min<std::size_t>(size, m_pool.size()));
+			std::memcpy(m_pool.data(m_buffer), bytes, count);
+			if (!m_ring.send(*m_queue, m_pool.slice(m_buffer, count)) || !await())
+				return false;
+			bytes += count;
+			size -= count;
+		}
+		return true;
+	}
+	bool receive(void *const data, std::size_t size) override
+	{
+		auto *bytes = static_cast<char*>(data);
+		while (size)
+		{
+			auto const count = static_cast<std::uint32_t>(std::min<std::size_t>(size, m_pool.size()));
+			std::uint32_t received{};
+			if (!m_ring.receive(*m_queue, m_pool.slice(m_buffer, count)) || !(received = await()))
+				return false;
+			std::memcpy(bytes, m_pool.data(m_buffer), received);
+			bytes += received;
+			size -= received;
+		}
+		return true;
+	}
+	void close() override { m_socket.close(); }
+
+private:
+	/// @return Bytes moved by the outstanding operation, zero on error or if the peer closed
+	std::uint32_t await()
+	{
+		tcp::Ring::Completion completion{};
+		std::size_t count{};
+		while (!(count = m_ring.complete(&completion, 1)))
+			;
+		return count == static_cast<std::size_t>(SOCKET_ERROR) || completion.error ? 0 : completion.bytes;
+	}
+
+	// Declared so the socket closes before its ring, and the ring before its memory
+	tcp::BufferPool m_pool = tcp::BufferPool::create(1, 64 * 1024);
+	std::uint32_t m_buffer = m_pool.acquire();
+	tcp::Ring m_ring;
+	tcp::Socket m_socket;
+	tcp::Ring::Queue *m_queue{};
+};
+
+/// @brief One direction of an in-process connection, bounded like a socket buffer
+struct Pipe
+{
+	bool write(char const *data, std::size_t size)
+	{
+		std::unique_lock lock{m_mutex};
+		while (size)
+		{
+			m_changed.wait(lock, [&] { return m_closed || m_size != m_buffer.size(); });
+			if (m_closed)
+				return false;
+
+			std::size_t const tail = (m_head + m_size) % m_buffer.size();
+			std::size_t const count = std::min({size, m_buffer.size() - m_size, m_buffer.size() - tail});
+			std::memcpy(m_buffer.data() + tail, data, count);
+			m_size += count;
+			data += count;
+			size -= count;
+			m_changed.notify_all();
+		}
+		return true;
+	}
+	bool read(char *data, std::size_t size)
+	{
+		std::unique_lock lock{m_mutex};
+		while (size)
+		{
+			m_changed.wait(lock, [&] { return m_closed || m_size != 0; });
+			if (m_size == 0)
+				return false;
+
+			std::size_t const count = std::min({size, m_size, m_buffer.size() - m_head});
+			std::memcpy(data, m_buffer.data() + m_head, count);
+			m_head = (m_head + count) % m_buffer.size();
+			m_size -= count;
+			data += count;
+			size -= count;
+			m_changed.notify_all();
+		}
+		return true;
+	}
+	void close()
+	{
+		std::scoped_lock const lock{m_mutex};
+		m_closed = true;
+		m_changed.notify_all();
+	}
+
+private:
+	std::mutex m_mutex{};
+	std::condition_variable m_changed{};
+	std::vector<char> m_buffer = std::vector<char>(std::size_t{256} * 1024);
+	std::size_t m_head{};
+	std::size_t m_size{};
+	bool m_closed{};
+};
+
+struct MemorySide final: Side
+{
+	MemorySide(std::shared_ptr<Pipe> in, std::shared_ptr<Pipe> out) noexcept: m_in{std::move(in)}, m_out{std::move(out)} {}
+
+	bool send(void const *const data, std::size_t const size) override { return m_out->write(static_cast<char const*>(data), size); }
+	bool receive(void *const data, std::size_t const size) override { return m_in->read(static_cast<char*>(data), size); }
+	void close() override
+	{
+		m_in->close();
+		m_out->close();
+	}
+
+private:
+	std::shared_ptr<Pipe> m_in;
+	std::shared_ptr<Pipe> m_out;
+};
+
+struct Connection
+{
+	std::unique_ptr<Side> client;
+	std::unique_ptr<Side> server;
+};
+/// @param ringListener Listener at port + 1 whose accepted sockets can join rings
+[[nodiscard]] bool open(Backend const backend, tcp::Socket const &listener, tcp::Socket const &ringListener,
+						std::uint16_t const port, Connection &connection)
+{
+	if (backend == Backend::Memory)
+	{
+		auto const request = std::make_shared<Pipe>(), response = std::make_shared<Pipe>();
+		connection.client = std::make_unique<MemorySide>(response, request);
+		connection.server = std::make_unique<MemorySide>(request, response);
+		return true;
+	}
+
+	tcp::Socket client{}, server{};
+	if (ring(backend))
+	{
+		if (!ringListener || !bench::connect(ringListener, port + 1, client, server, tcp::Ring::createSocket) ||
+			!client.setNoDelay() || !server.setNoDelay())
+			return false;
+		auto clientSide = std::make_unique<RingSide>(std::move(client), backend);
+		auto serverSide = std::make_unique<RingSide>(std::move(server), backend);
+		if (!*clientSide || !*serverSide)
+			return false;
+		connection.client = std::move(clientSide);
+		connection.server = std::move(serverSide);
+		return true;
+	}
+
+	bench::Mode const mode = backend == Backend::Blocking ? bench::Mode::Blocking : bench::Mode::NonBlocking;
+	if (!bench::connect(listener, port, client, server) || !bench::configure(client, mode) || !bench::configure(server, mode))
+		return false;
+	connection.client = std::make_unique<SocketSide>(std::move(client), backend);
+	connection.server = std::make_unique<SocketSide>(std::move(server), backend);
+	return true;
+}
+
+struct Outcome
+{
+	tcp::Histogram latency{};
+	std::uint64_t messages{};
+	std::uint64_t bytes{};
+	std::uint64_t calls{};
+	double seconds{};
+	double cpu{};
+	bool completed{true};
+};
+
+/// @brief Repeat a client operation for the warm-up and measured window
+///
+/// @param operation Performs one message exchange, returning the bytes moved or zero on failure
+template<class Operation> Outcome drive(Side &client, bench::Options const &options, bool const timed, Operation const &operation)
+{
+	std::int64_t const measureBegin = tcp::Clock::nanoseconds() + bench::nanoseconds(options.number("warmup-seconds", 0.2));
+	std::int64_t const end = measureBegin + bench::nanoseconds(options.number("seconds", 1.0));
+
+	Outcome outcome{};
+	bool measuring{};
+	for (;;)
+	{
+		std::int64_t const begin = tcp::Clock::nanoseconds();
+		if (!measuring && begin >= measureBegin)
+		{
+			measuring = true;
+			outcome.cpu = bench::cpuSeconds();
+			outcome.calls = bench::syscalls();
+		}
+		if (begin >= end)
+			break;
+
+		std::size_t const bytes = operation(client);
+		if (bytes == 0)
+		{
+			outcome.completed = false;
+			break;
+		}
+		if (measuring)
+		{
+			++outcome.messages;
+			outcome.bytes += bytes;
+			if (timed)
+				outcome.latency.record(static_cast<std::uint64_t>(tcp::Clock::nanoseconds() - begin));
+		}
+	}
+	outcome.seconds = double(tcp::Clock::nanoseconds() - measureBegin) / 1e9;
+	outcome.cpu = bench::cpuSeconds() - outcome.cpu;
+	outcome.calls = bench::syscalls() - outcome.calls;
+	return outcome;
+}
+
+Outcome echo(Connection const &connection, bench::Options const &options)
+{
+	auto const size = std::max<std::size_t>(1, options.number<std::size_t>("size", 64));
+	std::thread server{[&]
+	{
+		std::vector<char> buffer(size);
+		while (connection.server->receive(buffer.data(), size) && connection.server->send(buffer.data(), size))
+			;
+	}};
+
+	std::vector<char> buffer(size, 'x');
+	Outcome outcome = drive(*connection.client, options, true, [&](Side &client) -> std::size_t
+	{
+		return client.send(buffer.data(), size) && client.receive(buffer.data(), size) ? 2 * size : 0;
+	});
+	connection.client->close();
+	server.join();
+	return outcome;
+}
+
+Outcome rpc(Connection const &connection, bench::Options const &options)
+{
+	std::thread server{[&]
+	{
+		std::vector<char> buffer(sizeof(bench::RpcHeader) + bench::kRpcMaxSize);
+		for (bench::RpcHeader header{}; connection.server->receive(&header, sizeof(header)) && header.size <= bench::kRpcMaxSize &&
+								 connection.server->receive(buffer.data() + sizeof(header), header.size);)
+		{
+			header.size = header.size / 2 + 8;
+			std::memcpy(buffer.data(), &header, sizeof(header));
+			if (!connection.server->send(buffer.data(), sizeof(header) + header.size))
+				break;
+		}
+	}};
+
+	std::vector<char> buffer(sizeof(bench::RpcHeader) + bench::kRpcMaxSize, 'x');
+	std::uint32_t id{};
+	Outcome outcome = drive(*connection.client, options, true, [&](Side &client) -> std::size_t
+	{
+		bench::RpcHeader header{id, bench::kRpcSizes[id % bench::kRpcSizes.size()]};
+		std::size_t const sent = sizeof(header) + header.size;
+		std::memcpy(buffer.data(), &header, sizeof(header));
+		bool const answered = client.send(buffer.data(), sent) && client.receive(&header, sizeof(header)) &&
+							  header.id == id++ && header.size <= bench::kRpcMaxSize &&
+							  client.receive(buffer.data() + sizeof(header), header.size);
+		return answered ? sent + sizeof(header) + header.size : 0;
+	});
+	connection.client->close();
+	server.join();
+	return outcome;
+}
+
+Outcome bulk(Connection const &connection, bench::Options const &options)
+{
+	auto const chunk = std::max<std::size_t>(1, options.number<std::size_t>("chunk", 65536));
+	std::thread server{[&]
+	{
+		std::vector<char> buffer(chunk);
+		while (connection.server->receive(buffer.data(), chunk))
+			;
+	}};
+
+	std::vector<char> buffer(chunk, 'x');
+	Outcome outcome = drive(*connection.client, options, false, [&](Side &client) -> std::size_t
+	{
+		return client.send(buffer.data(), chunk) ? chunk : 0;
+	});
+	connection.client->close();
+	server.join();
+	return outcome;
+}
+
+int benchmark(bench::Options const &options)
+{
+	auto const port = options.number<std::uint16_t>("port", 45007);
+	tcp::Socket const listener = bench::listen(port);
+	if (!listener)
+	{
+		std::printf("failed to listen\n");
+		return 1;
+	}
+	// Unavailable Registered I/O fails only the rio cells
+	tcp::Socket const ringListener = bench::listen(port + 1, SOMAXCONN, tcp::Ring::createSocket);
+
+	struct Workload
+	{
+		char const *name;
+		Outcome (*run)(Connection const&, bench::Options const&);
+	};
+	constexpr std::array kWorkloads{Workload{"echo", echo}, Workload{"rpc", rpc}, Workload{"bulk", bulk}};
+
+	int result{};
+	for (Workload const &workload : kWorkloads)
+	{
+		if (!selected(options, "workloads", workload.name))
+			continue;
+		for (Backend const backend : kBackends)
+		{
+			if (!selected(options, "backends", name(backend)))
+				continue;
+
+			Connection connection{};
+			if (!open(backend, listener, ringListener, port, connection))
+			{
+				std::printf("%s over %s failed to connect\n", workload.name, name(backend));
+				result = 1;
+				continue;
+			}
+			Outcome const outcome = workload.run(connection, options);
+			if (!outcome.completed)
+			{
+				std::printf("%s over %s failed\n", workload.name, name(backend));
+				result = 1;
+				continue;
+			}
+
+			bench::Report report{options};
+			report.add("workload", workload.name).add("backend", name(backend))
+				.add("msg/s", double(outcome.messages) / outcome.seconds)
+				.add("MB/s", double(outcome.bytes) / outcome.seconds / 1e6);
+			if (outcome.latency.count())
+				report.add("p50_us", double(outcome.latency.percentile(50.0)) / 1000.0)
+					.add("p99_us", double(outcome.latency.percentile(99.0)) / 1000.0);
+			else
+				report.add("p50_us", "n/a").add("p99_us", "n/a");
+			report.add("cpu_cores", outcome.cpu / outcome.seconds).addSyscalls(outcome.calls, outcome.messages).print();
+		}
+	}
+	return result;
+}
+}  // namespace
+
+int main(int const argc, char const *const *argv)
+{
+	bench::Options const options{argc, argv};
+	if (!tcp::startup())
+		return 1;
+	tcp::Clock::calibrate();
+
+	// Sockets are scoped within benchmark which ensures their dtors are called
+	// prior to tcp::shutdown
+	int const result = benchmark(options);
+
+	tcp::shutdown();
+	return result;
+}
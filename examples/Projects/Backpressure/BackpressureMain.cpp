@@ -0,0 +1,266 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+//
+// Slow readers against a server whose responses outgrow its requests, with
+// and without a tcp::Budget on the bytes queued in its tcp::async::Outbox.
+//
+// Each client sends requests as fast as it can and reads the responses at
+// --rate bytes per second. Without a limit, the server's queues grow for as
+// long as the run lasts. With --budget, a server session stops reading while
+// the budget is exhausted and its own queue is still draining. Clients are then
+// held back by their sockets instead. Each run reports the peak bytes queued,
+// refused pushes, paused reads, and the largest consumer at the end.
+//
+// Options:
+//   --connections N      Concurrent connections (default 8)
+//   --size N             Request size in bytes (default 64)
+//   --amplify N          Response size as a multiple of the request (default 16)
+//   --rate N             Bytes per second each client reads (default 1048576)
+//   --budget N           Bytes the server may queue in the budgeted run (default 1048576)
+//   --seconds N          Duration per run (default 1)
+//   --port N             Loopback port to listen on (default 45013)
+//   --json               Print results as JSON lines
+#include "../Common/Benchmark.hpp"
+
+#include <tcp/async.hpp>
+#include <tcp/budget.hpp>
+#include <tcp/clock.hpp>
+#include <tcp/outbox.hpp>
+#include <tcp/tcp.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+/// @brief Server side of one connection, answering each request with a larger response
+struct Session
+{
+	struct Received
+	{
+		void setValue(std::size_t const bytes) noexcept { session->received(bytes); }
+		void setError(int) noexcept {}
+		void setStopped() noexcept {}
+
+		Session *session;
+	};
+	struct Drained
+	{
+		void setValue() noexcept { session->receive(); }
+		void setError(int) noexcept {}
+		void setStopped() noexcept {}
+
+		Session *session;
+	};
+
+	Session(tcp::async::Loop &loop, tcp::Socket socket, tcp::Budget &budget, std::uint64_t const id, std::size_t const size, std::size_t const amplify):
+		m_loop{loop}, m_socket{std::move(socket)}, m_account{budget, id}, m_outbox{loop, m_socket, m_account},
+		m_request(size), m_response(size * amplify, 'y') {}
+
+	[[nodiscard]] tcp::Budget::Account const &account() const noexcept { return m_account; }
+	[[nodiscard]] std::uint64_t refused() const noexcept { return m_refused; }
+	[[nodiscard]] std::uint64_t paused() const noexcept { return m_paused; }
+
+	/// @brief Read the next request, unless the budget cannot take its response while this queue drains
+	void receive() noexcept
+	{
+		if (m_outbox.queued() && m_account.budget().exhausted(m_response.size()))
+		{
+			++m_paused;
+			m_draining.start(m_outbox.drained(), Drained{this});
+			return;
+		}
+		m_receiving.start(tcp::async::receive(m_loop, m_socket, m_request.data() + m_filled, m_request.size() - m_filled), Received{this});
+	}
+
+private:
+	void received(std::size_t const bytes) noexcept
+	{
+		if (bytes == 0)
+			return; // Peer closed
+		if ((m_filled += bytes) == m_request.size())
+		{
+			m_filled = 0;
+			if (!m_outbox.push(m_response.data(), m_response.size()))
+				++m_refused;
+		}
+		receive();
+	}
+
+	tcp::async::Loop &m_loop;
+	tcp::Socket m_socket;
+	tcp::Budget::Account m_account;
+	tcp::async::Outbox m_outbox;
+	std::vector<char> m_request;
+	std::vector<char> m_response;
+	std::size_t m_filled{};
+	std::uint64_t m_refused{};
+	std::uint64_t m_paused{};
+	tcp::async::Slot<tcp::async::ReceiveSender, Received> m_receiving{};
+	tcp::async::Slot<tcp::async::DrainSender, Drained> m_draining{};
+};
+
+/// @brief Receiver starting every session once scheduled on the server loop
+struct Begin
+{
+	void setValue() noexcept
+	{
+		for (auto const &session : *sessions)
+			session->receive();
+	}
+	void setError(int) noexcept {}
+	void setStopped() noexcept {}
+
+	std::vector<std::unique_ptr<Session>> const *sessions;
+};
+
+struct Ran
+{
+	std::uint64_t received{}; ///< Response bytes read by clients
+	double seconds{};
+	std::size_t peak{};
+	std::uint64_t refused{};
+	std::uint64_t paused{};
+	tcp::Budget::Usage top{};
+	bool completed{true};
+};
+
+Ran run(tcp::Socket const &listener, bench::Options const &options, std::size_t const limit)
+{
+	auto const port = options.number<std::uint16_t>("port", 45013);
+	auto const connections = std::max<std::size_t>(1, options.number<std::size_t>("connections", 8));
+	auto const size = std::max<std::size_t>(1, options.number<std::size_t>("size", 64));
+	auto const amplify = std::max<std::size_t>(1, options.number<std::size_t>("amplify", 16));
+	auto const rate = std::max(1.0, options.number("rate", 1048576.0));
+
+	Ran ran{};
+	tcp::Budget budget{limit};
+	tcp::async::Loop loop{};
+	std::vector<tcp::Socket> clients(connections);
+	std::vector<std::unique_ptr<Session>> sessions{};
+	ran.completed = !!loop;
+	for (std::size_t i{}; ran.completed && i != connections; ++i)
+	{
+		tcp::Socket server{};
+		ran.completed = bench::connect(listener, port, clients[i], server) && server.setShouldBlock(false);
+		if (ran.completed)
+			sessions.push_back(std::make_unique<Session>(loop, std::move(server), budget, i, size, amplify));
+	}
+	if (!ran.completed)
+		return ran;
+
+	std::thread server{[&loop] { loop.run(); }};
+	tcp::async::Slot<tcp::async::ScheduleSender, Begin> beginning{};
+	beginning.start(loop.scheduler().schedule(), Begin{&sessions});
+
+	// Each client writes flat out and reads at its rate; once stopped, it reads flat out until the server closes
+	std::atomic<bool> running{true};
+	std::atomic<std::uint64_t> received{};
+	std::vector<std::thread> threads{};
+	for (tcp::Socket const &client : clients)
+	{
+		threads.emplace_back([&client, &running, size]
+		{
+			std::vector<char> request(size, 'x');
+			while (running.load(std::memory_order_relaxed) && bench::sendAll(client, request.data(), request.size()))
+				;
+		});
+		threads.emplace_back([&client, &running, &received, rate]
+		{
+			char buffer[4096];
+			std::int64_t const begin = tcp::Clock::nanoseconds();
+			std::uint64_t total{};
+			for (;;)
+			{
+				std::size_t const bytes = client.receive(buffer, sizeof(buffer));
+				if (bytes == 0 || bytes == static_cast<std::size_t>(SOCKET_ERROR))
+					break;
+				total += bytes;
+				if (!running.load(std::memory_order_relaxed))
+					continue;
+				received.fetch_add(bytes, std::memory_order_relaxed);
+				auto const due = begin + static_cast<std::int64_t>(double(total) / rate * 1e9);
+				std::this_thread::sleep_for(std::chrono::nanoseconds{std::max<std::int64_t>(0, due - tcp::Clock::nanoseconds())});
+			}
+		});
+	}
+
+	std::int64_t const start = tcp::Clock::nanoseconds();
+	std::this_thread::sleep_for(std::chrono::duration<double>{options.number("seconds", 1.0)});
+	ran.seconds = double(tcp::Clock::nanoseconds() - start) / 1e9;
+	ran.received = received.load();
+	ran.peak = budget.peak();
+	if (std::vector<tcp::Budget::Usage> const top = budget.top(1); !top.empty())
+		ran.top = top.front();
+
+	// Writers finish once the server reads again, which it does as the readers drain it
+	running.store(false);
+	for (std::size_t i{}; i < threads.size(); i += 2)
+		threads[i].join();
+	loop.stop();
+	server.join();
+	for (auto const &session : sessions)
+	{
+		ran.refused += session->refused();
+		ran.paused += session->paused();
+	}
+	sessions.clear();
+	for (std::size_t i = 1; i < threads.size(); i += 2)
+		threads[i].join();
+	return ran;
+}
+
+int benchmark(bench::Options const &options)
+{
+	auto const port = options.number<std::uint16_t>("port", 45013);
+	tcp::Socket const listener = bench::listen(port);
+	if (!listener)
+	{
+		std::printf("failed to listen\n");
+		return 1;
+	}
+
+	int result{};
+	for (std::size_t const limit : {std::size_t{}, options.number<std::size_t>("budget", 1048576)})
+	{
+		char const *const mode = limit ? "budget" : "unbounded";
+		Ran const ran = run(listener, options, limit);
+		if (!ran.completed)
+		{
+			std::printf("%s failed\n", mode);
+			result = 1;
+			continue;
+		}
+		bench::Report{options}.add("mode", mode)
+			.add("MB/s", double(ran.received) / ran.seconds / 1e6)
+			.add("peak_bytes", std::uint64_t{ran.peak})
+			.add("refused", ran.refused)
+			.add("paused", ran.paused)
+			.add("top_id", ran.top.id)
+			.add("top_bytes", std::uint64_t{ran.top.bytes})
+			.print();
+	}
+	return result;
+}
+}  // namespace
+
+int main(int const argc, char const *const *argv)
+{
+	bench::Options const options{argc, argv};
+	if (!tcp::startup())
+		return 1;
+	tcp::Clock::calibrate();
+
+	// Sockets are scoped within benchmark which ensures their dtors are called
+	// prior to tcp::shutdown
+	int const result = benchmark(options);
+
+	tcp::shutdown();
+	return result;
+}
@@ -0,0 +1,188 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+//
+// Rate of short-lived loopback connections: connect, one request, close.
+//
+// Each client stamps its request with the time it started connecting, so the
+// accepting side measures accept latency as the time until accept returned.
+// The server closes first so TIME_WAIT is held by the listening port rather
+// than exhausting client ephemeral ports.
+//
+// Options:
+//   --clients N         Connecting threads (default 8)
+//   --acceptors N       Threads accepting on the shared listener (default 1)
+//   --backlog N         Listen backlog (default SOMAXCONN)
+//   --request-size N    Bytes sent each way per connection, at least 8 (default 64)
+//   --seconds N         Measured duration (default 2)
+//   --warmup-seconds N  Unmeasured duration (default 0.5)
+//   --port N            Loopback port to listen on (default 45003)
+//   --hdr               Also print the full accept latency distribution
+//   --json              Print results as JSON lines
+#include "../Common/Benchmark.hpp"
+
+#include <tcp/clock.hpp>
+#include <tcp/histogram.hpp>
+#include <tcp/tcp.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+struct alignas(64) Results
+{
+	tcp::Histogram latency{}; ///< Accept latency for acceptors, whole connection for clients
+	std::uint64_t completed{};
+	std::uint64_t failed{};
+};
+
+/// @brief Accept connections and answer their single request until no longer serving
+void serve(tcp::Socket const &listener, std::size_t const requestSize, std::atomic<bench::Phase> const &phase,
+		   std::atomic<bool> const &serving, Results &results)
+{
+	std::vector<char> buffer(requestSize);
+	while (serving.load(std::memory_order_relaxed))
+	{
+		tcp::Socket connection{};
+		tcp::Endpoint endpoint{};
+		bool const accepted = listener.accept(connection, endpoint);
+		std::int64_t const acceptedAt = tcp::Clock::nanoseconds();
+		bool const measuring = phase.load(std::memory_order_relaxed) == bench::Phase::Measuring;
+
+		if (!accepted || !bench::receiveAll(connection, buffer.data(), buffer.size()) ||
+			!bench::sendAll(connection, buffer.data(), buffer.size()))
+		{
+			// Accepts fail once the listener is closed to stop us
+			if (measuring && serving.load(std::memory_order_relaxed))
+				++results.failed;
+			continue;
+		}
+
+		std::int64_t connecting{};
+		std::memcpy(&connecting, buffer.data(), sizeof(connecting));
+		if (measuring)
+			results.latency.record(static_cast<std::uint64_t>(std::max<std::int64_t>(0, acceptedAt - connecting)));
+	} // Closes first
+}
+
+/// @brief Open connections back to back until stopping
+void churn(std::uint16_t const port, std::size_t const requestSize, std::atomic<bench::Phase> const &phase, Results &results)
+{
+	std::vector<char> buffer(requestSize, 'x');
+	for (bench::Phase current; (current = phase.load(std::memory_order_relaxed)) != bench::Phase::Stopping;)
+	{
+		std::int64_t const begin = tcp::Clock::nanoseconds();
+		std::memcpy(buffer.data(), &begin, sizeof(begin));
+
+		tcp::Socket const socket = tcp::Socket::create();
+		char end{};
+		bool const completed = socket.connect(tcp::Endpoint{INADDR_LOOPBACK, port}) &&
+							   bench::sendAll(socket, buffer.data(), buffer.size()) &&
+							   bench::receiveAll(socket, buffer.data(), buffer.size()) &&
+							   socket.receive(end) == 0; // Wait for the server to close
+
+		// Only connections made entirely within the measured phase count against its duration
+		if (current != bench::Phase::Measuring || phase.load(std::memory_order_relaxed) != bench::Phase::Measuring)
+			continue;
+		if (!completed)
+		{
+			++results.failed;
+			continue;
+		}
+		++results.completed;
+		results.latency.record(static_cast<std::uint64_t>(tcp::Clock::nanoseconds() - begin));
+	}
+}
+
+int benchmark(bench::Options const &options)
+{
+	auto const port = options.number<std::uint16_t>("port", 45003);
+	auto const requestSize = std::max<std::size_t>(sizeof(std::int64_t), options.number<std::size_t>("request-size", 64));
+	auto const clients = std::max<std::size_t>(1, options.number<std::size_t>("clients", 8));
+	auto const acceptors = std::max<std::size_t>(1, options.number<std::size_t>("acceptors", 1));
+
+	tcp::Socket listener = bench::listen(port, options.number("backlog", SOMAXCONN));
+	if (!listener)
+	{
+		std::printf("failed to listen\n");
+		return 1;
+	}
+
+	std::atomic<bench::Phase> phase{bench::Phase::Warmup};
+	std::atomic<bool> serving{true};
+	std::vector<Results> served(acceptors), churned(clients);
+	std::vector<std::thread> servers, connectors;
+	for (Results &results : served)
+		servers.emplace_back(serve, std::cref(listener), requestSize, std::cref(phase), std::cref(serving), std::ref(results));
+	for (Results &results : churned)
+		connectors.emplace_back(churn, port, requestSize, std::cref(phase), std::ref(results));
+
+	using Seconds = std::chrono::duration<double>;
+	std::this_thread::sleep_for(Seconds{options.number("warmup-seconds", 0.5)});
+	phase.store(bench::Phase::Measuring);
+	std::int64_t const begin = tcp::Clock::nanoseconds();
+	std::this_thread::sleep_for(Seconds{options.number("seconds", 2.0)});
+	phase.store(bench::Phase::Stopping);
+	double const seconds = double(tcp::Clock::nanoseconds() - begin) / 1e9;
+
+	// Keep serving until every client has finished its last connection, then
+	// close the listener, which fails the accepts acceptors are blocked in
+	for (std::thread &connector : connectors)
+		connector.join();
+	serving.store(false);
+	::closesocket(listener.handle());
+	for (std::thread &server : servers)
+		server.join();
+	static_cast<void>(listener.release());
+
+	Results accepted{}, connected{};
+	for (Results const &results : served)
+	{
+		accepted.latency.merge(results.latency);
+		accepted.failed += results.failed;
+	}
+	for (Results const &results : churned)
+	{
+		connected.latency.merge(results.latency);
+		connected.completed += results.completed;
+		connected.failed += results.failed;
+	}
+
+	auto const us = [](tcp::Histogram const &histogram, double const percentile)
+	{
+		return double(histogram.percentile(percentile)) / 1000.0;
+	};
+	bench::Report{options}.add("clients", std::uint64_t{clients}).add("acceptors", std::uint64_t{acceptors})
+		.add("conn/s", double(connected.completed) / seconds)
+		.add("failed", connected.failed + accepted.failed)
+		.add("accept_p50_us", us(accepted.latency, 50.0)).add("accept_p99_us", us(accepted.latency, 99.0))
+		.add("accept_p99.9_us", us(accepted.latency, 99.9)).add("accept_max_us", double(accepted.latency.max()) / 1000.0)
+		.add("conn_p50_us", us(connected.latency, 50.0)).add("conn_p99_us", us(connected.latency, 99.0))
+		.print();
+	if (options.has("hdr"))
+		accepted.latency.print(std::cout, 1000.0);
+	return connected.failed + accepted.failed ? 1 : 0;
+}
+}  // namespace
+
+int main(int const argc, char const *const *argv)
+{
+	bench::Options const options{argc, argv};
+	if (!tcp::startup())
+		return 1;
+	tcp::Clock::calibrate();
+
+	// Sockets are scoped within benchmark which ensures their dtors are called
+	// prior to tcp::shutdown
+	int const result = benchmark(options);
+
+	tcp::shutdown();
+	return result;
+}
@@ -0,0 +1,367 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <tcp/tcp.hpp>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Shared by the benchmark projects
+namespace bench {
+/// @brief Command line options of the form --name value
+struct Options
+{
+	Options(int const argc, char const *const *argv): m_arguments(argv + 1, argv + argc) {}
+
+	/// @brief Test whether a flag was passed
+	[[nodiscard]] bool has(std::string_view const name) const noexcept
+	{
+		for (std::string_view const argument : m_arguments)
+			if (argument.starts_with("--") && argument.substr(2) == name)
+				return true;
+		return false;
+	}
+	/// @brief Value following an option, or the fallback if absent
+	[[nodiscard]] std::string_view text(std::string_view const name, std::string_view const fallback) const noexcept
+	{
+		for (std::size_t i{}; i + 1 < m_arguments.size(); ++i)
+			if (m_arguments[i].starts_with("--") && m_arguments[i].substr(2) == name)
+				return m_arguments[i + 1];
+		return fallback;
+	}
+	/// @brief Numeric value following an option, or the fallback if absent or malformed
+	template<class T> [[nodiscard]] T number(std::string_view const name, T const fallback) const noexcept
+	{
+		std::string_view const value = text(name, {});
+		T result{};
+		auto const [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+		return error == std::errc{} && end == value.data() + value.size() ? result : fallback;
+	}
+	/// @brief Comma-separated numbers following an option, e.g. --sizes 1,64,1024
+	[[nodiscard]] std::vector<std::size_t> numbers(std::string_view const name, std::vector<std::size_t> fallback) const
+	{
+		std::string_view value = text(name, {});
+		if (value.empty())
+			return fallback;
+
+		std::vector<std::size_t> result;
+		while (!value.empty())
+		{
+			std::size_t number{};
+			auto const [end, error] = std::from_chars(value.data(), value.data() + value.size(), number);
+			if (error != std::errc{})
+				return fallback;
+			result.push_back(number);
+			value.remove_prefix(std::size_t(end - value.data()));
+			if (!value.empty())
+				value.remove_prefix(1); // Separator
+		}
+		return result;
+	}
+
+private:
+	std::vector<std::string_view> m_arguments;
+};
+
+/// @brief One row of results, printed as aligned columns or with --json as one JSON object per line
+///
+/// JSON lines are meant for comparing builds; a header is printed whenever the columns change.
+struct Report
+{
+	explicit Report(Options const &options): m_json{options.has("json")} {}
+
+	Report &add(std::string_view const key, std::string_view const value)
+	{
+		std::string quoted{"\""};
+		for (char const character : value)
+		{
+			if (character == '"' || character == '\\')
+				quoted += '\\';
+			quoted += character;
+		}
+		m_fields.emplace_back(key, std::string{value}, quoted + '"');
+		return *this;
+	}
+	Report &add(std::string_view const key, double const value)
+	{
+		char text[32]{};
+		std::snprintf(text, sizeof(text), "%.3f", value);
+		m_fields.emplace_back(key, text, text);
+		return *this;
+	}
+	Report &add(std::string_view const key, std::uint64_t const value)
+	{
+		std::string const text = std::to_string(value);
+		m_fields.emplace_back(key, text, text);
+		return *this;
+	}
+	/// @brief Add socket calls per message, or n/a unless built with TCP_ENABLE_SYSCALL_COUNTING
+	///
+	/// @param calls Calls made over the measurement, see syscalls()
+	Report &addSyscalls(std::uint64_t const calls, std::uint64_t const messages)
+	{
+#ifdef TCP_ENABLE_SYSCALL_COUNTING
+		return add("syscalls/msg", messages ? double(calls) / double(messages) : 0.0);
+#else
+		static_cast<void>(calls), static_cast<void>(messages);
+		return add("syscalls/msg", "n/a");
+#endif  // TCP_ENABLE_SYSCALL_COUNTING
+	}
+
+	void print() const
+	{
+		std::string line;
+		if (m_json)
+		{
+			char const *separator = "{";
+			for (Field const &field : m_fields)
+			{
+				((line += separator) += '"') += field.key;
+				(line += "\":") += field.json;
+				separator = ",";
+			}
+			line += "}\n";
+		}
+		else
+		{
+			std::string header;
+			for (Field const &field : m_fields)
+			{
+				std::size_t const width = std::max<std::size_t>(12, field.key.size() + 1);
+				header += std::string(width - field.key.size(), ' ') += field.key;
+				line += std::string(width - std::min(width, field.text.size()), ' ') += field.text;
+			}
+			static std::string previous{};
+			if (header != previous)
+				std::printf("%s\n", (previous = header).c_str());
+			line += '\n';
+		}
+		std::fputs(line.c_str(), stdout);
+		std::fflush(stdout);
+	}
+
+private:
+	struct Field
+	{
+		Field(std::string_view const key, std::string text, std::string json):
+			key{key}, text{std::move(text)}, json{std::move(json)}
+		{}
+
+		std::string key;
+		std::string text;
+		std::string json;
+	};
+
+	std::vector<Field> m_fields{};
+	bool m_json;
+};
+
+/// @brief Pin the calling thread to a logical processor
+///
+/// @param cpu Processor index within the thread's processor group; negative leaves the thread unpinned
+/// @return False if the processor does not exist or pinning failed
+inline bool pin(int const cpu) noexcept
+{
+	if (cpu < 0)
+		return true;
+#ifdef _WIN32
+	if (cpu >= int(sizeof(DWORD_PTR) * 8))
+		return false; // Beyond the affinity mask of a group
+	return ::SetThreadAffinityMask(::GetCurrentThread(), DWORD_PTR{1} << cpu) != 0;
+#else
+	return false;
+#endif  // _WIN32
+}
+
+/// @brief User and kernel processor time consumed so far by all threads of the process, in seconds
+[[nodiscard]] inline double cpuSeconds() noexcept
+{
+#ifdef _WIN32
+	FILETIME created{}, exited{}, kernel{}, user{};
+	if (!::GetProcessTimes(::GetCurrentProcess(), &created, &exited, &kernel, &user))
+		return 0.0;
+
+	auto const ticks = [](FILETIME const &time) { return (std::uint64_t{time.dwHighDateTime} << 32) | time.dwLowDateTime; };
+	return double(ticks(kernel) + ticks(user)) / 1e7; // 100ns units
+#else
+	return 0.0;
+#endif  // _WIN32
+}
+
+/// @brief User and kernel processor time consumed so far by the calling thread, in seconds
+[[nodiscard]] inline double threadCpuSeconds() noexcept
+{
+#ifdef _WIN32
+	FILETIME created{}, exited{}, kernel{}, user{};
+	if (!::GetThreadTimes(::GetCurrentThread(), &created, &exited, &kernel, &user))
+		return 0.0;
+
+	auto const ticks = [](FILETIME const &time) { return (std::uint64_t{time.dwHighDateTime} << 32) | time.dwLowDateTime; };
+	return double(ticks(kernel) + ticks(user)) / 1e7; // 100ns units
+#else
+	return 0.0;
+#endif  // _WIN32
+}
+
+/// @brief Stage of a timed run, advanced by the main thread and observed by workers
+enum class Phase
+{
+	Warmup,
+	Measuring,
+	Stopping,
+};
+
+/// @brief Convert seconds, e.g. from an option, to clock nanoseconds
+[[nodiscard]] constexpr std::int64_t nanoseconds(double const seconds) noexcept
+{
+	return static_cast<std::int64_t>(seconds * 1e9);
+}
+
+/// @brief Request and response framing of the RPC workloads
+struct RpcHeader
+{
+	std::uint32_t id;
+	std::uint32_t size; ///< Payload bytes following the header
+};
+/// @brief Payload sizes RPC requests cycle through
+constexpr std::array<std::uint32_t, 6> kRpcSizes{16, 100, 512, 1500, 4096, 64};
+constexpr std::size_t kRpcMaxSize{4096};
+
+/// @brief How sockets wait for data
+enum class Mode
+{
+	Blocking,
+	NonBlocking, ///< Spins on would-block
+};
+[[nodiscard]] constexpr char const *name(Mode const mode) noexcept
+{
+	return mode == Mode::Blocking ? "blocking" : "non-blocking";
+}
+/// @brief Modes selected by --mode, defaulting to all
+[[nodiscard]] inline std::vector<Mode> modes(Options const &options)
+{
+	std::string_view const mode = options.text("mode", "all");
+	if (mode == name(Mode::Blocking))
+		return {Mode::Blocking};
+	if (mode == name(Mode::NonBlocking))
+		return {Mode::NonBlocking};
+	return {Mode::Blocking, Mode::NonBlocking};
+}
+
+/// @brief Test whether the last failed operation would have blocked
+[[nodiscard]] inline bool wouldBlock() noexcept
+{
+#ifdef _WIN32
+	return ::WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return false;
+#endif  // _WIN32
+}
+
+/// @brief Socket calls made so far by all threads
+///
+/// @return Zero unless built with TCP_ENABLE_SYSCALL_COUNTING
+[[nodiscard]] inline std::uint64_t syscalls()
+{
+#ifdef TCP_ENABLE_SYSCALL_COUNTING
+	return tcp::syscalls::total().total();
+#else
+	return 0;
+#endif  // TCP_ENABLE_SYSCALL_COUNTING
+}
+
+/// @brief Send an entire buffer, retrying partial and would-block sends
+inline bool sendAll(tcp::Socket const &socket, void const *data, std::size_t size) noexcept
+{
+	auto const *bytes = static_cast<char const*>(data);
+	while (size)
+	{
+		std::size_t const sent = socket.send(bytes, size);
+		if (sent == static_cast<std::size_t>(SOCKET_ERROR))
+		{
+			if (wouldBlock())
+				continue;
+			return false;
+		}
+		bytes += sent;
+		size -= sent;
+	}
+	return true;
+}
+/// @brief Fill an entire buffer, retrying partial and would-block receives
+///
+/// @return False on error or if the peer closed the connection
+inline bool receiveAll(tcp::Socket const &socket, void *data, std::size_t size) noexcept
+{
+	auto *bytes = static_cast<char*>(data);
+	while (size)
+	{
+		std::size_t const received = socket.receive(bytes, size);
+		if (received == static_cast<std::size_t>(SOCKET_ERROR))
+		{
+			if (wouldBlock())
+				continue;
+			return false;
+		}
+		if (received == 0)
+			return false;
+		bytes += received;
+		size -= received;
+	}
+	return true;
+}
+
+/// @brief Listening socket on the loopback interface
+[[nodiscard]] inline tcp::Socket listen(std::uint16_t const port, int const backlog = SOMAXCONN,
+									   tcp::Socket (*const create)() noexcept = tcp::Socket::create) noexcept
+{
+	tcp::Socket socket = create();
+	if (!socket.bind(tcp::Endpoint{INADDR_LOOPBACK, port}) || !socket.listen(backlog))
+		return {};
+	return socket;
+}
+/// @brief Establish a connection to a listener on the loopback interface
+///
+/// @param listener Listening socket, bound to port
+/// @param port Port of listener
+/// @param client Connecting side
+/// @param server Accepted side
+/// @param create Makes the client socket
+inline bool connect(tcp::Socket const &listener, std::uint16_t const port, tcp::Socket &client, tcp::Socket &server,
+					tcp::Socket (*const create)() noexcept = tcp::Socket::create) noexcept
+{
+	client = create();
+	if (!client.connect(tcp::Endpoint{INADDR_LOOPBACK, port}))
+		return false;
+
+	tcp::Endpoint endpoint{};
+	return listener.accept(server, endpoint);
+}
+/// @brief Local endpoint for the index-th of many loopback clients
+///
+/// Binding clients explicitly, spread across 127.0.0.2 and up, allows more
+/// connections than the ephemeral port range.
+/// @param first Lowest port to use on each address
+[[nodiscard]] constexpr tcp::Endpoint source(std::size_t const index, std::uint16_t const first = 1024) noexcept
+{
+	std::size_t const ports = std::size_t{65536} - (first ? first : 1);
+	return tcp::Endpoint{static_cast<std::uint32_t>(INADDR_LOOPBACK + 1 + index / ports),
+						 static_cast<std::uint16_t>(65536 - ports + index % ports)};
+}
+/// @brief Apply a mode and disable send coalescing
+inline bool configure(tcp::Socket const &socket, Mode const mode) noexcept
+{
+	return socket.setNoDelay() && socket.setShouldBlock(mode == Mode::Blocking);
+}
+}  // namespace bench
@@ -0,0 +1,418 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+//
+// Broadcast of one message stream to many loopback subscribers.
+//
+// A single publisher thread sends every message to each subscriber in turn
+// with non-blocking sends, on a fixed schedule. A subscriber whose socket
+// cannot take the next message misses it rather than stalling the others, as
+// market data distribution does. A fraction of subscribers read only
+// periodically, so they fall behind and start missing messages.
+//
+// Messages carry their scheduled publish time, so delivery latency includes any
+// delay of the publisher itself. Latency is reported for the fast subscribers
+// over all deliveries and as the spread of per-subscriber means.
+//
+// Options:
+//   --subscribers 1000,...  Subscriber counts to sweep (default 1000,10000,50000)
+//   --rate N                Messages per second to each subscriber (default 100)
+//   --size N                Message size in bytes, at least 16 (default 64)
+//   --slow-fraction N       Fraction of subscribers that read slowly (default 0.01)
+//   --slow-interval N       Milliseconds between reads of a slow subscriber (default 50)
+//   --slow-buffer N         Kernel buffer size in bytes on both sides of a slow subscriber, so it
+//                           falls behind within the run (default 4096)
+//   --readers N             Threads reading the subscribers (default 4)
+//   --send-buffer N         Publisher kernel send buffer per subscriber in bytes (default left to the OS)
+//   --seconds N             Measured duration (default 5)
+//   --warmup-seconds N      Unmeasured duration (default 1)
+//   --first-port N          Lowest subscriber source port (default 1024)
+//   --port N                Loopback port to listen on (default 45008)
+//   --json                  Print results as JSON lines
+#include "../Common/Benchmark.hpp"
+
+#include <tcp/clock.hpp>
+#include <tcp/histogram.hpp>
+#include <tcp/tcp.hpp>
+
+#include <Psapi.h>
+#pragma comment(lib, "Psapi.lib")
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+struct Message
+{
+	std::uint64_t sequence;
+	std::int64_t scheduled; ///< Intended publish time
+};
+
+/// @brief Absolute times shared by the publisher and readers
+struct Schedule
+{
+	std::int64_t interval;
+	std::int64_t begin;
+	std::int64_t measureBegin;
+	std::int64_t measureEnd;
+
+	[[nodiscard]] bool measured(std::int64_t const scheduled) const noexcept
+	{
+		return scheduled >= measureBegin && scheduled < measureEnd;
+	}
+};
+
+/// @brief Publisher's side of one subscriber
+struct Outbound
+{
+	tcp::Socket socket{};
+	Message pending{};    ///< Partially sent message
+	std::size_t offset{}; ///< Bytes of the pending message sent, zero if none
+	std::uint64_t missed{};
+	bool slow{};
+	bool failed{};
+};
+
+/// @brief Reading side of one subscriber
+struct Inbound
+{
+	tcp::Socket socket{};
+	std::vector<char> partial{};
+	std::size_t filled{};
+	std::int64_t nextRead{};
+	std::uint64_t delivered{};
+	std::uint64_t latencySum{};
+	bool slow{};
+	bool failed{};
+};
+
+struct alignas(64) Delivery
+{
+	tcp::Histogram latency{};
+	std::uint64_t delivered{};
+};
+
+void encode(Message const &message, std::vector<char> &buffer) noexcept
+{
+	std::memcpy(buffer.data(), &message, sizeof(message));
+}
+
+/// @brief Send each scheduled message to every subscriber
+///
+/// @param busy Nanoseconds spent sending measured messages
+/// @param cpu CPU seconds of the publishing thread while sending measured messages, sleeps excluded
+void publish(std::vector<Outbound> &subscribers, std::size_t const size, Schedule const &schedule, std::int64_t &busy, double &cpu)
+{
+	std::vector<char> buffer(size, 'x'), pending(size, 'x');
+	for (std::uint64_t sequence{};; ++sequence)
+	{
+		std::int64_t const scheduled = schedule.begin + std::int64_t(sequence) * schedule.interval;
+		if (scheduled >= schedule.measureEnd)
+			break;
+		if (scheduled >= schedule.measureBegin && scheduled - schedule.interval < schedule.measureBegin)
+			cpu = -bench::threadCpuSeconds();
+		if (std::int64_t const early = scheduled - tcp::Clock::nanoseconds(); early > 0)
+			std::this_thread::sleep_for(std::chrono::nanoseconds{early});
+
+		Message const message{sequence, scheduled};
+		encode(message, buffer);
+		std::int64_t const begin = tcp::Clock::nanoseconds();
+		for (Outbound &subscriber : subscribers)
+		{
+			if (subscriber.failed)
+				continue;
+
+			// Finish a partially sent message first to keep the stream framed
+			if (subscriber.offset)
+			{
+				encode(subscriber.pending, pending);
+				std::size_t const sent = subscriber.socket.send(pending.data() + subscriber.offset, size - subscriber.offset);
+				if (sent == static_cast<std::size_t>(SOCKET_ERROR))
+					subscriber.failed = !bench::wouldBlock();
+				else
+					subscriber.offset = (subscriber.offset + sent) % size;
+				if (subscriber.offset || subscriber.failed)
+				{
+					subscriber.missed += schedule.measured(scheduled);
+					continue;
+				}
+			}
+
+			std::size_t const sent = subscriber.socket.send(buffer.data(), size);
+			if (sent == static_cast<std::size_t>(SOCKET_ERROR))
+			{
+				subscriber.failed = !bench::wouldBlock();
+				subscriber.missed += schedule.measured(scheduled);
+			}
+			else if (sent != size)
+			{
+				subscriber.pending = message;
+				subscriber.offset = sent;
+			}
+		}
+		if (schedule.measured(scheduled))
+			busy += tcp::Clock::nanoseconds() - begin;
+	}
+	if (cpu < 0.0)
+		cpu += bench::threadCpuSeconds();
+}
+
+/// @brief Consume received bytes, completing messages as they fill
+void consume(Inbound &subscriber, char const *data, std::size_t size, Schedule const &schedule, Delivery &delivery)
+{
+	while (size)
+	{
+		std::size_t const count = std::min(size, subscriber.partial.size() - subscriber.filled);
+		std::memcpy(subscriber.partial.data() + subscriber.filled, data, count);
+		subscriber.filled += count;
+		data += count;
+		size -= count;
+		if (subscriber.filled != subscriber.partial.size())
+			break;
+
+		subscriber.filled = 0;
+		Message message{};
+		std::memcpy(&message, subscriber.partial.data(), sizeof(message));
+		if (!schedule.measured(message.scheduled))
+			continue;
+
+		++subscriber.delivered;
+		if (subscriber.slow)
+			continue;
+		auto const latency = static_cast<std::uint64_t>(std::max<std::int64_t>(0, tcp::Clock::nanoseconds() - message.scheduled));
+		subscriber.latencySum += latency;
+		delivery.latency.record(latency);
+		++delivery.delivered;
+	}
+}
+
+/// @brief Wait for any of a share of subscribers to become readable and drain them
+void read(std::vector<Inbound*> const subscribers, std::size_t const size, std::int64_t const slowInterval,
+		  Schedule const &schedule, std::atomic<bool> const &stop, Delivery &delivery)
+{
+	std::vector<char> buffer(64 * 1024);
+	std::vector<WSAPOLLFD> descriptors;
+	std::vector<Inbound*> polled;
+	std::vector<std::size_t> slow; ///< Indices into descriptors of slow subscribers
+	for (bool rebuild{true}; !stop.load(std::memory_order_relaxed);)
+	{
+		// The set only changes as subscribers fail
+		if (rebuild)
+		{
+			descriptors.clear();
+			polled.clear();
+			slow.clear();
+			for (Inbound *subscriber : subscribers)
+				if (!subscriber->failed)
+				{
+					if (subscriber->slow)
+						slow.push_back(descriptors.size());
+					descriptors.push_back(WSAPOLLFD{subscriber->socket.handle(), POLLRDNORM, 0});
+					polled.push_back(subscriber);
+				}
+			rebuild = false;
+		}
+
+		// Slow subscribers are only polled once their next read is due
+		std::int64_t const now = tcp::Clock::nanoseconds();
+		for (std::size_t const i : slow)
+			descriptors[i].events = now >= polled[i]->nextRead ? POLLRDNORM : 0;
+		if (descriptors.empty() || ::WSAPoll(descriptors.data(), static_cast<ULONG>(descriptors.size()), 1) <= 0)
+		{
+			if (descriptors.empty())
+				std::this_thread::sleep_for(std::chrono::milliseconds{1});
+			continue;
+		}
+
+		for (std::size_t i{}; i != descriptors.size(); ++i)
+		{
+			if (!descriptors[i].revents)
+				continue;
+
+			Inbound &subscriber = *polled[i];
+			for (;;)
+			{
+				// A slow subscriber takes a single message per wake
+				std::size_t const received = subscriber.socket.receive(buffer.data(), subscriber.slow ? size : buffer.size());
+				if (received == static_cast<std::size_t>(SOCKET_ERROR) && bench::wouldBlock())
+					break;
+				if (received == static_cast<std::size_t>(SOCKET_ERROR) || received == 0)
+				{
+					subscriber.failed = rebuild = true;
+					break;
+				}
+				consume(subscriber, buffer.data(), received, schedule, delivery);
+				if (subscriber.slow)
+				{
+					subscriber.nextRead = tcp::Clock::nanoseconds() + slowInterval;
+					break;
+				}
+			}
+		}
+	}
+}
+
+[[nodiscard]] double workingSetMegabytes() noexcept
+{
+	PROCESS_MEMORY_COUNTERS counters{};
+	counters.cb = sizeof(counters);
+	return ::GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters)) ? double(counters.WorkingSetSize) / 1e6 : 0.0;
+}
+
+/// @brief Broadcast to one number of subscribers and report
+///
+/// @param source Index of the next subscriber source endpoint; ports of earlier
+/// runs are left in TIME_WAIT, so each run continues where the last stopped
+bool run(std::size_t const count, bench::Options const &options, tcp::Socket const &listener, std::size_t &source)
+{
+	auto const port = options.number<std::uint16_t>("port", 45008);
+	auto const size = std::max(sizeof(Message), options.number<std::size_t>("size", 64));
+	auto const readers = std::clamp<std::size_t>(options.number<std::size_t>("readers", 4), 1, count);
+	double const slowFraction = options.number("slow-fraction", 0.01);
+	std::size_t const slowEvery = slowFraction > 0.0 ? std::max<std::size_t>(1, std::size_t(1.0 / slowFraction + 0.5)) : 0;
+
+	std::vector<Outbound> outbound(count);
+	std::vector<Inbound> inbound(count);
+	for (std::size_t i{}; i != count; ++i)
+	{
+		tcp::Socket &client = inbound[i].socket;
+		tcp::Endpoint endpoint{};
+		client = tcp::Socket::create();
+
+		// Source ports taken by something else are skipped
+		bool bound{};
+		for (std::size_t attempt{}; attempt != 1024 && !bound; ++attempt)
+			bound = client.bind(bench::source(source++, options.number<std::uint16_t>("first-port", 1024)));
+		if (!bound || !client.connect(tcp::Endpoint{INADDR_LOOPBACK, port}) || !listener.accept(outbound[i].socket, endpoint) ||
+			!bench::configure(client, bench::Mode::NonBlocking) || !bench::configure(outbound[i].socket, bench::Mode::NonBlocking))
+		{
+			std::printf("failed to connect subscriber %zu\n", i);
+			return false;
+		}
+		if (auto const bytes = options.number("send-buffer", 0))
+			outbound[i].socket.setSendBufferSize(bytes);
+
+		inbound[i].slow = outbound[i].slow = slowEvery && i % slowEvery == 0;
+		if (inbound[i].slow)
+		{
+			int const bytes = options.number("slow-buffer", 4096);
+			client.setReceiveBufferSize(bytes);
+			outbound[i].socket.setSendBufferSize(bytes);
+		}
+		inbound[i].partial.resize(size);
+	}
+
+	Schedule schedule{};
+	schedule.interval = std::max<std::int64_t>(1, bench::nanoseconds(1.0 / std::max(1e-3, options.number("rate", 100.0))));
+	schedule.begin = tcp::Clock::nanoseconds() + bench::nanoseconds(0.01);
+	schedule.measureBegin = schedule.begin + bench::nanoseconds(options.number("warmup-seconds", 1.0));
+	schedule.measureEnd = schedule.measureBegin + bench::nanoseconds(options.number("seconds", 5.0));
+
+	std::atomic<bool> stop{};
+	std::vector<Delivery> deliveries(readers);
+	std::vector<std::thread> threads;
+	auto const slowInterval = bench::nanoseconds(options.number("slow-interval", 50.0) / 1e3);
+	for (std::size_t i{}; i != readers; ++i)
+	{
+		std::vector<Inbound*> owned;
+		for (std::size_t j = i; j < count; j += readers)
+			owned.push_back(&inbound[j]);
+		threads.emplace_back(read, std::move(owned), size, slowInterval, std::cref(schedule), std::cref(stop), std::ref(deliveries[i]));
+	}
+
+	std::int64_t busy{};
+	double cpu{};
+	publish(outbound, size, schedule, busy, cpu);
+	std::this_thread::sleep_for(std::chrono::milliseconds{200}); // Drain the fast subscribers
+	stop.store(true);
+	for (std::thread &thread : threads)
+		thread.join();
+
+	Delivery total{};
+	for (Delivery const &delivery : deliveries)
+	{
+		total.latency.merge(delivery.latency);
+		total.delivered += delivery.delivered;
+	}
+	tcp::Histogram means{};
+	std::uint64_t missedFast{}, missedSlow{}, slow{}, failed{};
+	for (std::size_t i{}; i != count; ++i)
+	{
+		if (outbound[i].slow)
+		{
+			++slow;
+			missedSlow += outbound[i].missed;
+		}
+		else
+		{
+			missedFast += outbound[i].missed;
+			if (inbound[i].delivered)
+				means.record(inbound[i].latencySum / inbound[i].delivered);
+		}
+		failed += outbound[i].failed || inbound[i].failed;
+	}
+
+	double const seconds = double(schedule.measureEnd - schedule.measureBegin) / 1e9;
+	double const published = seconds * 1e9 / double(schedule.interval);
+	auto const us = [](tcp::Histogram const &histogram, double const percentile)
+	{
+		return double(histogram.percentile(percentile)) / 1000.0;
+	};
+	auto const percent = [&](std::uint64_t const missed, std::uint64_t const subscribers)
+	{
+		return subscribers ? 100.0 * double(missed) / (published * double(subscribers)) : 0.0;
+	};
+	bench::Report{options}.add("subscribers", std::uint64_t{count}).add("slow", slow)
+		.add("deliveries/s", double(total.delivered) / seconds)
+		.add("p50_us", us(total.latency, 50.0)).add("p99_us", us(total.latency, 99.0))
+		.add("p99.9_us", us(total.latency, 99.9)).add("max_us", double(total.latency.max()) / 1000.0)
+		.add("sub_mean_p50_us", us(means, 50.0)).add("sub_mean_max_us", double(means.max()) / 1000.0)
+		.add("fast_missed%", percent(missedFast, count - slow)).add("slow_missed%", percent(missedSlow, slow))
+		.add("pub_cpu%", 100.0 * cpu / seconds)
+		.add("pub_ns/send", double(busy) / (published * double(count)))
+		.add("working_MB", workingSetMegabytes())
+		.print();
+	return failed == 0;
+}
+
+int benchmark(bench::Options const &options)
+{
+	tcp::Socket const listener = bench::listen(options.number<std::uint16_t>("port", 45008));
+	if (!listener)
+	{
+		std::printf("failed to listen\n");
+		return 1;
+	}
+
+	int result{};
+	std::size_t source{};
+	for (std::size_t const count : options.numbers("subscribers", {1'000, 10'000, 50'000}))
+		if (!run(std::max<std::size_t>(1, count), options, listener, source))
+		{
+			std::printf("%zu subscribers failed\n", count);
+			result = 1;
+		}
+	return result;
+}
+}  // namespace
+
+int main(int const argc, char const *const *argv)
+{
+	bench::Options const options{argc, argv};
+	if (!tcp::startup())
+		return 1;
+	tcp::Clock::calibrate();
+
+	// Sockets are scoped within benchmark which ensures their dtors are called
+	// prior to tcp::shutdown
+	int const result = benchmark(options);
+
+	tcp::shutdown();
+	return result;
+}
@@ -0,0 +1,190 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+//
+// Memory cost of idle loopback connections, opened in increasing steps and
+// held until the end of the run.
+//
+// Both sockets of every connection live in this process, so the per-connection
+// figures cover a client and a server socket. User bytes are the growth of the
+// process private commit; kernel bytes are the growth of the system-wide
+// nonpaged pool, where socket state lives, so run on an otherwise quiet host.
+//
+// Windows has no per-process descriptor limit to raise; the binding limit is
+// ephemeral ports, so clients bind explicit source ports across 127.0.0.2 and up.
+//
+// Options:
+//   --counts 10000,...   Cumulative connection counts to report at (default 10000,100000,1000000)
+//   --first-port N       Lowest client source port (default 1024)
+//   --backlog N          Listen backlog (default SOMAXCONN)
+//   --port N             Loopback port to listen on (default 45005)
+//   --json               Print results as JSON lines
+#include "../Common/Benchmark.hpp"
+
+#include <tcp/clock.hpp>
+#include <tcp/tcp.hpp>
+
+#include <Psapi.h>
+#pragma comment(lib, "Psapi.lib")
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace {
+struct Memory
+{
+	std::uint64_t workingSet;
+	std::uint64_t privateBytes;
+	std::uint64_t kernel; ///< System-wide nonpaged pool
+};
+
+[[nodiscard]] Memory sample() noexcept
+{
+	PROCESS_MEMORY_COUNTERS_EX process{};
+	process.cb = sizeof(process);
+	::GetProcessMemoryInfo(::GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&process), sizeof(process));
+
+	PERFORMANCE_INFORMATION system{};
+	system.cb = sizeof(system);
+	::GetPerformanceInfo(&system, sizeof(system));
+	return Memory{process.WorkingSetSize, process.PrivateUsage, std::uint64_t{system.KernelNonpaged} * system.PageSize};
+}
+
+int benchmark(bench::Options const &options)
+{
+	std::vector<std::size_t> counts = options.numbers("counts", {10'000, 100'000, 1'000'000});
+	std::sort(counts.begin(), counts.end());
+	auto const port = options.number<std::uint16_t>("port", 45005);
+	auto const firstPort = options.number<std::uint16_t>("first-port", 1024);
+
+	if (counts.empty())
+	{
+		std::printf("no connection counts given\n");
+		return 1;
+	}
+	tcp::Socket listener = bench::listen(port, options.number("backlog", SOMAXCONN));
+	if (!listener)
+	{
+		std::printf("failed to listen\n");
+		return 1;
+	}
+
+	// Reserved up front so growth is the sockets rather than these vectors
+	std::vector<tcp::Socket> clients, servers;
+	clients.reserve(counts.back());
+	servers.reserve(counts.back() + 1);
+	Memory const baseline = sample();
+
+	std::atomic<std::size_t> accepted{};
+	std::atomic<bool> accepting{true};
+	std::thread acceptor{[&]
+	{
+		while (accepting.load(std::memory_order_relaxed))
+		{
+			tcp::Socket socket{};
+			tcp::Endpoint endpoint{};
+			if (listener.accept(socket, endpoint))
+			{
+				servers.push_back(std::move(socket));
+				accepted.fetch_add(1, std::memory_order_release);
+			}
+		}
+	}};
+
+	tcp::Endpoint const target{INADDR_LOOPBACK, port};
+	std::size_t source{}, skipped{};
+	char const *failed{}; ///< Why opening stopped early
+	for (std::size_t const count : counts)
+	{
+		std::int64_t const begin = tcp::Clock::nanoseconds();
+		std::size_t const opened = clients.size();
+		while (clients.size() < count && !failed)
+		{
+			// Source ports already taken by something else are skipped
+			tcp::Endpoint const endpoint = bench::source(source++, firstPort);
+
+			tcp::Socket client = tcp::Socket::create();
+			if (!client)
+				failed = "socket failed";
+			else if (!client.bind(endpoint))
+			{
+				// Anything but a taken port, such as running out of buffers, would recur on every port
+				int const error = ::WSAGetLastError();
+				if (error == WSAEADDRINUSE || error == WSAEACCES)
+					++skipped;
+				else
+					failed = "bind failed";
+			}
+			else if (!client.connect(target))
+				failed = "connect failed";
+			else
+				clients.push_back(std::move(client));
+		}
+
+		// A failed accept leaves its connection unaccounted for, so give up once accepting stalls
+		std::size_t seen = accepted.load(std::memory_order_acquire);
+		for (std::int64_t progressed = tcp::Clock::nanoseconds(); seen < clients.size();)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds{1});
+			if (std::size_t const now = accepted.load(std::memory_order_acquire); now != seen)
+			{
+				seen = now;
+				progressed = tcp::Clock::nanoseconds();
+			}
+			else if (tcp::Clock::nanoseconds() - progressed > 5'000'000'000)
+			{
+				failed = "accept stalled";
+				break;
+			}
+		}
+		double const seconds = double(tcp::Clock::nanoseconds() - begin) / 1e9;
+
+		if (clients.size() > opened)
+		{
+			Memory const memory = sample();
+			double const connections = double(clients.size());
+			bench::Report{options}.add("connections", std::uint64_t{clients.size()})
+				.add("seconds", seconds).add("conn/s", double(clients.size() - opened) / seconds)
+				.add("working_MB", double(memory.workingSet) / 1e6)
+				.add("user_B/conn", (double(memory.privateBytes) - double(baseline.privateBytes)) / connections)
+				.add("kernel_B/conn", (double(memory.kernel) - double(baseline.kernel)) / connections)
+				.add("skipped_ports", std::uint64_t{skipped})
+				.print();
+		}
+		if (failed)
+		{
+			std::printf("stopped at %zu connections: %s\n", clients.size(), failed);
+			break;
+		}
+	}
+
+	// Closing the listener fails the acceptor's blocking accept, which a wake-up
+	// connection could not do once sockets or ports are exhausted. Only the handle
+	// is read here; the object forgets it once the acceptor has stopped using it.
+	accepting.store(false);
+	::closesocket(listener.handle());
+	acceptor.join();
+	static_cast<void>(listener.release());
+	return failed ? 1 : 0;
+}
+}  // namespace
+
+int main(int const argc, char const *const *argv)
+{
+	bench::Options const options{argc, argv};
+	if (!tcp::startup())
+		return 1;
+	tcp::Clock::calibrate();
+
+	// Sockets are scoped within benchmark which ensures their dtors are called
+	// prior to tcp::shutdown
+	int const result = benchmark(options);
+
+	tcp::shutdown();
+	return result;
+}
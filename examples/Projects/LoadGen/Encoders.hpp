@@ -0,0 +1,120 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include "../Common/Benchmark.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace loadgen {
+/// @brief Produces requests and frames responses of one protocol
+///
+/// Add a protocol by deriving from Encoder and registering it in makeEncoder.
+/// Each connection owns its own instance, so implementations may keep state.
+struct Encoder
+{
+	virtual ~Encoder() = default;
+
+	/// @brief Append the next request to an output buffer
+	///
+	/// @param sequence Number of requests previously encoded on this connection
+	virtual void encode(std::uint64_t sequence, std::vector<char> &out) = 0;
+	/// @brief Find the end of the first response in received data
+	///
+	/// @return Size of the complete response, or zero if more data is needed
+	[[nodiscard]] virtual std::size_t frame(char const *data, std::size_t size) = 0;
+};
+
+/// @brief Fixed-size payloads answered by an echo of the same size
+struct EchoEncoder final: Encoder
+{
+	explicit EchoEncoder(std::size_t const size): m_size{size ? size : 1} {}
+
+	void encode(std::uint64_t const sequence, std::vector<char> &out) override
+	{
+		out.resize(out.size() + m_size, static_cast<char>('a' + sequence % 26));
+	}
+	[[nodiscard]] std::size_t frame(char const*, std::size_t const size) override
+	{
+		return size >= m_size ? m_size : 0;
+	}
+
+private:
+	std::size_t m_size;
+};
+
+/// @brief Keep-alive HTTP/1.1 GET requests; responses are framed by Content-Length
+/// @note Chunked responses are not supported
+struct HttpEncoder final: Encoder
+{
+	HttpEncoder(std::string_view const host, std::string_view const path):
+		m_request{"GET " + std::string{path} + " HTTP/1.1\r\nHost: " + std::string{host} + "\r\n\r\n"}
+	{}
+
+	void encode(std::uint64_t, std::vector<char> &out) override
+	{
+		out.insert(out.end(), m_request.begin(), m_request.end());
+	}
+	[[nodiscard]] std::size_t frame(char const *data, std::size_t const size) override
+	{
+		std::string_view const received{data, size};
+		std::size_t const headerEnd = received.find("\r\n\r\n");
+		if (headerEnd == std::string_view::npos)
+			return 0;
+
+		std::size_t const total = headerEnd + 4 + contentLength(received.substr(0, headerEnd));
+		return size >= total ? total : 0;
+	}
+
+private:
+	[[nodiscard]] static std::size_t contentLength(std::string_view headers) noexcept
+	{
+		constexpr std::string_view kName{"content-length:"};
+		for (std::size_t line{}; line < headers.size();)
+		{
+			std::size_t const end = std::min(headers.find("\r\n", line), headers.size());
+			std::string_view const header = headers.substr(line, end - line);
+			if (header.size() > kName.size() &&
+				std::equal(kName.begin(), kName.end(), header.begin(),
+						   [](char const left, char const right) { return left == std::tolower(static_cast<unsigned char>(right)); }))
+			{
+				std::string_view value = header.substr(kName.size());
+				while (!value.empty() && value.front() == ' ')
+					value.remove_prefix(1);
+
+				std::size_t length{};
+				std::from_chars(value.data(), value.data() + value.size(), length);
+				return length;
+			}
+			line = end + 2;
+		}
+		return 0;
+	}
+
+	std::string m_request;
+};
+
+/// @brief Create the encoder selected by --encoder
+///
+/// @return Null if the name is unknown
+[[nodiscard]] inline std::unique_ptr<Encoder> makeEncoder(bench::Options const &options)
+{
+	std::string_view const name = options.text("encoder", "echo");
+	if (name == "echo")
+		return std::make_unique<EchoEncoder>(options.number<std::size_t>("size", 64));
+	if (name == "http")
+		return std::make_unique<HttpEncoder>(options.text("host", "127.0.0.1"), options.text("path", "/"));
+	return nullptr;
+}
+}  // namespace loadgen
@@ -0,0 +1,352 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+//
+// Open-loop load generator: requests are issued on a fixed schedule regardless
+// of how quickly responses arrive.
+//
+// Each connection has its own schedule of intended send times, staggered so the
+// total rate is even. Latency is measured from the intended send time rather
+// than the actual one, so a stalled server or generator is charged for every
+// request it delayed instead of silently slowing the schedule down (coordinated
+// omission). Requests are pipelined; responses are matched to requests in order.
+//
+// Options:
+//   --rate N             Total requests per second (default 10000)
+//   --connections N      Connections to the target (default 16)
+//   --threads N          Generating threads, each owning a share of the connections (default 2)
+//   --encoder NAME       Request encoder, echo (default) or http; see Encoders.hpp
+//   --size N             Request size of the echo encoder in bytes (default 64)
+//   --path PATH          Request path of the http encoder (default /)
+//   --host HOST          Target host (default 127.0.0.1)
+//   --port N             Target port (default 45004)
+//   --serve              Serve echo on the loopback port in-process instead of using an external target
+//   --seconds N          Measured duration (default 5)
+//   --warmup-seconds N   Unmeasured duration before measuring (default 1)
+//   --drain-seconds N    Time allowed for outstanding responses after the last request (default 1)
+//   --hdr                Also print the full corrected latency distribution
+//   --json               Print results as JSON lines
+//
+// Build with TCP_ENABLE_SYSCALL_COUNTING, e.g. msbuild /p:TcpSyscallCounting=true,
+// to also report socket calls per request.
+#include "../Common/Benchmark.hpp"
+#include "Encoders.hpp"
+
+#include <tcp/clock.hpp>
+#include <tcp/histogram.hpp>
+#include <tcp/tcp.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+struct Request
+{
+	std::int64_t intended; ///< When the schedule called for it
+	std::int64_t queued;   ///< When the generator got around to it
+};
+
+struct Connection
+{
+	tcp::Socket socket{};
+	std::unique_ptr<loadgen::Encoder> encoder{};
+	std::deque<Request> outstanding{};
+	std::vector<char> output{};
+	std::vector<char> input{};
+	std::size_t written{};
+	std::size_t framed{};
+	std::uint64_t sequence{};
+	std::int64_t next{}; ///< Intended time of the next request
+};
+
+/// @brief Absolute times shared by every generating thread
+struct Schedule
+{
+	std::int64_t interval; ///< Between requests on one connection
+	std::int64_t measureBegin;
+	std::int64_t measureEnd; ///< No requests are intended after this
+	std::int64_t deadline;   ///< Outstanding requests are abandoned after this
+
+	[[nodiscard]] bool measured(std::int64_t const intended) const noexcept
+	{
+		return intended >= measureBegin && intended < measureEnd;
+	}
+};
+
+struct alignas(64) Results
+{
+	tcp::Histogram corrected{};   ///< From intended send time
+	tcp::Histogram uncorrected{}; ///< From when the request was queued
+	std::uint64_t completed{};
+	std::uint64_t unanswered{};
+	std::uint64_t failed{};
+};
+
+/// @brief Flush pending output without blocking
+///
+/// @return False on error
+bool flush(Connection &connection) noexcept
+{
+	while (connection.written != connection.output.size())
+	{
+		std::size_t const sent = connection.socket.send(connection.output.data() + connection.written,
+														connection.output.size() - connection.written);
+		if (sent == static_cast<std::size_t>(SOCKET_ERROR))
+			return bench::wouldBlock();
+		connection.written += sent;
+	}
+	connection.output.clear();
+	connection.written = 0;
+	return true;
+}
+
+/// @brief Receive without blocking and record every complete response
+///
+/// @return False on error, close, or a response nothing was sent for
+bool collect(Connection &connection, std::vector<char> &buffer, Schedule const &schedule, Results &results)
+{
+	for (;;)
+	{
+		std::size_t const received = connection.socket.receive(buffer.data(), buffer.size());
+		if (received == static_cast<std::size_t>(SOCKET_ERROR) && bench::wouldBlock())
+			break;
+		if (received == static_cast<std::size_t>(SOCKET_ERROR) || received == 0)
+			return false;
+		connection.input.insert(connection.input.end(), buffer.data(), buffer.data() + received);
+	}
+
+	std::int64_t const now = tcp::Clock::nanoseconds();
+	while (connection.framed != connection.input.size())
+	{
+		std::size_t const size = connection.encoder->frame(connection.input.data() + connection.framed,
+														   connection.input.size() - connection.framed);
+		if (size == 0)
+			break;
+		if (connection.outstanding.empty())
+			return false;
+
+		Request const request = connection.outstanding.front();
+		connection.outstanding.pop_front();
+		connection.framed += size;
+		if (schedule.measured(request.intended))
+		{
+			results.corrected.record(static_cast<std::uint64_t>(now - request.intended));
+			results.uncorrected.record(static_cast<std::uint64_t>(now - request.queued));
+			++results.completed;
+		}
+	}
+
+	// Compact once the consumed prefix dominates
+	if (connection.framed == connection.input.size())
+	{
+		connection.input.clear();
+		connection.framed = 0;
+	}
+	else if (connection.framed > connection.input.size() / 2)
+	{
+		connection.input.erase(connection.input.begin(), connection.input.begin() + std::ptrdiff_t(connection.framed));
+		connection.framed = 0;
+	}
+	return true;
+}
+
+/// @brief Issue requests on schedule and collect responses until drained or past the deadline
+void generate(std::vector<Connection*> connections, Schedule const &schedule, Results &results)
+{
+	std::vector<char> buffer(64 * 1024);
+	for (;;)
+	{
+		std::int64_t const now = tcp::Clock::nanoseconds();
+		if (now >= schedule.deadline)
+			break;
+
+		bool waiting{};
+		for (auto iterator = connections.begin(); iterator != connections.end();)
+		{
+			Connection &connection = **iterator;
+			for (; connection.next <= now && connection.next < schedule.measureEnd; connection.next += schedule.interval)
+			{
+				connection.encoder->encode(connection.sequence++, connection.output);
+				connection.outstanding.push_back(Request{connection.next, now});
+			}
+
+			if (!flush(connection) || !collect(connection, buffer, schedule, results))
+			{
+				++results.failed;
+				for (Request const &request : connection.outstanding)
+					results.unanswered += schedule.measured(request.intended);
+				connection.socket.close();
+				iterator = connections.erase(iterator);
+				continue;
+			}
+			waiting |= !connection.outstanding.empty() || connection.next < schedule.measureEnd;
+			++iterator;
+		}
+		if (!waiting)
+			break;
+		std::this_thread::yield();
+	}
+
+	for (Connection const *connection : connections)
+		for (Request const &request : connection->outstanding)
+			results.unanswered += schedule.measured(request.intended);
+}
+
+/// @brief Echo everything received until the peer closes
+void echo(tcp::Socket const socket)
+{
+	std::vector<char> buffer(64 * 1024);
+	for (;;)
+	{
+		std::size_t const received = socket.receive(buffer.data(), buffer.size());
+		if (received == static_cast<std::size_t>(SOCKET_ERROR) || received == 0 ||
+			!bench::sendAll(socket, buffer.data(), received))
+			return;
+	}
+}
+
+int benchmark(bench::Options const &options)
+{
+	auto const rate = std::max(1.0, options.number("rate", 10'000.0));
+	auto const count = std::max<std::size_t>(1, options.number<std::size_t>("connections", 16));
+	auto const threads = std::clamp<std::size_t>(options.number<std::size_t>("threads", 2), 1, count);
+	auto const port = options.number<std::uint16_t>("port", 45004);
+	bool const serve = options.has("serve");
+
+	tcp::Socket listener{};
+	tcp::Endpoint target{INADDR_LOOPBACK, port};
+	if (serve)
+		listener = bench::listen(port);
+	else
+		target = tcp::Endpoint::lookup(options.text("host", "127.0.0.1"), port);
+	if (serve && !listener)
+	{
+		std::printf("failed to listen\n");
+		return 1;
+	}
+
+	std::vector<Connection> connections(count);
+	std::vector<std::thread> servers;
+	for (Connection &connection : connections)
+	{
+		connection.encoder = loadgen::makeEncoder(options);
+		if (!connection.encoder)
+		{
+			std::printf("unknown encoder\n");
+			return 1;
+		}
+
+		bool connected{};
+		if (serve)
+		{
+			tcp::Socket server{};
+			connected = bench::connect(listener, port, connection.socket, server);
+			if (connected)
+				servers.emplace_back(echo, std::move(server));
+		}
+		else
+		{
+			connection.socket = tcp::Socket::create();
+			connected = connection.socket.connect(target);
+		}
+		if (!connected || !bench::configure(connection.socket, bench::Mode::NonBlocking))
+		{
+			std::printf("failed to connect\n");
+			for (Connection &opened : connections)
+				opened.socket.close();
+			for (std::thread &server : servers)
+				server.join();
+			return 1;
+		}
+	}
+
+	// Every connection sends at rate / count, offset so the total is evenly spaced
+	std::int64_t const begin = tcp::Clock::nanoseconds() + bench::nanoseconds(0.01);
+	Schedule schedule{};
+	schedule.interval = std::max<std::int64_t>(1, bench::nanoseconds(double(count) / rate));
+	schedule.measureBegin = begin + bench::nanoseconds(options.number("warmup-seconds", 1.0));
+	schedule.measureEnd = schedule.measureBegin + bench::nanoseconds(options.number("seconds", 5.0));
+	schedule.deadline = schedule.measureEnd + bench::nanoseconds(options.number("drain-seconds", 1.0));
+	for (std::size_t i{}; i != count; ++i)
+		connections[i].next = begin + schedule.interval * std::int64_t(i) / std::int64_t(count);
+
+	std::vector<Results> results(threads);
+	std::vector<std::thread> generators;
+	for (std::size_t i{}; i != threads; ++i)
+	{
+		std::vector<Connection*> owned;
+		for (std::size_t j = i; j < count; j += threads)
+			owned.push_back(&connections[j]);
+		generators.emplace_back(generate, std::move(owned), std::cref(schedule), std::ref(results[i]));
+	}
+
+	// Socket calls over the measured window
+	auto const sleepUntil = [](std::int64_t const time)
+	{
+		std::this_thread::sleep_for(std::chrono::nanoseconds{std::max<std::int64_t>(0, time - tcp::Clock::nanoseconds())});
+	};
+	sleepUntil(schedule.measureBegin);
+	std::uint64_t calls = bench::syscalls();
+	sleepUntil(schedule.measureEnd);
+	calls = bench::syscalls() - calls;
+
+	for (std::thread &generator : generators)
+		generator.join();
+
+	// Closing the clients ends the echo threads
+	for (Connection &connection : connections)
+		connection.socket.close();
+	for (std::thread &server : servers)
+		server.join();
+
+	Results total{};
+	for (Results const &result : results)
+	{
+		total.corrected.merge(result.corrected);
+		total.uncorrected.merge(result.uncorrected);
+		total.completed += result.completed;
+		total.unanswered += result.unanswered;
+		total.failed += result.failed;
+	}
+
+	double const seconds = double(schedule.measureEnd - schedule.measureBegin) / 1e9;
+	auto const us = [](tcp::Histogram const &histogram, double const percentile)
+	{
+		return double(histogram.percentile(percentile)) / 1000.0;
+	};
+	bench::Report{options}.add("encoder", options.text("encoder", "echo")).add("connections", std::uint64_t{count})
+		.add("target/s", double(count) * 1e9 / double(schedule.interval))
+		.add("achieved/s", double(total.completed) / seconds)
+		.add("unanswered", total.unanswered).add("failed", total.failed)
+		.add("p50_us", us(total.corrected, 50.0)).add("p90_us", us(total.corrected, 90.0))
+		.add("p99_us", us(total.corrected, 99.0)).add("p99.9_us", us(total.corrected, 99.9))
+		.add("max_us", double(total.corrected.max()) / 1000.0)
+		.add("raw_p99_us", us(total.uncorrected, 99.0))
+		.addSyscalls(calls, total.completed).print();
+	if (options.has("hdr"))
+		total.corrected.print(std::cout, 1000.0);
+	return total.failed || total.unanswered ? 1 : 0;
+}
+}  // namespace
+
+int main(int const argc, char const *const *argv)
+{
+	bench::Options const options{argc, argv};
+	if (!tcp::startup())
+		return 1;
+	tcp::Clock::calibrate();
+
+	// Sockets are scoped within benchmark which ensures their dtors are called
+	// prior to tcp::shutdown
+	int const result = benchmark(options);
+
+	tcp::shutdown();
+	return result;
+}
@@ -0,0 +1,227 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+//
+// Micro-benchmarks of the byte-order and Endpoint primitives on the
+// per-connection and per-log-line paths.
+//
+// Each kernel is a non-inlined extern "C" function over an array of runtime
+// inputs, so its loop can be found by name in a disassembly (e.g. /FAs or
+// dumpbin /disasm) and cannot be folded into the caller. Timings are per
+// element; the best and median of several repetitions are reported.
+//
+// Options:
+//   --filter TEXT        Only run kernels whose name contains TEXT
+//   --elements N         Inputs per kernel call (default 1024)
+//   --milliseconds N     Duration of each repetition (default 100)
+//   --repetitions N      Repetitions per kernel (default 7)
+//   --cpu N              Processor to pin to (default 0, negative to not pin)
+//   --json               Print results as JSON lines
+#include "../Common/Benchmark.hpp"
+
+#include <tcp/clock.hpp>
+#include <tcp/counters.hpp>
+#include <tcp/tcp.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef _MSC_VER
+# define MICRO_KERNEL extern "C" __declspec(noinline)
+#else
+# define MICRO_KERNEL extern "C" __attribute__((noinline))
+#endif  // _MSC_VER
+
+MICRO_KERNEL std::uint64_t microSwapBytes8(std::uint8_t const *values, std::size_t const size) noexcept
+{
+	std::uint64_t sum{};
+	for (std::size_t i{}; i != size; ++i)
+		sum += tcp::internal::swapBytes(values[i]);
+	return sum;
+}
+MICRO_KERNEL std::uint64_t microSwapBytes16(std::uint16_t const *values, std::size_t const size) noexcept
+{
+	std::uint64_t sum{};
+	for (std::size_t i{}; i != size; ++i)
+		sum += tcp::internal::swapBytes(values[i]);
+	return sum;
+}
+MICRO_KERNEL std::uint64_t microSwapBytes32(std::uint32_t const *values, std::size_t const size) noexcept
+{
+	std::uint64_t sum{};
+	for (std::size_t i{}; i != size; ++i)
+		sum += tcp::internal::swapBytes(values[i]);
+	return sum;
+}
+MICRO_KERNEL std::uint64_t microSwapBytes64(std::uint64_t const *values, std::size_t const size) noexcept
+{
+	std::uint64_t sum{};
+	for (std::size_t i{}; i != size; ++i)
+		sum ^= tcp::internal::swapBytes(values[i]);
+	return sum;
+}
+MICRO_KERNEL std::uint64_t microDerive(std::string const *ips, std::size_t const size) noexcept
+{
+	std::uint64_t sum{};
+	for (std::size_t i{}; i != size; ++i)
+		sum += tcp::Endpoint::derive(ips[i], 80).address();
+	return sum;
+}
+MICRO_KERNEL std::uint64_t microIp(tcp::Endpoint const *endpoints, std::size_t const size) noexcept
+{
+	std::uint64_t sum{};
+	for (std::size_t i{}; i != size; ++i)
+		sum += static_cast<unsigned char>(endpoints[i].ip()[6]);
+	return sum;
+}
+MICRO_KERNEL std::uint64_t microCompare(tcp::Endpoint const *endpoints, std::size_t const size) noexcept
+{
+	std::uint64_t equal{};
+	for (std::size_t i{1}; i < size; ++i)
+		equal += endpoints[i] == endpoints[i - 1];
+	return equal;
+}
+MICRO_KERNEL std::uint64_t microLookup(std::size_t const size) noexcept
+{
+	std::uint64_t sum{};
+	for (std::size_t i{}; i != size; ++i)
+		sum += tcp::Endpoint::lookup("localhost", 80).address();
+	return sum;
+}
+
+namespace {
+/// @brief Keeps kernel results observable so calls are not discarded
+volatile std::uint64_t gSink{};
+
+struct Inputs
+{
+	explicit Inputs(std::size_t const size)
+	{
+		std::mt19937_64 random{size};
+		for (std::size_t i{}; i != size; ++i)
+		{
+			std::uint64_t const value = random();
+			bytes.push_back(static_cast<std::uint8_t>(value));
+			shorts.push_back(static_cast<std::uint16_t>(value));
+			words.push_back(static_cast<std::uint32_t>(value));
+			longs.push_back(value);
+
+			// Mostly distinct with occasional repeats, so comparison is not predictable
+			auto const address = static_cast<std::uint32_t>(value % 4 ? value : longs.front());
+			tcp::Endpoint const endpoint{address, static_cast<std::uint16_t>(value >> 32)};
+			endpoints.push_back(endpoint);
+			ips.emplace_back(endpoint.ip().data());
+		}
+	}
+
+	std::vector<std::uint8_t> bytes;
+	std::vector<std::uint16_t> shorts;
+	std::vector<std::uint32_t> words;
+	std::vector<std::uint64_t> longs;
+	std::vector<tcp::Endpoint> endpoints;
+	std::vector<std::string> ips;
+};
+
+struct Timing
+{
+	double best{};   ///< Nanoseconds per element
+	double median{}; ///< Nanoseconds per element
+	double cycles{}; ///< Per element in the best repetition, zero if unavailable
+};
+
+/// @brief Time repetitions of a kernel, each call processing elements inputs
+template<class Kernel> Timing measure(Kernel const &kernel, std::size_t const elements, bench::Options const &options)
+{
+	auto const duration = static_cast<std::int64_t>(options.number("milliseconds", 100.0) * 1e6);
+	auto const repetitions = std::max<std::size_t>(1, options.number<std::size_t>("repetitions", 7));
+	tcp::Counters const counters = tcp::Counters::open();
+
+	// Size batches so clock reads are negligible
+	std::size_t batch{1};
+	for (std::int64_t const begin = tcp::Clock::nanoseconds();; batch *= 2)
+	{
+		for (std::size_t i{}; i != batch; ++i)
+			gSink = gSink + kernel();
+		if (tcp::Clock::nanoseconds() - begin > duration / 100)
+			break;
+	}
+
+	std::vector<double> perElement;
+	Timing timing{};
+	for (std::size_t repetition{}; repetition != repetitions; ++repetition)
+	{
+		std::uint64_t calls{};
+		tcp::CounterSample const beginCounters = counters.read();
+		std::int64_t const begin = tcp::Clock::nanoseconds(), end = begin + duration;
+		std::int64_t now{};
+		do
+		{
+			for (std::size_t i{}; i != batch; ++i)
+				gSink = gSink + kernel();
+			calls += batch;
+		} while ((now = tcp::Clock::nanoseconds()) < end);
+		std::uint64_t const cycles = (counters.read() - beginCounters)[tcp::Counter::Cycles];
+
+		double const elapsed = double(now - begin) / double(calls * elements);
+		if (perElement.empty() || elapsed < timing.best)
+		{
+			timing.best = elapsed;
+			timing.cycles = counters.available(tcp::Counter::Cycles) ? double(cycles) / double(calls * elements) : 0.0;
+		}
+		perElement.push_back(elapsed);
+	}
+	std::nth_element(perElement.begin(), perElement.begin() + std::ptrdiff_t(perElement.size() / 2), perElement.end());
+	timing.median = perElement[perElement.size() / 2];
+	return timing;
+}
+
+int benchmark(bench::Options const &options)
+{
+	auto const elements = std::max<std::size_t>(2, options.number<std::size_t>("elements", 1024));
+	std::string_view const filter = options.text("filter", {});
+	bench::pin(options.number("cpu", 0));
+
+	Inputs const inputs{elements};
+	auto const run = [&](char const *name, std::size_t const count, auto const &kernel)
+	{
+		if (std::string_view{name}.find(filter) == std::string_view::npos)
+			return;
+
+		Timing const timing = measure(kernel, count, options);
+		bench::Report report{options};
+		report.add("kernel", name).add("ns/op", timing.best).add("median_ns/op", timing.median);
+		if (timing.cycles)
+			report.add("cycles/op", timing.cycles);
+		else
+			report.add("cycles/op", "n/a");
+		report.print();
+	};
+
+	run("microSwapBytes8", elements, [&] { return microSwapBytes8(inputs.bytes.data(), elements); });
+	run("microSwapBytes16", elements, [&] { return microSwapBytes16(inputs.shorts.data(), elements); });
+	run("microSwapBytes32", elements, [&] { return microSwapBytes32(inputs.words.data(), elements); });
+	run("microSwapBytes64", elements, [&] { return microSwapBytes64(inputs.longs.data(), elements); });
+	run("microDerive", elements, [&] { return microDerive(inputs.ips.data(), elements); });
+	run("microIp", elements, [&] { return microIp(inputs.endpoints.data(), elements); });
+	run("microCompare", elements - 1, [&] { return microCompare(inputs.endpoints.data(), elements); });
+	run("microLookup", 1, [] { return microLookup(1); }); // Bound by the resolver, so one call per op
+	return 0;
+}
+}  // namespace
+
+int main(int const argc, char const *const *argv)
+{
+	bench::Options const options{argc, argv};
+	if (!tcp::startup())
+		return 1;
+	tcp::Clock::calibrate();
+
+	int const result = benchmark(options);
+
+	tcp::shutdown();
+	return result;
+}
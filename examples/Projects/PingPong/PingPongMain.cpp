@@ -0,0 +1,157 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+//
+// Round-trip latency between two pinned threads over loopback.
+//
+// Options:
+//   --sizes 1,16,...    Payload sizes in bytes (default 1 to 64KiB in powers of four)
+//   --mode MODE         blocking, non-blocking or all (default); non-blocking spins,
+//                       so give each thread its own core
+//   --iterations N      Measured round trips per case (default 100000)
+//   --warmup N          Unmeasured round trips per case (default 10000)
+//   --client-cpu N      Processor of the measuring thread (default 0, negative to not pin);
+//                       a case fails if pinning does
+//   --server-cpu N      Processor of the echoing thread (default 1, negative to not pin)
+//   --port N            Loopback port to listen on (default 45001)
+//   --hdr               Also print the full percentile distribution of each case
+//   --json              Print results as JSON lines
+//
+// Build with TCP_ENABLE_SYSCALL_COUNTING, e.g. msbuild /p:TcpSyscallCounting=true,
+// to also report socket calls per round trip.
+#include "../Common/Benchmark.hpp"
+
+#include <tcp/clock.hpp>
+#include <tcp/histogram.hpp>
+#include <tcp/tcp.hpp>
+
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+struct Case
+{
+	bench::Mode mode;
+	std::size_t size;
+	std::size_t iterations;
+	std::size_t warmup;
+};
+
+/// @brief Measure round trips of one payload size in one mode
+///
+/// @param calls Socket calls of both threads over the measured round trips
+/// @return False if the connection could not be established or failed part-way
+bool run(Case const &test, bench::Options const &options, tcp::Socket const &listener, tcp::Histogram &histogram,
+		 std::uint64_t &calls)
+{
+	tcp::Socket client{}, server{};
+	if (!bench::connect(listener, options.number<std::uint16_t>("port", 45001), client, server) ||
+		!bench::configure(client, test.mode) || !bench::configure(server, test.mode))
+		return false;
+
+	std::size_t const total = test.warmup + test.iterations;
+	bool echoed{true};
+	std::thread echo{[&]
+	{
+		if (int const cpu = options.number("server-cpu", 1); !bench::pin(cpu))
+		{
+			std::printf("failed to pin the echoing thread to processor %d\n", cpu);
+			echoed = false;
+		}
+
+		std::vector<char> buffer(test.size);
+		for (std::size_t i{}; i != total && echoed; ++i)
+			echoed = bench::receiveAll(server, buffer.data(), buffer.size()) &&
+					 bench::sendAll(server, buffer.data(), buffer.size());
+		// Unblock the client, which would otherwise wait for an echo forever
+		if (!echoed)
+			::shutdown(server.handle(), SD_BOTH);
+	}};
+
+	bool completed{true};
+	if (int const cpu = options.number("client-cpu", 0); !bench::pin(cpu))
+	{
+		std::printf("failed to pin the measuring thread to processor %d\n", cpu);
+		completed = false;
+	}
+
+	std::vector<char> buffer(test.size, 'x');
+	for (std::size_t i{}; i != total && completed; ++i)
+	{
+		if (i == test.warmup)
+			calls = bench::syscalls();
+
+		std::int64_t const begin = tcp::Clock::nanoseconds();
+		completed = bench::sendAll(client, buffer.data(), buffer.size()) &&
+					bench::receiveAll(client, buffer.data(), buffer.size());
+		std::int64_t const end = tcp::Clock::nanoseconds();
+
+		if (i >= test.warmup)
+			histogram.record(static_cast<std::uint64_t>(end - begin));
+	}
+	calls = bench::syscalls() - calls;
+
+	client.close();
+	echo.join();
+	return completed && echoed;
+}
+
+/// @brief Run every requested case and print a row for each
+int benchmark(bench::Options const &options)
+{
+	std::vector<std::size_t> const sizes = options.numbers("sizes", {1, 4, 16, 64, 256, 1024, 4096, 16384, 65536});
+	auto const iterations = options.number<std::size_t>("iterations", 100'000);
+	auto const warmup = options.number<std::size_t>("warmup", 10'000);
+
+	tcp::Socket const listener = bench::listen(options.number<std::uint16_t>("port", 45001));
+	if (!listener)
+	{
+		std::printf("failed to listen\n");
+		return 1;
+	}
+
+	int result{};
+	for (bench::Mode const mode : bench::modes(options))
+		for (std::size_t const size : sizes)
+		{
+			tcp::Histogram histogram{};
+			std::uint64_t calls{};
+			if (!run(Case{mode, size ? size : 1, iterations, warmup}, options, listener, histogram, calls))
+			{
+				std::printf("%-13s %8zu failed\n", bench::name(mode), size);
+				result = 1;
+				continue;
+			}
+
+			auto const us = [&](double const percentile) { return double(histogram.percentile(percentile)) / 1000.0; };
+			bench::Report{options}.add("mode", bench::name(mode)).add("bytes", std::uint64_t{size})
+				.add("min_us", double(histogram.min()) / 1000.0).add("p50_us", us(50.0)).add("p90_us", us(90.0))
+				.add("p99_us", us(99.0)).add("p99.9_us", us(99.9)).add("p99.99_us", us(99.99))
+				.add("max_us", double(histogram.max()) / 1000.0).addSyscalls(calls, histogram.count()).print();
+			if (options.has("hdr"))
+			{
+				histogram.print(std::cout, 1000.0);
+				std::cout << std::endl;
+			}
+		}
+	return result;
+}
+}  // namespace
+
+int main(int const argc, char const *const *argv)
+{
+	bench::Options const options{argc, argv};
+	if (!tcp::startup())
+		return 1;
+	tcp::Clock::calibrate();
+
+	// Sockets are scoped within benchmark which ensures their dtors are called
+	// prior to tcp::shutdown
+	int const result = benchmark(options);
+
+	tcp::shutdown();
+	return result;
+}
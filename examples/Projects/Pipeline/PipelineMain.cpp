@@ -0,0 +1,311 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+//
+// One high-rate connection whose server decodes, validates, handles and
+// encodes each request, either inline after each receive or as a
+// tcp::Pipeline spread over threads.
+//
+// A client streams fixed-size requests and reads a response to each, checking
+// that every response arrives in order with the right result. The inline
+// server runs every stage on its receiving thread. The pipelined server
+// assigns the stages to executors with --layout. Leading stages on executor 0
+// run on the receiving thread. Each other run of adjacent stages on one
+// executor is a thread of the pipeline, fed by a bounded queue, so 1,2,1,2 has
+// four threads and 0,1,0,1 three. The encode stage gathers the responses to
+// each batch and sends them in one call, or sends each one if it runs on the
+// receiving thread. Each run reports throughput and the mean batch taken from
+// a queue.
+//
+// Options:
+//   --messages N         Requests per run (default 1000000)
+//   --work N             Rounds of hashing per request in the handle stage (default 256)
+//   --layout N,N,N,N     Executors of decode, validate, handle and encode; adjacent stages
+//                        on one executor share a thread (default 0,0,1,2)
+//   --capacity N         Requests each pipeline queue holds (default 1024)
+//   --batch N            Most requests a pipeline thread takes at once (default 64)
+//   --port N             Loopback port to listen on (default 45015)
+//   --json               Print results as JSON lines
+#include "../Common/Benchmark.hpp"
+
+#include <tcp/clock.hpp>
+#include <tcp/pipeline.hpp>
+#include <tcp/tcp.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+constexpr std::size_t kRequest{64};  ///< Identifier, value and check, then padding
+constexpr std::size_t kResponse{16}; ///< Identifier and result
+constexpr std::uint64_t kKey{0x9E3779B97F4A7C15};
+
+[[nodiscard]] constexpr std::uint64_t mix(std::uint64_t value, std::size_t const rounds) noexcept
+{
+	for (std::size_t i{}; i != rounds; ++i)
+	{
+		value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9;
+		value = (value ^ (value >> 27)) * 0x94D049BB133111EB;
+		value ^= value >> 31;
+	}
+	return value;
+}
+
+struct Message
+{
+	std::array<char, kRequest> request{};
+	std::uint64_t id{};
+	std::uint64_t value{};
+	std::uint64_t check{};
+	std::uint64_t result{};
+};
+
+/// @brief The stages of the server, shared by both modes
+struct Server
+{
+	bool decode(Message &message) const noexcept
+	{
+		std::memcpy(&message.id, message.request.data(), sizeof(message.id));
+		std::memcpy(&message.value, message.request.data() + 8, sizeof(message.value));
+		std::memcpy(&message.check, message.request.data() + 16, sizeof(message.check));
+		return true;
+	}
+	bool validate(Message const &message) const noexcept
+	{
+		return message.check == (message.id ^ message.value ^ kKey);
+	}
+	bool handle(Message &message) const noexcept
+	{
+		message.result = mix(message.value, work);
+		return true;
+	}
+	/// @brief Gather the response, to be sent by flush
+	bool encode(Message const &message)
+	{
+		std::size_t const offset = responses.size();
+		responses.resize(offset + kResponse);
+		std::memcpy(responses.data() + offset, &message.id, sizeof(message.id));
+		std::memcpy(responses.data() + offset + 8, &message.result, sizeof(message.result));
+		return true;
+	}
+	bool flush() noexcept
+	{
+		bool const sent = bench::sendAll(socket, responses.data(), responses.size());
+		responses.clear();
+		return sent;
+	}
+	/// @brief Give up on the run; shutting the connection down ends the client's threads too
+	void fail() noexcept
+	{
+		if (!failed.exchange(true))
+			::shutdown(socket.handle(), SD_BOTH);
+	}
+	/// @brief Fail the run unless a stage kept its message
+	bool check(bool const kept) noexcept
+	{
+		if (!kept)
+			fail();
+		return kept;
+	}
+
+	tcp::Socket const &socket;
+	std::size_t work;
+	std::vector<char> responses{};
+	std::atomic<bool> failed{};
+};
+
+/// @brief Receive requests until count have arrived, passing each to accept
+///
+/// @return False once receiving, accepting a request or flushing fails
+template<class Accept> bool receive(tcp::Socket const &socket, std::size_t const count, Accept &&accept)
+{
+	std::vector<char> buffer(kRequest * 1024);
+	std::size_t filled{};
+	for (std::size_t received{}; received != count;)
+	{
+		std::size_t const bytes = socket.receive(buffer.data() + filled, buffer.size() - filled);
+		if (bytes == 0 || bytes == static_cast<std::size_t>(SOCKET_ERROR))
+			return false;
+		filled += bytes;
+		std::size_t offset{};
+		for (; offset + kRequest <= filled; offset += kRequest, ++received)
+		{
+			Message message{};
+			std::memcpy(message.request.data(), buffer.data() + offset, kRequest);
+			if (!accept(std::move(message)))
+				return false;
+		}
+		if (!accept.flush())
+			return false;
+		std::memmove(buffer.data(), buffer.data() + offset, filled - offset);
+		filled -= offset;
+	}
+	return true;
+}
+
+struct Ran
+{
+	double seconds{};
+	double batch{};
+	bool completed{};
+};
+
+Ran run(tcp::Socket const &client, tcp::Socket const &server, bench::Options const &options, bool const pipelined)
+{
+	auto const messages = options.number<std::size_t>("messages", 1000000);
+	auto const work = options.number<std::size_t>("work", 256);
+	std::vector<std::size_t> layout = options.numbers("layout", {0, 0, 1, 2});
+	layout.resize(4, layout.empty() ? 0 : layout.back());
+
+	// Client writes every request while reading and checking the responses
+	std::int64_t const start = tcp::Clock::nanoseconds();
+	bool answered{};
+	std::thread reader{[&client, &answered, messages, work]
+	{
+		std::array<char, kResponse * 1024> buffer{};
+		std::uint64_t expected{};
+		while (expected != messages)
+		{
+			std::size_t const count = std::min<std::size_t>(buffer.size() / kResponse, messages - expected);
+			if (!bench::receiveAll(client, buffer.data(), count * kResponse))
+				return;
+			for (std::size_t i{}; i != count; ++i, ++expected)
+			{
+				std::uint64_t id{}, result{};
+				std::memcpy(&id, buffer.data() + i * kResponse, sizeof(id));
+				std::memcpy(&result, buffer.data() + i * kResponse + 8, sizeof(result));
+				if (id != expected || result != mix(mix(id, 1), work))
+					return;
+			}
+		}
+		answered = true;
+	}};
+	std::thread writer{[&client, messages]
+	{
+		std::array<char, kRequest * 256> buffer{};
+		for (std::uint64_t id{}; id < messages;)
+		{
+			std::size_t const count = std::min<std::size_t>(buffer.size() / kRequest, messages - id);
+			for (std::size_t i{}; i != count; ++i, ++id)
+			{
+				std::uint64_t const value = mix(id, 1), check = id ^ value ^ kKey;
+				std::memcpy(buffer.data() + i * kRequest, &id, sizeof(id));
+				std::memcpy(buffer.data() + i * kRequest + 8, &value, sizeof(value));
+				std::memcpy(buffer.data() + i * kRequest + 16, &check, sizeof(check));
+			}
+			if (!bench::sendAll(client, buffer.data(), count * kRequest))
+				return;
+		}
+	}};
+
+	Ran ran{};
+	Server stages{server, work};
+	if (!pipelined)
+	{
+		struct Inline
+		{
+			bool operator()(Message message)
+			{
+				return stages.decode(message) && stages.validate(message) && stages.handle(message) && stages.encode(message);
+			}
+			bool flush() { return stages.flush(); }
+
+			Server &stages;
+		};
+		ran.completed = receive(server, messages, Inline{stages});
+		if (!ran.completed)
+			stages.fail();
+	}
+	else
+	{
+		using Pipeline = tcp::Pipeline<Message>;
+		Pipeline pipeline{{
+			Pipeline::Stage{[&stages](Message &message) { return stages.check(stages.decode(message)); }, layout[0]},
+			Pipeline::Stage{[&stages](Message &message) { return stages.check(stages.validate(message)); }, layout[1]},
+			Pipeline::Stage{[&stages](Message &message) { return stages.check(stages.handle(message)); }, layout[2]},
+			Pipeline::Stage{[&stages](Message &message) { return stages.check(stages.encode(message)); }, layout[3],
+							[&stages] { return stages.check(stages.flush()); }},
+		}, Pipeline::Settings{options.number<std::size_t>("capacity", 1024), std::max<std::size_t>(1, options.number<std::size_t>("batch", 64))}};
+
+		struct Feed
+		{
+			bool operator()(Message message) { return pipeline.push(std::move(message)); }
+			bool flush() noexcept { return true; }
+
+			Pipeline &pipeline;
+		};
+		ran.completed = receive(server, messages, Feed{pipeline});
+		if (!ran.completed)
+			stages.fail();
+		pipeline.close();
+
+		std::vector<double> const batching = pipeline.batching();
+		for (double const batch : batching)
+			ran.batch += batch / double(batching.size());
+	}
+	// A client blocked sending into a connection that no longer reads is only freed from its side
+	if (stages.failed)
+		::shutdown(client.handle(), SD_BOTH);
+	writer.join();
+	reader.join();
+	ran.seconds = double(tcp::Clock::nanoseconds() - start) / 1e9;
+	ran.completed = ran.completed && answered && !stages.failed;
+	return ran;
+}
+
+int benchmark(bench::Options const &options)
+{
+	auto const port = options.number<std::uint16_t>("port", 45015);
+	auto const messages = options.number<std::size_t>("messages", 1000000);
+	tcp::Socket const listener = bench::listen(port);
+	tcp::Socket client{}, server{};
+	if (!listener || !bench::connect(listener, port, client, server))
+	{
+		std::printf("failed to connect\n");
+		return 1;
+	}
+
+	std::string layout{};
+	for (std::size_t const executor : options.numbers("layout", {0, 0, 1, 2}))
+		layout += (layout.empty() ? "" : ",") + std::to_string(executor);
+
+	for (bool const pipelined : {false, true})
+	{
+		Ran const ran = run(client, server, options, pipelined);
+		if (!ran.completed)
+		{
+			std::printf("%s failed\n", pipelined ? "pipeline" : "inline");
+			return 1;
+		}
+		bench::Report{options}.add("mode", pipelined ? "pipeline" : "inline")
+			.add("layout", pipelined ? layout : "-")
+			.add("msg/s", double(messages) / ran.seconds)
+			.add("batch", ran.batch)
+			.print();
+	}
+	return 0;
+}
+}  // namespace
+
+int main(int const argc, char const *const *argv)
+{
+	bench::Options const options{argc, argv};
+	if (!tcp::startup())
+		return 1;
+	tcp::Clock::calibrate();
+
+	// Sockets are scoped within benchmark which ensures their dtors are called
+	// prior to tcp::shutdown
+	int const result = benchmark(options);
+
+	tcp::shutdown();
+	return result;
+}
@@ -0,0 +1,355 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+//
+// Connections that all land on one server loop, as they do when one thread
+// accepts them, spread over the other loops through tcp::async::Balancer. The
+// first --heavy connections cost the server --work microseconds per message,
+// and the rest cost next to nothing.
+//
+// A static run and a balanced run go back to back. The balanced run rebalances
+// every --interval milliseconds, moving busy connections to idle loops. Each
+// run reports its imbalance over the last interval, which is the busiest
+// loop's work divided by the mean.
+//
+// Options:
+//   --loops N            Server loops, and client loops (default 4)
+//   --connections N      Concurrent connections (default 16)
+//   --heavy N            Connections whose messages cost --work (default 4)
+//   --work N             Server work per heavy message in microseconds (default 20)
+//   --size N             Message size in bytes (default 64)
+//   --seconds N          Duration per run (default 1)
+//   --interval N         Milliseconds between measures (default 100)
+//   --port N             Loopback port to listen on (default 45012)
+//   --json               Print results as JSON lines
+#include "../Common/Benchmark.hpp"
+
+#include <tcp/async.hpp>
+#include <tcp/balance.hpp>
+#include <tcp/clock.hpp>
+#include <tcp/histogram.hpp>
+#include <tcp/tcp.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+namespace {
+/// @brief Server side of one connection, doing its work and echoing each message
+struct Session final: tcp::async::Balancer::Member
+{
+	struct Received
+	{
+		void setValue(std::size_t const bytes) noexcept { session->received(bytes); }
+		void setError(int) noexcept {}
+		void setStopped() noexcept { session->stopped(); }
+		[[nodiscard]] std::stop_token stopToken() const noexcept { return session->m_stop.get_token(); }
+
+		Session *session;
+	};
+	struct Sent
+	{
+		void setValue(std::size_t const bytes) noexcept
+		{
+			session->m_pending = session->m_pending.subspan(bytes);
+			session->resume();
+		}
+		void setError(int) noexcept {}
+		void setStopped() noexcept { session->stopped(); }
+		[[nodiscard]] std::stop_token stopToken() const noexcept { return session->m_stop.get_token(); }
+
+		Session *session;
+	};
+	struct Resumed
+	{
+		void setValue() noexcept { session->resume(); }
+		void setError(int) noexcept {}
+		void setStopped() noexcept {}
+
+		Session *session;
+	};
+
+	Session(tcp::async::Loop &loop, tcp::Socket socket, std::size_t const size, std::int64_t const work):
+		Member{loop, &Session::migrate}, m_socket{std::move(socket)}, m_buffer(size), m_work{work} {}
+
+	/// @brief Begin echoing on the loop of the session
+	void start() noexcept { m_resuming.start(loop().scheduler().schedule(), Resumed{this}); }
+
+private:
+	static void migrate(Member &member, tcp::async::Loop&) noexcept
+	{
+		// The operation in flight completes stopped, having transferred nothing
+		static_cast<Session&>(member).m_stop.request_stop();
+	}
+	void stopped() noexcept
+	{
+		m_stop = std::stop_source{};
+		arrive();
+		m_resuming.start(loop().scheduler().schedule(), Resumed{this});
+	}
+	/// @brief Continue with whichever operation is due
+	void resume() noexcept
+	{
+		if (m_pending.empty())
+			m_receiving.start(tcp::async::receive(loop(), m_socket, m_buffer.data(), m_buffer.size()), Received{this});
+		else
+			m_sending.start(tcp::async::send(loop(), m_socket, m_pending.data(), m_pending.size()), Sent{this});
+	}
+	void received(std::size_t const bytes) noexcept
+	{
+		if (bytes == 0)
+			return; // Peer closed
+		std::int64_t const begin = tcp::Clock::nanoseconds();
+		while (tcp::Clock::nanoseconds() - begin < m_work)
+			;
+		charge(static_cast<std::uint64_t>(tcp::Clock::nanoseconds() - begin), bytes);
+		m_pending = {m_buffer.data(), bytes};
+		resume();
+	}
+
+	tcp::Socket m_socket;
+	std::vector<char> m_buffer;
+	std::int64_t m_work;
+	std::span<char> m_pending{};
+	std::stop_source m_stop{};
+	tcp::async::Slot<tcp::async::ReceiveSender, Received> m_receiving{};
+	tcp::async::Slot<tcp::async::SendSender, Sent> m_sending{};
+	tcp::async::Slot<tcp::async::ScheduleSender, Resumed> m_resuming{};
+};
+
+/// @brief Client side of one connection, timing request-response exchanges
+struct Client
+{
+	using Exchange = tcp::async::WhenAllSender<tcp::async::SendSender, tcp::async::ReceiveSender>;
+	struct Exchanged
+	{
+		void setValue(std::size_t const sent, std::size_t const received) noexcept { client->finish(sent, received); }
+		void setError(int) noexcept { client->m_failed = true; }
+		void setStopped() noexcept {}
+
+		Client *client;
+	};
+	struct Received
+	{
+		void setValue(std::size_t const received) noexcept { client->finish(client->m_request.size(), received); }
+		void setError(int) noexcept { client->m_failed = true; }
+		void setStopped() noexcept {}
+
+		Client *client;
+	};
+
+	Client(tcp::async::Loop &loop, tcp::Socket socket, std::size_t const size, std::atomic<bool> const &running):
+		m_loop{loop}, m_socket{std::move(socket)}, m_request(size, 'x'), m_response(size), m_running{running} {}
+
+	[[nodiscard]] tcp::Histogram const &latency() const noexcept { return m_latency; }
+	[[nodiscard]] bool failed() const noexcept { return m_failed; }
+
+	void exchange() noexcept
+	{
+		m_begin = tcp::Clock::nanoseconds();
+		m_received = 0;
+		m_exchanging.start(tcp::async::whenAll(tcp::async::send(m_loop, m_socket, m_request.data(), m_request.size()),
+											   tcp::async::receive(m_loop, m_socket, m_response.data(), m_response.size())),
+						   Exchanged{this});
+	}
+
+private:
+	void finish(std::size_t const sent, std::size_t const received) noexcept
+	{
+		// Messages are small enough to be sent whole; responses may arrive in parts
+		if (sent != m_request.size() || received == 0)
+		{
+			m_failed = true;
+			return;
+		}
+		if ((m_received += received) < m_response.size())
+		{
+			m_receiving.start(tcp::async::receive(m_loop, m_socket, m_response.data() + m_received, m_response.size() - m_received), Received{this});
+			return;
+		}
+		m_latency.record(static_cast<std::uint64_t>(tcp::Clock::nanoseconds() - m_begin));
+		if (m_running.load(std::memory_order_relaxed))
+			exchange();
+	}
+
+	tcp::async::Loop &m_loop;
+	tcp::Socket m_socket;
+	std::vector<char> m_request;
+	std::vector<char> m_response;
+	std::atomic<bool> const &m_running;
+	tcp::Histogram m_latency{};
+	std::int64_t m_begin{};
+	std::size_t m_received{};
+	bool m_failed{};
+	tcp::async::Slot<Exchange, Exchanged> m_exchanging{};
+	tcp::async::Slot<tcp::async::ReceiveSender, Received> m_receiving{};
+};
+
+/// @brief Receiver starting the clients of one loop once scheduled there
+struct Begin
+{
+	void setValue() noexcept
+	{
+		for (std::size_t i = index; i < clients->size(); i += step)
+			(*clients)[i]->exchange();
+	}
+	void setError(int) noexcept {}
+	void setStopped() noexcept {}
+
+	std::vector<std::unique_ptr<Client>> const *clients;
+	std::size_t index;
+	std::size_t step;
+};
+
+struct Ran
+{
+	tcp::Histogram latency{};
+	double seconds{};
+	double imbalance{};
+	std::uint64_t moves{};
+	bool completed{true};
+};
+
+Ran run(tcp::Socket const &listener, bench::Options const &options, bool const balanced)
+{
+	auto const port = options.number<std::uint16_t>("port", 45012);
+	auto const loops = std::max<std::size_t>(2, options.number<std::size_t>("loops", 4));
+	auto const connections = std::max<std::size_t>(1, options.number<std::size_t>("connections", 16));
+	auto const heavy = options.number<std::size_t>("heavy", 4);
+	auto const work = static_cast<std::int64_t>(options.number("work", 20.0) * 1e3);
+	auto const size = std::max<std::size_t>(1, options.number<std::size_t>("size", 64));
+	auto const interval = std::chrono::milliseconds{options.number<int>("interval", 100)};
+
+	Ran ran{};
+	std::vector<std::unique_ptr<tcp::async::Loop>> servers{}, clients{};
+	std::vector<tcp::async::Loop*> serverLoops{};
+	for (std::size_t i{}; i != loops; ++i)
+	{
+		serverLoops.push_back(servers.emplace_back(std::make_unique<tcp::async::Loop>()).get());
+		clients.push_back(std::make_unique<tcp::async::Loop>());
+		ran.completed &= *servers.back() && *clients.back();
+	}
+	tcp::async::Balancer balancer{serverLoops};
+
+	// Every connection starts on the first server loop
+	std::atomic<bool> running{true};
+	std::vector<std::unique_ptr<Session>> sessions{};
+	std::vector<std::unique_ptr<Client>> exchangers{};
+	for (std::size_t i{}; ran.completed && i != connections; ++i)
+	{
+		tcp::Socket client{}, server{};
+		ran.completed = bench::connect(listener, port, client, server) && client.setNoDelay() && server.setNoDelay() &&
+						client.setShouldBlock(false) && server.setShouldBlock(false);
+		if (!ran.completed)
+			break;
+		auto &session = *sessions.emplace_back(std::make_unique<Session>(*servers.front(), std::move(server), size, i < heavy ? work : 0));
+		balancer.add(session);
+		exchangers.push_back(std::make_unique<Client>(*clients[i % loops], std::move(client), size, running));
+	}
+	if (!ran.completed)
+		return ran;
+
+	std::vector<std::thread> threads{};
+	for (std::size_t i{}; i != loops; ++i)
+	{
+		threads.emplace_back([&loop = *servers[i]] { loop.run(); });
+		threads.emplace_back([&loop = *clients[i]] { loop.run(); });
+	}
+
+	// Clients begin on their own loops
+	using Beginning = tcp::async::Slot<tcp::async::ScheduleSender, Begin>;
+	std::vector<std::unique_ptr<Beginning>> beginnings{};
+	for (auto const &session : sessions)
+		session->start();
+	std::int64_t const start = tcp::Clock::nanoseconds();
+	for (std::size_t i{}; i != loops; ++i)
+		beginnings.emplace_back(std::make_unique<Beginning>())->start(clients[i]->scheduler().schedule(), Begin{&exchangers, i, loops});
+
+	std::int64_t const end = start + static_cast<std::int64_t>(options.number("seconds", 1.0) * 1e9);
+	while (tcp::Clock::nanoseconds() < end)
+	{
+		std::this_thread::sleep_for(interval);
+		if (balanced)
+			static_cast<void>(balancer.rebalance());
+		else
+			balancer.measure();
+	}
+	running.store(false);
+	for (auto const &loop : clients)
+		static_cast<void>(tcp::async::syncWait(loop->scheduler().schedule()));
+	ran.seconds = double(tcp::Clock::nanoseconds() - start) / 1e9;
+
+	std::vector<double> const loads = balancer.loads();
+	double const mean = std::accumulate(loads.begin(), loads.end(), 0.0) / double(loads.size());
+	ran.imbalance = mean > 0.0 ? *std::max_element(loads.begin(), loads.end()) / mean : 0.0;
+	ran.moves = balancer.moves();
+
+	for (auto const &loop : clients)
+		loop->stop();
+	for (auto const &loop : servers)
+		loop->stop();
+	for (std::thread &thread : threads)
+		thread.join();
+	for (auto const &exchanger : exchangers)
+	{
+		ran.latency.merge(exchanger->latency());
+		ran.completed &= !exchanger->failed();
+	}
+	return ran;
+}
+
+int benchmark(bench::Options const &options)
+{
+	auto const port = options.number<std::uint16_t>("port", 45012);
+	tcp::Socket const listener = bench::listen(port);
+	if (!listener)
+	{
+		std::printf("failed to listen\n");
+		return 1;
+	}
+
+	int result{};
+	for (bool const balanced : {false, true})
+	{
+		char const *const mode = balanced ? "balanced" : "static";
+		Ran const ran = run(listener, options, balanced);
+		if (!ran.completed)
+		{
+			std::printf("%s failed\n", mode);
+			result = 1;
+			continue;
+		}
+		bench::Report{options}.add("mode", mode)
+			.add("msg/s", double(ran.latency.count()) / ran.seconds)
+			.add("p50_us", double(ran.latency.percentile(50.0)) / 1000.0)
+			.add("p99_us", double(ran.latency.percentile(99.0)) / 1000.0)
+			.add("moves", ran.moves)
+			.add("imbalance", ran.imbalance)
+			.print();
+	}
+	return result;
+}
+}  // namespace
+
+int main(int const argc, char const *const *argv)
+{
+	bench::Options const options{argc, argv};
+	if (!tcp::startup())
+		return 1;
+	tcp::Clock::calibrate();
+
+	// Sockets are scoped within benchmark which ensures their dtors are called
+	// prior to tcp::shutdown
+	int const result = benchmark(options);
+
+	tcp::shutdown();
+	return result;
+}
@@ -0,0 +1,249 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+//
+// A relay node between an echo client and an echo server, forwarding both
+// directions through one tcp::Ring:
+//
+//   client --> relay --> server
+//   client <-- relay <-- server
+//
+// Linked forwarding posts each direction as a receive-send chain, so the ring
+// issues the send as the receive completes and the relay loop runs once per
+// forward. Stepped forwarding returns to the loop after every receive and send.
+// Both modes run back to back and report the relay's ring counters per message.
+//
+// Options:
+//   --size N             Message size in bytes (default 64)
+//   --depth N            Messages in flight (default 1)
+//   --seconds N          Duration per mode (default 1)
+//   --wait MODE          Relay completions: notified (default) or polled
+//   --submit MODE        Relay submission: immediate or deferred (default)
+//   --buffer N           Relay buffer bytes per direction (default 65536)
+//   --port N             Loopback port of the server, and N+1 of the relay (default 45009)
+//   --json               Print results as JSON lines
+#include "../Common/Benchmark.hpp"
+
+#include <tcp/clock.hpp>
+#include <tcp/histogram.hpp>
+#include <tcp/pool.hpp>
+#include <tcp/ring.hpp>
+#include <tcp/tcp.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+/// @brief One direction through the relay
+struct Direction
+{
+	tcp::Ring::Queue *from;
+	tcp::Ring::Queue *to;
+	RIO_BUF buffer;
+	tcp::Ring::Link link{};
+	bool sending{}; ///< Stepped forwarding has the send outstanding
+};
+
+struct Relayed
+{
+	tcp::Ring::Stats stats{};
+	std::uint64_t returns{}; ///< Times the relay loop woke with completions
+	bool failed{};
+};
+
+/// @brief Forward between two sockets until either closes
+Relayed relay(tcp::Socket down, tcp::Socket up, tcp::Ring::Settings const &settings, std::uint32_t const size, bool const linked)
+{
+	Relayed relayed{};
+	tcp::BufferPool pool = tcp::BufferPool::create(2, size);
+	tcp::Ring ring = tcp::Ring::create(settings);
+	tcp::Ring::Queue *const downQueue = ring ? ring.attach(down) : nullptr;
+	tcp::Ring::Queue *const upQueue = ring ? ring.attach(up) : nullptr;
+	if (!pool || !downQueue || !upQueue)
+	{
+		relayed.failed = true;
+		return relayed;
+	}
+
+	std::array directions{Direction{downQueue, upQueue, pool.slice(pool.acquire(), size)},
+						  Direction{upQueue, downQueue, pool.slice(pool.acquire(), size)}};
+	auto const start = [&](Direction &direction)
+	{
+		if (linked)
+		{
+			direction.link = tcp::Ring::Link{direction.to, direction.buffer, &direction};
+			return ring.forward(*direction.from, direction.link);
+		}
+		direction.sending = false;
+		return ring.receive(*direction.from, direction.buffer, &direction);
+	};
+
+	bool open = start(directions[0]) && start(directions[1]);
+	std::array<tcp::Ring::Completion, 8> completions{};
+	while (open)
+	{
+		std::size_t const count = ring.complete(completions.data(), completions.size());
+		if (count == static_cast<std::size_t>(SOCKET_ERROR))
+		{
+			relayed.failed = true;
+			break;
+		}
+		++relayed.returns;
+		for (std::size_t i{}; i != count && open; ++i)
+		{
+			tcp::Ring::Completion const &completion = completions[i];
+			auto &direction = *static_cast<Direction*>(completion.context);
+			if (completion.error || !completion.bytes)
+				open = false;
+			else if (!linked && !direction.sending)
+			{
+				direction.sending = true;
+				open = ring.send(*direction.to, RIO_BUF{direction.buffer.BufferId, direction.buffer.Offset, completion.bytes}, &direction);
+			}
+			else
+				open = start(direction);
+		}
+	}
+
+	// Closing the other side lets the server observe the end
+	down.close();
+	up.close();
+	relayed.stats = ring.stats();
+	return relayed;
+}
+
+struct Exchanged
+{
+	tcp::Histogram latency{};
+	std::uint64_t messages{};
+	double seconds{};
+	bool completed{true};
+};
+
+/// @brief Keep depth messages in flight through the relay for the duration
+Exchanged exchange(tcp::Socket const &client, bench::Options const &options)
+{
+	auto const size = std::max<std::size_t>(1, options.number<std::size_t>("size", 64));
+	auto const depth = std::max<std::size_t>(1, options.number<std::size_t>("depth", 1));
+	std::vector<char> buffer(size, 'x');
+	std::vector<std::int64_t> sent(depth);
+
+	Exchanged exchanged{};
+	std::int64_t const begin = tcp::Clock::nanoseconds();
+	std::int64_t const end = begin + static_cast<std::int64_t>(options.number("seconds", 1.0) * 1e9);
+	for (std::int64_t &time : sent)
+	{
+		time = tcp::Clock::nanoseconds();
+		exchanged.completed &= bench::sendAll(client, buffer.data(), size);
+	}
+	// Messages return in order, so the oldest send time belongs to the next response
+	for (std::size_t oldest{}; exchanged.completed; oldest = (oldest + 1) % depth)
+	{
+		if (!bench::receiveAll(client, buffer.data(), size))
+		{
+			exchanged.completed = false;
+			break;
+		}
+		std::int64_t const now = tcp::Clock::nanoseconds();
+		exchanged.latency.record(static_cast<std::uint64_t>(now - sent[oldest]));
+		++exchanged.messages;
+		if (now >= end)
+			break;
+
+		sent[oldest] = now;
+		exchanged.completed = bench::sendAll(client, buffer.data(), size);
+	}
+	exchanged.seconds = double(tcp::Clock::nanoseconds() - begin) / 1e9;
+	return exchanged;
+}
+
+int benchmark(bench::Options const &options)
+{
+	auto const port = options.number<std::uint16_t>("port", 45009);
+	auto const size = std::max<std::size_t>(1, options.number<std::size_t>("size", 64));
+	tcp::Ring::Settings const settings{
+		.entries = 8,
+		.wait = options.text("wait", "notified") == "polled" ? tcp::Ring::Wait::Polled : tcp::Ring::Wait::Notified,
+		.submit = options.text("submit", "deferred") == "immediate" ? tcp::Ring::Submit::Immediate : tcp::Ring::Submit::Deferred};
+	auto const buffer = options.number<std::uint32_t>("buffer", 65536);
+
+	tcp::Socket const serverListener = bench::listen(port);
+	tcp::Socket const relayListener = bench::listen(port + 1, SOMAXCONN, tcp::Ring::createSocket);
+	if (!serverListener || !relayListener)
+	{
+		std::printf("failed to listen\n");
+		return 1;
+	}
+
+	int result{};
+	for (bool const linked : {true, false})
+	{
+		char const *const mode = linked ? "linked" : "stepped";
+		tcp::Socket client{}, down{}, up{}, server{};
+		if (!bench::connect(relayListener, port + 1, client, down) ||
+			!bench::connect(serverListener, port, up, server, tcp::Ring::createSocket) ||
+			!client.setNoDelay() || !down.setNoDelay() || !up.setNoDelay() || !server.setNoDelay())
+		{
+			std::printf("%s failed to connect\n", mode);
+			result = 1;
+			continue;
+		}
+
+		std::thread echo{[&server, size]
+		{
+			std::vector<char> data(size);
+			while (bench::receiveAll(server, data.data(), size) && bench::sendAll(server, data.data(), size))
+				;
+		}};
+		Relayed relayed{};
+		std::thread forwarder{[&]
+		{
+			relayed = relay(std::move(down), std::move(up), settings, buffer, linked);
+		}};
+
+		Exchanged const exchanged = exchange(client, options);
+		client.close();
+		forwarder.join();
+		echo.join();
+		if (!exchanged.completed || relayed.failed)
+		{
+			std::printf("%s failed\n", mode);
+			result = 1;
+			continue;
+		}
+
+		// Each message costs the relay a receive and a send in each direction
+		double const messages = double(exchanged.messages);
+		bench::Report{options}.add("mode", mode)
+			.add("msg/s", messages / exchanged.seconds)
+			.add("p50_us", double(exchanged.latency.percentile(50.0)) / 1000.0)
+			.add("p99_us", double(exchanged.latency.percentile(99.0)) / 1000.0)
+			.add("wakes/msg", double(relayed.returns) / messages)
+			.add("submits/msg", double(relayed.stats.submitCalls) / messages)
+			.add("saved/msg", double(relayed.stats.submitCallsSaved()) / messages)
+			.add("linked/msg", double(relayed.stats.linked) / messages)
+			.print();
+	}
+	return result;
+}
+}  // namespace
+
+int main(int const argc, char const *const *argv)
+{
+	bench::Options const options{argc, argv};
+	if (!tcp::startup())
+		return 1;
+	tcp::Clock::calibrate();
+
+	// Sockets are scoped within benchmark which ensures their dtors are called
+	// prior to tcp::shutdown
+	int const result = benchmark(options);
+
+	tcp::shutdown();
+	return result;
+}
@@ -0,0 +1,170 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+//
+// One large payload over a loopback connection, materialised whole versus
+// streamed in chunks through tcp::Stream.
+//
+// The whole run builds the payload in one buffer and sends it with a single
+// sendAll, and the receiver fills an equally large buffer before reading it.
+// Each streamed run produces and consumes the payload a chunk at a time, so
+// producing, sending, receiving and consuming overlap. Both sides checksum the
+// payload, and a run only passes if their checksums match. Each run reports
+// throughput and the payload bytes it is configured to hold in memory at once
+// across both sides, the buffers it allocates rather than a measured peak.
+//
+// Options:
+//   --bytes N            Payload size in bytes, rounded down to whole words (default 268435456)
+//   --chunks N,...       Chunk sizes to stream with (default 65536,1048576)
+//   --port N             Loopback port to listen on (default 45014)
+//   --json               Print results as JSON lines
+#include "../Common/Benchmark.hpp"
+
+#include <tcp/clock.hpp>
+#include <tcp/stream.hpp>
+#include <tcp/tcp.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+/// @brief Word at a position of the payload
+[[nodiscard]] constexpr std::uint64_t word(std::uint64_t index) noexcept
+{
+	index = (index ^ (index >> 30)) * 0xBF58476D1CE4E5B9;
+	index = (index ^ (index >> 27)) * 0x94D049BB133111EB;
+	return index ^ (index >> 31);
+}
+
+/// @brief Writes the payload in pieces of whole words
+struct Producer
+{
+	/// @return Bytes written, zero once the payload is complete
+	std::size_t operator()(char *const data, std::size_t const capacity) noexcept
+	{
+		std::size_t const words = std::min<std::uint64_t>(capacity / sizeof(std::uint64_t), total - next);
+		for (std::size_t i{}; i != words; ++i)
+		{
+			std::uint64_t const value = word(next++);
+			sum += value;
+			std::memcpy(data + i * sizeof(value), &value, sizeof(value));
+		}
+		return words * sizeof(std::uint64_t);
+	}
+
+	std::uint64_t total; ///< Words
+	std::uint64_t next{};
+	std::uint64_t sum{};
+};
+/// @brief Checksums the payload in pieces of whole words
+struct Consumer
+{
+	bool operator()(char const *const data, std::size_t const size) noexcept
+	{
+		for (std::size_t offset{}; offset + sizeof(std::uint64_t) <= size; offset += sizeof(std::uint64_t))
+		{
+			std::uint64_t value{};
+			std::memcpy(&value, data + offset, sizeof(value));
+			sum += value;
+		}
+		return size % sizeof(std::uint64_t) == 0;
+	}
+
+	std::uint64_t sum{};
+};
+
+struct Ran
+{
+	double seconds{};
+	std::uint64_t held{}; ///< Payload bytes the run's buffers hold at once, both sides, as configured
+	bool completed{};
+};
+
+Ran whole(tcp::Socket const &client, tcp::Socket const &server, std::uint64_t const words)
+{
+	std::size_t const bytes = words * sizeof(std::uint64_t);
+	Consumer consumer{};
+	bool received{};
+	std::int64_t const start = tcp::Clock::nanoseconds();
+	std::thread receiver{[&server, &consumer, &received, bytes]
+	{
+		std::vector<char> payload(bytes);
+		received = bench::receiveAll(server, payload.data(), payload.size()) && consumer(payload.data(), payload.size());
+	}};
+
+	Producer producer{words};
+	std::vector<char> payload(bytes);
+	producer(payload.data(), payload.size());
+	bool const sent = bench::sendAll(client, payload.data(), payload.size());
+	receiver.join();
+	return Ran{double(tcp::Clock::nanoseconds() - start) / 1e9, 2 * std::uint64_t{bytes},
+			   sent && received && producer.sum == consumer.sum};
+}
+
+Ran stream(tcp::Socket const &client, tcp::Socket const &server, std::uint64_t const words, std::size_t const chunk)
+{
+	tcp::Stream sending{client, chunk};
+	tcp::Stream receiving{server, chunk};
+	Consumer consumer{};
+	bool received{};
+	std::int64_t const start = tcp::Clock::nanoseconds();
+	std::thread receiver{[&receiving, &consumer, &received] { received = receiving.receive(consumer); }};
+
+	Producer producer{words};
+	bool const sent = sending.send(producer);
+	receiver.join();
+	return Ran{double(tcp::Clock::nanoseconds() - start) / 1e9, 4 * std::uint64_t{chunk},
+			   sent && received && producer.sum == consumer.sum && receiving.bytes() == sending.bytes()};
+}
+
+int benchmark(bench::Options const &options)
+{
+	auto const port = options.number<std::uint16_t>("port", 45014);
+	auto const words = options.number<std::uint64_t>("bytes", 268435456) / sizeof(std::uint64_t);
+	tcp::Socket const listener = bench::listen(port);
+	tcp::Socket client{}, server{};
+	if (!listener || !bench::connect(listener, port, client, server))
+	{
+		std::printf("failed to connect\n");
+		return 1;
+	}
+
+	int result{};
+	auto const report = [&options, &result, words](char const *const mode, std::size_t const chunk, Ran const &ran)
+	{
+		if (!ran.completed)
+			result = 1;
+		bench::Report{options}.add("mode", mode)
+			.add("chunk", std::uint64_t{chunk})
+			.add("MB/s", double(words * sizeof(std::uint64_t)) / ran.seconds / 1e6)
+			.add("buffer_bytes", ran.held)
+			.add("verified", ran.completed ? "yes" : "no")
+			.print();
+	};
+	report("whole", 0, whole(client, server, words));
+	for (std::size_t const chunk : options.numbers("chunks", {65536, 1048576}))
+		// Whole words, so every piece handed to the consumer is too
+		report("stream", chunk, stream(client, server, words, std::max<std::size_t>(sizeof(std::uint64_t), chunk / sizeof(std::uint64_t) * sizeof(std::uint64_t))));
+	return result;
+}
+}  // namespace
+
+int main(int const argc, char const *const *argv)
+{
+	bench::Options const options{argc, argv};
+	if (!tcp::startup())
+		return 1;
+	tcp::Clock::calibrate();
+
+	// Sockets are scoped within benchmark which ensures their dtors are called
+	// prior to tcp::shutdown
+	int const result = benchmark(options);
+
+	tcp::shutdown();
+	return result;
+}
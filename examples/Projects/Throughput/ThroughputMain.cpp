@@ -0,0 +1,274 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+//
+// Bulk streaming throughput over loopback connections.
+//
+// Options:
+//   --sizes 64,...          Message sizes in bytes passed to each send/receive (default 64,1024,16384,65536)
+//   --connections 1,...     Connection counts to sweep (default 1,4,16)
+//   --writers N             Sending threads (default one per connection)
+//   --readers N             Receiving threads (default one per connection)
+//   --send-buffer N         Kernel send buffer size in bytes (default left to the OS)
+//   --receive-buffer N      Kernel receive buffer size in bytes (default left to the OS)
+//   --nodelay               Disable send coalescing
+//   --mode MODE             blocking, non-blocking or all (default); blocking requires one
+//                           writer and one reader per connection, non-blocking spins
+//   --seconds N             Measured duration per case (default 2)
+//   --warmup-seconds N      Unmeasured duration per case (default 0.5)
+//   --port N                Loopback port to listen on (default 45002)
+//   --json                  Print results as JSON lines
+//
+// Build with TCP_ENABLE_SYSCALL_COUNTING, e.g. msbuild /p:TcpSyscallCounting=true,
+// to also report socket calls per message.
+#include "../Common/Benchmark.hpp"
+
+#include <tcp/clock.hpp>
+#include <tcp/counters.hpp>
+#include <tcp/tcp.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace {
+struct Connection
+{
+	tcp::Socket client{};
+	tcp::Socket server{};
+	std::size_t offset{}; ///< Progress through the current message when non-blocking
+};
+
+/// @brief Per-thread results, padded against false sharing
+struct alignas(64) Worker
+{
+	std::atomic<std::uint64_t> bytes{};
+	std::uint64_t cycles{};
+	bool failed{};
+};
+
+/// @brief Attributes the cycles of the calling thread to the measured phase
+struct CycleMeter
+{
+	explicit CycleMeter(std::atomic<bench::Phase> const &phase) noexcept: m_phase{phase} {}
+
+	/// @brief Observe the current phase
+	///
+	/// @return False once stopping
+	bool update(Worker &worker) noexcept
+	{
+		bench::Phase const phase = m_phase.load(std::memory_order_relaxed);
+		if (phase == m_seen)
+			return phase != bench::Phase::Stopping;
+
+		if (phase == bench::Phase::Measuring)
+			m_begin = m_counters.read();
+		else if (phase == bench::Phase::Stopping && m_seen == bench::Phase::Measuring)
+			worker.cycles = (m_counters.read() - m_begin)[tcp::Counter::Cycles];
+		m_seen = phase;
+		return phase != bench::Phase::Stopping;
+	}
+
+private:
+	std::atomic<bench::Phase> const &m_phase;
+	tcp::Counters const m_counters{tcp::Counters::open()};
+	tcp::CounterSample m_begin{};
+	bench::Phase m_seen{bench::Phase::Warmup};
+};
+
+void write(std::vector<Connection*> const connections, bench::Mode const mode, std::size_t const size,
+		   std::atomic<bench::Phase> const &phase, Worker &worker)
+{
+	CycleMeter meter{phase};
+	std::vector<char> const buffer(size, 'x');
+	while (meter.update(worker))
+		for (Connection *connection : connections)
+		{
+			if (mode == bench::Mode::Blocking)
+			{
+				if (!bench::sendAll(connection->client, buffer.data(), buffer.size()))
+					worker.failed = true;
+				continue;
+			}
+
+			std::size_t const sent = connection->client.send(buffer.data() + connection->offset, size - connection->offset);
+			if (sent == static_cast<std::size_t>(SOCKET_ERROR))
+				worker.failed |= !bench::wouldBlock();
+			else
+				connection->offset = (connection->offset + sent) % size;
+		}
+}
+void read(std::vector<Connection*> connections, std::size_t const size, std::atomic<bench::Phase> const &phase, Worker &worker)
+{
+	CycleMeter meter{phase};
+	std::vector<char> buffer(size);
+	while (!connections.empty())
+	{
+		meter.update(worker);
+		for (auto iterator = connections.begin(); iterator != connections.end();)
+		{
+			std::size_t const received = (*iterator)->server.receive(buffer.data(), buffer.size());
+			if (received == static_cast<std::size_t>(SOCKET_ERROR) && bench::wouldBlock())
+			{
+				++iterator;
+				continue;
+			}
+			if (received == static_cast<std::size_t>(SOCKET_ERROR) || received == 0)
+			{
+				// Closed by the writer once stopping
+				worker.failed |= phase.load(std::memory_order_relaxed) != bench::Phase::Stopping;
+				iterator = connections.erase(iterator);
+				continue;
+			}
+			worker.bytes.fetch_add(received, std::memory_order_relaxed);
+			++iterator;
+		}
+	}
+	meter.update(worker);
+}
+
+struct Case
+{
+	bench::Mode mode;
+	std::size_t size;
+	std::size_t connections;
+	std::size_t writers;
+	std::size_t readers;
+};
+
+/// @brief Stream over every connection of a case and report the measured rate
+bool run(Case const &test, bench::Options const &options, tcp::Socket const &listener)
+{
+	std::vector<Connection> connections(test.connections);
+	for (Connection &connection : connections)
+	{
+		if (!bench::connect(listener, options.number<std::uint16_t>("port", 45002), connection.client, connection.server))
+			return false;
+
+		for (tcp::Socket const *socket : {&connection.client, &connection.server})
+		{
+			if (auto const bytes = options.number("send-buffer", 0))
+				socket->setSendBufferSize(bytes);
+			if (auto const bytes = options.number("receive-buffer", 0))
+				socket->setReceiveBufferSize(bytes);
+			if (!socket->setNoDelay(options.has("nodelay")) || !socket->setShouldBlock(test.mode == bench::Mode::Blocking))
+				return false;
+		}
+	}
+
+	std::atomic<bench::Phase> phase{bench::Phase::Warmup};
+	std::vector<Worker> writers(test.writers), readers(test.readers);
+	std::vector<std::thread> threads;
+	for (std::size_t i{}; i != test.readers; ++i)
+	{
+		std::vector<Connection*> owned;
+		for (std::size_t j = i; j < connections.size(); j += test.readers)
+			owned.push_back(&connections[j]);
+		threads.emplace_back(read, std::move(owned), test.size, std::cref(phase), std::ref(readers[i]));
+	}
+	for (std::size_t i{}; i != test.writers; ++i)
+	{
+		std::vector<Connection*> owned;
+		for (std::size_t j = i; j < connections.size(); j += test.writers)
+			owned.push_back(&connections[j]);
+		threads.emplace_back(write, std::move(owned), test.mode, test.size, std::cref(phase), std::ref(writers[i]));
+	}
+
+	auto const received = [&]
+	{
+		std::uint64_t bytes{};
+		for (Worker const &reader : readers)
+			bytes += reader.bytes.load(std::memory_order_relaxed);
+		return bytes;
+	};
+	using Seconds = std::chrono::duration<double>;
+	std::this_thread::sleep_for(Seconds{options.number("warmup-seconds", 0.5)});
+
+	phase.store(bench::Phase::Measuring);
+	std::int64_t const begin = tcp::Clock::nanoseconds();
+	std::uint64_t const beginBytes = received(), beginCalls = bench::syscalls();
+	std::this_thread::sleep_for(Seconds{options.number("seconds", 2.0)});
+	std::uint64_t const bytes = received() - beginBytes, calls = bench::syscalls() - beginCalls;
+	double const seconds = double(tcp::Clock::nanoseconds() - begin) / 1e9;
+	phase.store(bench::Phase::Stopping);
+
+	// Writers first, then close their side so blocked readers see the end of stream
+	for (std::size_t i{}; i != test.writers; ++i)
+		threads[test.readers + i].join();
+	for (Connection &connection : connections)
+		connection.client.close();
+	for (std::size_t i{}; i != test.readers; ++i)
+		threads[i].join();
+
+	std::uint64_t cycles{};
+	bool failed{};
+	for (auto const *workers : {&writers, &readers})
+		for (Worker const &worker : *workers)
+		{
+			cycles += worker.cycles;
+			failed |= worker.failed;
+		}
+
+	bench::Report report{options};
+	report.add("mode", bench::name(test.mode)).add("bytes", std::uint64_t{test.size})
+		.add("connections", std::uint64_t{test.connections}).add("writers", std::uint64_t{test.writers})
+		.add("readers", std::uint64_t{test.readers}).add("GB/s", double(bytes) / seconds / 1e9)
+		.add("Mmsg/s", double(bytes) / double(test.size) / seconds / 1e6);
+	if (cycles && bytes)
+		report.add("cycles/byte", double(cycles) / double(bytes));
+	else
+		report.add("cycles/byte", "n/a");
+	report.addSyscalls(calls, bytes / test.size).print();
+	return !failed;
+}
+
+int benchmark(bench::Options const &options)
+{
+	tcp::Socket const listener = bench::listen(options.number<std::uint16_t>("port", 45002));
+	if (!listener)
+	{
+		std::printf("failed to listen\n");
+		return 1;
+	}
+
+	int result{};
+	for (bench::Mode const mode : bench::modes(options))
+		for (std::size_t const connections : options.numbers("connections", {1, 4, 16}))
+			for (std::size_t const size : options.numbers("sizes", {64, 1024, 16384, 65536}))
+			{
+				Case const test{mode, size ? size : 1, connections ? connections : 1,
+								options.number<std::size_t>("writers", connections), options.number<std::size_t>("readers", connections)};
+				if (test.writers == 0 || test.readers == 0 ||
+					(mode == bench::Mode::Blocking && (test.writers != test.connections || test.readers != test.connections)))
+				{
+					std::printf("skipping %s with %zu connections: needs one writer and reader per connection\n",
+								bench::name(mode), test.connections);
+					continue;
+				}
+				if (!run(test, options, listener))
+				{
+					std::printf("%s with %zu connections of %zu bytes failed\n", bench::name(mode), test.connections, test.size);
+					result = 1;
+				}
+			}
+	return result;
+}
+}  // namespace
+
+int main(int const argc, char const *const *argv)
+{
+	bench::Options const options{argc, argv};
+	if (!tcp::startup())
+		return 1;
+	tcp::Clock::calibrate();
+
+	// Sockets are scoped within benchmark which ensures their dtors are called
+	// prior to tcp::shutdown
+	int const result = benchmark(options);
+
+	tcp::shutdown();
+	return result;
+}
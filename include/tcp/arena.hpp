@@ -0,0 +1,130 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+
+namespace tcp {
+/// @brief Bump allocator for the scratch memory of one request at a time
+///
+/// Allocation advances a pointer through one contiguous block. Deallocation does
+/// nothing. reset, called once the response is sent, releases everything at
+/// once. A request that outgrows the block continues in further blocks from
+/// upstream. The next reset then replaces them with a single block large enough
+/// for all of them. Once the arena has seen its largest request, it asks the
+/// upstream for nothing more.
+///
+/// Use it as a std::pmr::memory_resource, so that pmr containers decoding a
+/// request draw from the connection's arena. It is used by one thread at a time.
+struct Arena final: std::pmr::memory_resource
+{
+	/// @param capacity Initial bytes, allocated on first use
+	/// @param upstream Source of blocks
+	explicit Arena(std::size_t const capacity = 4096, std::pmr::memory_resource *const upstream = std::pmr::get_default_resource()) noexcept:
+		m_upstream{upstream}, m_capacity{capacity} {}
+	~Arena() noexcept override
+	{
+		release();
+	}
+
+	/// @brief Non copy-constructible
+	Arena(Arena const&) = delete;
+	/// @brief Non copy-assignable
+	Arena &operator=(Arena const&) = delete;
+
+	/// @brief End the request, making all memory allocated from the arena available again
+	void reset() noexcept
+	{
+		if (m_blocks && m_blocks->next)
+		{
+			// Outgrown; one block for the whole of the largest request keeps the next contiguous
+			m_capacity = std::max(m_capacity, m_peak);
+			release();
+		}
+		m_current = m_blocks ? m_blocks->data() : nullptr;
+		m_end = m_blocks ? m_current + m_blocks->size : nullptr;
+		m_used = 0;
+	}
+
+	/// @brief Access bytes allocated since the last reset, including alignment padding
+	[[nodiscard]] constexpr std::size_t used() const noexcept { return m_used; }
+	/// @brief Access most bytes used by one request
+	[[nodiscard]] constexpr std::size_t peak() const noexcept { return m_peak; }
+	/// @brief Access number of blocks taken from upstream
+	[[nodiscard]] constexpr std::uint64_t refills() const noexcept { return m_refills; }
+
+private:
+	struct Block
+	{
+		Block *next;
+		std::size_t size; ///< Usable bytes following the header
+
+		[[nodiscard]] std::byte *data() noexcept { return reinterpret_cast<std::byte*>(this + 1); }
+	};
+
+	void *do_allocate(std::size_t const bytes, std::size_t const alignment) override
+	{
+		auto const address = reinterpret_cast<std::uintptr_t>(m_current);
+		std::size_t const padding = (alignment - address % alignment) % alignment;
+		if (!m_current || std::size_t(m_end - m_current) < padding + bytes)
+			return refill(bytes, alignment);
+
+		std::byte *const pointer = m_current + padding;
+		m_current = pointer + bytes;
+		account(padding + bytes);
+		return pointer;
+	}
+	void do_deallocate(void*, std::size_t, std::size_t) noexcept override {}
+	[[nodiscard]] bool do_is_equal(std::pmr::memory_resource const &other) const noexcept override
+	{
+		return this == &other;
+	}
+
+	/// @brief Continue in a new block, at least doubling the last
+	void *refill(std::size_t const bytes, std::size_t const alignment)
+	{
+		std::size_t const size = std::max({m_capacity, bytes + alignment, m_blocks ? m_blocks->size * 2 : 0});
+		auto *const block = static_cast<Block*>(m_upstream->allocate(sizeof(Block) + size, alignof(Block)));
+		m_blocks = ::new (block) Block{m_blocks, size};
+		++m_refills;
+
+		std::byte *const data = block->data();
+		auto const address = reinterpret_cast<std::uintptr_t>(data);
+		std::byte *const pointer = data + (alignment - address % alignment) % alignment;
+		// Padding wasted at the end of the previous block still counts, so peak covers a single block
+		account(std::size_t(m_end - m_current) + std::size_t(pointer - data) + bytes);
+		m_current = pointer + bytes;
+		m_end = data + size;
+		return pointer;
+	}
+	void account(std::size_t const bytes) noexcept
+	{
+		m_used += bytes;
+		m_peak = std::max(m_peak, m_used);
+	}
+	void release() noexcept
+	{
+		while (Block *const block = m_blocks)
+		{
+			m_blocks = block->next;
+			m_upstream->deallocate(block, sizeof(Block) + block->size, alignof(Block));
+		}
+		m_current = m_end = nullptr;
+	}
+
+	std::pmr::memory_resource *m_upstream;
+	std::size_t m_capacity;
+	Block *m_blocks{}; ///< Newest first
+	std::byte *m_current{};
+	std::byte *m_end{};
+	std::size_t m_used{};
+	std::size_t m_peak{};
+	std::uint64_t m_refills{};
+};
+}  // namespace tcp
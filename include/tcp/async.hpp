@@ -0,0 +1,811 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <tcp/tcp.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Asynchronous socket operations in the sender/receiver model.
+//
+// A sender describes work and lists the values it completes with in Values.
+// connect(receiver) binds it into an operation state, which start() begins.
+// The operation then calls exactly one of receiver.setValue(values...),
+// setError(code) with a WSA error code, or setStopped(). Operation states are
+// neither copied nor moved. Compositions therefore hold their children inline,
+// and no operation allocates.
+//
+// Socket operations need non-blocking sockets. They are attempted when started
+// and, if they would block, retried on their loop's thread once the socket is
+// ready. They therefore complete either inline from start or on the loop. A
+// chain of operations each started from the last one's completion is posted to
+// the loop every so often, so that other operations get their turn.
+//
+// A receiver may provide stopToken(), returning a std::stop_token. Stopping it
+// removes a waiting socket operation from its loop and completes it with
+// setStopped, so its buffer is returned without waiting for the socket.
+namespace tcp {
+namespace async {
+namespace internal {
+/// @brief Operation parked on a loop until its socket is ready, or posted to run there
+struct Waiter
+{
+	using Resume = void (*)(Waiter&) noexcept;
+
+	constexpr Waiter(Resume const resume, SOCKET const socket = INVALID_SOCKET, short const events = 0) noexcept:
+		resume{resume}, socket{socket}, events{events} {}
+
+	/// @brief Non copy-constructible
+	Waiter(Waiter const&) = delete;
+	/// @brief Non copy-assignable
+	Waiter &operator=(Waiter const&) = delete;
+
+	Resume resume;
+	SOCKET socket; ///< INVALID_SOCKET for posted work
+	short events;
+	bool cancelled{}; ///< Stopped before the loop admitted it; posted instead of parked
+	bool deferred{};  ///< Held back by the inline limit; posted instead of parked
+	Waiter *next{};   ///< Link in the loop's inbox
+};
+
+/// @brief Receiver whose operations may be stopped
+template<class Receiver> concept Stoppable = requires(Receiver const &receiver)
+{
+	{ receiver.stopToken() } -> std::convertible_to<std::stop_token>;
+};
+
+template<class... Tuples> using Concat = decltype(std::tuple_cat(std::declval<Tuples>()...));
+template<class Sender, class Receiver> using OperationOf = decltype(std::declval<Sender const&>().connect(std::declval<Receiver>()));
+}  // namespace internal
+
+struct Scheduler;
+
+/// @brief I/O thread that waits for sockets with WSAPoll and resumes their operations
+///
+/// Any thread may start operations on a loop; they resume on the thread in run.
+struct Loop
+{
+	/// @brief Creates the loopback connection used to wake the loop; test validity before use
+	Loop() noexcept
+	{
+		Socket const listener = Socket::create();
+		Endpoint endpoint{INADDR_LOOPBACK, 0}, peer{};
+		int size{sizeof(endpoint.raw())};
+		if (!listener.bind(endpoint) || ::getsockname(listener.handle(), &endpoint.raw(), &size) != 0 || !listener.listen(1))
+			return;
+		m_wakeSend = Socket::create();
+		if (!m_wakeSend.connect(endpoint) || !listener.accept(m_wakeReceive, peer) ||
+			!m_wakeReceive.setShouldBlock(false) || !m_wakeSend.setNoDelay())
+			m_wakeReceive = Socket{};
+	}
+
+	/// @brief Non copy-constructible
+	Loop(Loop const&) = delete;
+	/// @brief Non copy-assignable
+	Loop &operator=(Loop const&) = delete;
+
+	/// @brief Test validity of loop
+	[[nodiscard]] explicit operator bool() const noexcept { return !!m_wakeReceive; }
+
+	/// @brief Returns scheduler whose work runs on this loop
+	[[nodiscard]] Scheduler scheduler() noexcept;
+
+	/// @brief Resume operations on the calling thread until stop
+	void run() noexcept
+	{
+		m_thread.store(std::this_thread::get_id());
+		for (;;)
+		{
+			// Cleared before testing for stop and taking the inbox, so a later stop or post always wakes the poll
+			m_woken.store(false);
+			if (m_stopped.load())
+				break;
+			admit();
+			poll(m_posted.empty() ? -1 : 0);
+
+			// Work posted while running waits for the next pass, so sockets are not starved
+			m_running.swap(m_posted);
+			for (internal::Waiter *const waiter : m_running)
+				if (waiter)
+					waiter->resume(*waiter);
+			m_running.clear();
+		}
+		m_thread.store(std::thread::id{});
+	}
+	/// @brief Make run return after its current pass; callable from any thread
+	void stop() noexcept
+	{
+		m_stopped.store(true);
+		wake();
+	}
+	/// @brief Test whether the calling thread is running this loop
+	[[nodiscard]] bool running() const noexcept { return m_thread.load(std::memory_order_relaxed) == std::this_thread::get_id(); }
+
+	/// @brief Park an operation until its socket is ready, or post it if it has none or is deferred
+	void wait(internal::Waiter &waiter) noexcept
+	{
+		if (running())
+		{
+			(waiter.socket == INVALID_SOCKET || waiter.cancelled || waiter.deferred ? m_posted : m_waiting).push_back(&waiter);
+			return;
+		}
+		{
+			std::scoped_lock const lock{m_mutex};
+			waiter.next = nullptr;
+			(m_inboxTail ? m_inboxTail->next : m_inbox) = &waiter;
+			m_inboxTail = &waiter;
+		}
+		wake();
+	}
+	/// @brief Take an operation parked on a socket or posted off the loop; called on the loop's thread
+	///
+	/// @return Whether the operation was on the loop
+	bool remove(internal::Waiter const &waiter) noexcept
+	{
+		if (auto const found = std::find(m_waiting.begin(), m_waiting.end(), &waiter); found != m_waiting.end())
+		{
+			*found = m_waiting.back();
+			m_waiting.pop_back();
+			return true;
+		}
+		if (auto const found = std::find(m_posted.begin(), m_posted.end(), &waiter); found != m_posted.end())
+		{
+			m_posted.erase(found);
+			return true;
+		}
+		// Due later in the pass now running, so its entry is cleared rather than erased
+		if (auto const found = std::find(m_running.begin(), m_running.end(), &waiter); found != m_running.end())
+		{
+			*found = nullptr;
+			return true;
+		}
+		return false;
+	}
+
+private:
+	void wake() noexcept
+	{
+		if (!m_woken.exchange(true))
+		{
+			char const byte{};
+			m_wakeSend.send(&byte, 1);
+		}
+	}
+	/// @brief Take operations handed over by other threads
+	void admit() noexcept
+	{
+		internal::Waiter *waiter{};
+		{
+			std::scoped_lock const lock{m_mutex};
+			waiter = std::exchange(m_inbox, nullptr);
+			m_inboxTail = nullptr;
+		}
+		for (; waiter; waiter = waiter->next)
+			(waiter->socket == INVALID_SOCKET || waiter->cancelled || waiter->deferred ? m_posted : m_waiting).push_back(waiter);
+	}
+	void poll(int const ms) noexcept
+	{
+		m_descriptors.clear();
+		m_descriptors.push_back(WSAPOLLFD{m_wakeReceive.handle(), POLLRDNORM, 0});
+		for (internal::Waiter const *const waiter : m_waiting)
+			m_descriptors.push_back(WSAPOLLFD{waiter->socket, waiter->events, 0});
+
+		TCP_COUNT_SYSCALL(Poll);
+		if (::WSAPoll(m_descriptors.data(), ULONG(m_descriptors.size()), ms) <= 0)
+			return;
+		if (m_descriptors.front().revents)
+		{
+			char bytes[64];
+			while (m_wakeReceive.receive(bytes, sizeof(bytes)) == sizeof(bytes))
+				;
+		}
+
+		// Ready operations leave the list before resuming, since resuming may park them again
+		std::size_t kept{};
+		for (std::size_t i{}; i != m_waiting.size(); ++i)
+		{
+			if (m_descriptors[i + 1].revents)
+				m_running.push_back(m_waiting[i]);
+			else
+				m_waiting[kept++] = m_waiting[i];
+		}
+		m_waiting.resize(kept);
+		for (internal::Waiter *const waiter : m_running)
+			if (waiter)
+				waiter->resume(*waiter);
+		m_running.clear();
+	}
+
+	Socket m_wakeSend{};
+	Socket m_wakeReceive{};
+	std::atomic<bool> m_woken{};
+	std::atomic<bool> m_stopped{};
+	std::atomic<std::thread::id> m_thread{};
+
+	std::mutex m_mutex{};
+	internal::Waiter *m_inbox{};     ///< Handed over by other threads, oldest first
+	internal::Waiter *m_inboxTail{};
+
+	std::vector<internal::Waiter*> m_waiting{}; ///< Parked on sockets
+	std::vector<internal::Waiter*> m_posted{};  ///< To run on the next pass
+	std::vector<internal::Waiter*> m_running{};
+	std::vector<WSAPOLLFD> m_descriptors{};
+};
+
+template<class Receiver> struct ScheduleOperation final: internal::Waiter
+{
+	ScheduleOperation(Loop &loop, Receiver receiver) noexcept:
+		internal::Waiter{&ScheduleOperation::resume}, m_loop{loop}, m_receiver{std::move(receiver)} {}
+
+	void start() noexcept { m_loop.wait(*this); }
+
+private:
+	static void resume(internal::Waiter &waiter) noexcept { static_cast<ScheduleOperation&>(waiter).m_receiver.setValue(); }
+
+	Loop &m_loop;
+	Receiver m_receiver;
+};
+/// @brief Completes on the thread of a loop
+struct ScheduleSender
+{
+	using Values = std::tuple<>;
+
+	template<class Receiver> [[nodiscard]] ScheduleOperation<Receiver> connect(Receiver receiver) const noexcept
+	{
+		return ScheduleOperation<Receiver>{loop, std::move(receiver)};
+	}
+
+	Loop &loop;
+};
+/// @brief Handle through which work is sent to a loop
+struct Scheduler
+{
+	[[nodiscard]] ScheduleSender schedule() const noexcept { return ScheduleSender{*loop}; }
+	[[nodiscard]] bool operator==(Scheduler const&) const noexcept = default;
+
+	Loop *loop;
+};
+inline Scheduler Loop::scheduler() noexcept
+{
+	return Scheduler{this};
+}
+
+namespace internal {
+constexpr std::size_t kInlineLimit{16}; ///< Operations completing within one another before one is posted to the loop
+
+/// @brief Access depth of operations attempted within one another on the calling thread
+[[nodiscard]] inline std::size_t &inlineDepth() noexcept
+{
+	thread_local std::size_t depth{};
+	return depth;
+}
+
+/// @brief Socket call retried on its loop each time the socket is ready
+///
+/// Derived::attempt returns true once it has completed the receiver, false to wait.
+template<class Derived, class Receiver> struct SocketOperation: Waiter
+{
+	SocketOperation(Loop &loop, SOCKET const socket, short const events, Receiver &&receiver) noexcept:
+		Waiter{&SocketOperation::resume, socket, events}, m_receiver{std::move(receiver)}, m_loop{loop}, m_stop{*this} {}
+
+	void start() noexcept
+	{
+		if constexpr (Stoppable<Receiver>)
+		{
+			if (m_receiver.stopToken().stop_requested())
+			{
+				m_receiver.setStopped();
+				return;
+			}
+		}
+		step();
+	}
+
+protected:
+	/// @brief Complete with the last error unless the call would block
+	bool fail() noexcept
+	{
+		int const error = ::WSAGetLastError();
+		if (error == WSAEWOULDBLOCK)
+			return false;
+		m_receiver.setError(error);
+		return true;
+	}
+
+	Receiver m_receiver;
+
+private:
+	/// @brief Runs on the thread requesting stop, handing the cancellation to the loop
+	struct OnStop
+	{
+		void operator()() const noexcept
+		{
+			operation->m_stop.requested.store(true);
+			operation->m_loop.wait(operation->m_stop.cancel);
+		}
+
+		SocketOperation *operation;
+	};
+	struct Cancel final: Waiter
+	{
+		explicit Cancel(SocketOperation &operation) noexcept:
+			Waiter{&SocketOperation::cancel}, operation{operation} {}
+
+		SocketOperation &operation;
+	};
+	struct Stop
+	{
+		explicit Stop(SocketOperation &operation) noexcept: cancel{operation} {}
+
+		std::optional<std::stop_callback<OnStop>> callback{}; ///< Registered only while waiting
+		std::atomic<bool> requested{};
+		bool dropped{}; ///< Resumed by its socket after the stop, so left for the cancellation
+		Cancel cancel;
+	};
+	struct NoStop
+	{
+		explicit constexpr NoStop(SocketOperation&) noexcept {}
+	};
+
+	void step() noexcept
+	{
+		// Completions run within whatever started them, so a chain of operations that keep
+		// completing at once would starve the loop and grow the stack without this limit.
+		// Past it the attempt runs on the loop's next pass, whatever the socket's state.
+		std::size_t &depth = inlineDepth();
+		deferred = depth >= kInlineLimit;
+		if (!deferred)
+		{
+			++depth;
+			bool const completed = static_cast<Derived&>(*this).attempt();
+			--depth;
+			// Completing may end the lifetime of this operation, so it is not touched after
+			if (completed)
+				return;
+		}
+		if constexpr (Stoppable<Receiver>)
+		{
+			// A stop requested from here on is seen by the loop before this operation resumes
+			if (std::stop_token token = m_receiver.stopToken(); token.stop_possible())
+				m_stop.callback.emplace(std::move(token), OnStop{this});
+		}
+		m_loop.wait(*this);
+	}
+	static void resume(Waiter &waiter) noexcept
+	{
+		auto &operation = static_cast<SocketOperation&>(waiter);
+		if constexpr (Stoppable<Receiver>)
+		{
+			// Waits out a stop in progress, after which a stop has either posted its cancellation or cannot
+			operation.m_stop.callback.reset();
+			if (operation.m_stop.requested.load())
+			{
+				if (operation.cancelled)
+					operation.m_receiver.setStopped();
+				else
+					operation.m_stop.dropped = true;
+				return;
+			}
+		}
+		operation.step();
+	}
+	/// @brief Complete a stopped operation on the loop's thread
+	static void cancel(Waiter &waiter) noexcept
+	{
+		SocketOperation &operation = static_cast<Cancel&>(waiter).operation;
+		if (operation.m_loop.remove(operation) || operation.m_stop.dropped)
+		{
+			operation.m_stop.callback.reset();
+			operation.m_receiver.setStopped();
+		}
+		else
+			operation.cancelled = true; // Still on its way to the loop, which resumes it on arrival
+	}
+
+	Loop &m_loop;
+	[[no_unique_address]] std::conditional_t<Stoppable<Receiver>, Stop, NoStop> m_stop;
+};
+}  // namespace internal
+
+template<class Receiver> struct SendOperation final: internal::SocketOperation<SendOperation<Receiver>, Receiver>
+{
+	SendOperation(Loop &loop, Socket const &socket, void const *const data, std::size_t const size, Receiver receiver) noexcept:
+		internal::SocketOperation<SendOperation, Receiver>{loop, socket.handle(), POLLWRNORM, std::move(receiver)},
+		m_socket{socket}, m_data{data}, m_size{size} {}
+
+	bool attempt() noexcept
+	{
+		std::size_t const sent = m_socket.send(static_cast<char const*>(m_data), m_size);
+		if (sent == static_cast<std::size_t>(SOCKET_ERROR))
+			return this->fail();
+		this->m_receiver.setValue(sent);
+		return true;
+	}
+
+private:
+	Socket const &m_socket;
+	void const *m_data;
+	std::size_t m_size;
+};
+/// @brief Sends once, completing with the number of bytes sent
+struct SendSender
+{
+	using Values = std::tuple<std::size_t>;
+
+	template<class Receiver> [[nodiscard]] SendOperation<Receiver> connect(Receiver receiver) const noexcept
+	{
+		return SendOperation<Receiver>{loop, socket, data, size, std::move(receiver)};
+	}
+
+	Loop &loop;
+	Socket const &socket;
+	void const *data;
+	std::size_t size;
+};
+
+template<class Receiver> struct ReceiveOperation final: internal::SocketOperation<ReceiveOperation<Receiver>, Receiver>
+{
+	ReceiveOperation(Loop &loop, Socket const &socket, void *const data, std::size_t const size, Receiver receiver) noexcept:
+		internal::SocketOperation<ReceiveOperation, Receiver>{loop, socket.handle(), POLLRDNORM, std::move(receiver)},
+		m_socket{socket}, m_data{data}, m_size{size} {}
+
+	bool attempt() noexcept
+	{
+		std::size_t const received = m_socket.receive(static_cast<char*>(m_data), m_size);
+		if (received == static_cast<std::size_t>(SOCKET_ERROR))
+			return this->fail();
+		this->m_receiver.setValue(received);
+		return true;
+	}
+
+private:
+	Socket const &m_socket;
+	void *m_data;
+	std::size_t m_size;
+};
+/// @brief Receives once, completing with the number of bytes received; zero if the peer closed
+struct ReceiveSender
+{
+	using Values = std::tuple<std::size_t>;
+
+	template<class Receiver> [[nodiscard]] ReceiveOperation<Receiver> connect(Receiver receiver) const noexcept
+	{
+		return ReceiveOperation<Receiver>{loop, socket, data, size, std::move(receiver)};
+	}
+
+	Loop &loop;
+	Socket const &socket;
+	void *data;
+	std::size_t size;
+};
+
+template<class Receiver> struct AcceptOperation final: internal::SocketOperation<AcceptOperation<Receiver>, Receiver>
+{
+	AcceptOperation(Loop &loop, Socket const &listener, Receiver receiver) noexcept:
+		internal::SocketOperation<AcceptOperation, Receiver>{loop, listener.handle(), POLLRDNORM, std::move(receiver)},
+		m_listener{listener} {}
+
+	bool attempt() noexcept
+	{
+		// Socket::accept closes the socket it replaces, which would overwrite the error
+		Endpoint endpoint{};
+		int size{sizeof(endpoint.raw())};
+		TCP_COUNT_SYSCALL(Accept);
+		SOCKET const socket = ::accept(m_listener.handle(), &endpoint.raw(), &size);
+		if (socket == INVALID_SOCKET)
+			return this->fail();
+		this->m_receiver.setValue(Socket{socket}, endpoint);
+		return true;
+	}
+
+private:
+	Socket const &m_listener;
+};
+/// @brief Accepts one connection, completing with its socket, non-blocking like the listener, and endpoint
+struct AcceptSender
+{
+	using Values = std::tuple<Socket, Endpoint>;
+
+	template<class Receiver> [[nodiscard]] AcceptOperation<Receiver> connect(Receiver receiver) const noexcept
+	{
+		return AcceptOperation<Receiver>{loop, listener, std::move(receiver)};
+	}
+
+	Loop &loop;
+	Socket const &listener;
+};
+
+template<class Receiver> struct ConnectOperation final: internal::SocketOperation<ConnectOperation<Receiver>, Receiver>
+{
+	ConnectOperation(Loop &loop, Socket const &socket, Endpoint const &endpoint, Receiver receiver) noexcept:
+		internal::SocketOperation<ConnectOperation, Receiver>{loop, socket.handle(), POLLWRNORM, std::move(receiver)},
+		m_socket{socket}, m_endpoint{endpoint} {}
+
+	bool attempt() noexcept
+	{
+		if (!m_pending)
+		{
+			if (!m_socket.connect(m_endpoint))
+			{
+				// A connection in progress reports would-block; its outcome follows writability
+				m_pending = true;
+				return this->fail();
+			}
+			this->m_receiver.setValue();
+			return true;
+		}
+
+		int error{}, size{sizeof(error)};
+		TCP_COUNT_SYSCALL(Option);
+		if (::getsockopt(m_socket.handle(), SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &size) != 0)
+			error = ::WSAGetLastError();
+		if (error)
+			this->m_receiver.setError(error);
+		else
+			this->m_receiver.setValue();
+		return true;
+	}
+
+private:
+	Socket const &m_socket;
+	Endpoint m_endpoint;
+	bool m_pending{};
+};
+/// @brief Connects to a remote endpoint
+struct ConnectSender
+{
+	using Values = std::tuple<>;
+
+	template<class Receiver> [[nodiscard]] ConnectOperation<Receiver> connect(Receiver receiver) const noexcept
+	{
+		return ConnectOperation<Receiver>{loop, socket, endpoint, std::move(receiver)};
+	}
+
+	Loop &loop;
+	Socket const &socket;
+	Endpoint endpoint;
+};
+
+/// @brief Returns sender of one send along a non-blocking socket
+[[nodiscard]] inline SendSender send(Loop &loop, Socket const &socket, void const *const data, std::size_t const size) noexcept
+{
+	return SendSender{loop, socket, data, size};
+}
+/// @brief Returns sender of one receive from a non-blocking socket
+[[nodiscard]] inline ReceiveSender receive(Loop &loop, Socket const &socket, void *const data, std::size_t const size) noexcept
+{
+	return ReceiveSender{loop, socket, data, size};
+}
+/// @brief Returns sender of one connection accepted by a non-blocking listener
+[[nodiscard]] inline AcceptSender accept(Loop &loop, Socket const &listener) noexcept
+{
+	return AcceptSender{loop, listener};
+}
+/// @brief Returns sender connecting a non-blocking socket to a remote endpoint
+[[nodiscard]] inline ConnectSender connect(Loop &loop, Socket const &socket, Endpoint const &endpoint) noexcept
+{
+	return ConnectSender{loop, socket, endpoint};
+}
+
+/// @brief Storage for an operation started repeatedly, such as the receive of a connection
+///
+/// Starting again ends the previous operation, which must have completed; this may
+/// be done from within its completion.
+template<class Sender, class Receiver> struct Slot
+{
+	using Operation = internal::OperationOf<Sender, Receiver>;
+
+	Slot() = default;
+	~Slot() noexcept
+	{
+		reset();
+	}
+
+	/// @brief Non copy-constructible
+	Slot(Slot const&) = delete;
+	/// @brief Non copy-assignable
+	Slot &operator=(Slot const&) = delete;
+
+	/// @brief Connect a sender in place and start it
+	void start(Sender const &sender, Receiver receiver) noexcept
+	{
+		reset();
+		// Constructed from the prvalue, as operations cannot be moved
+		auto *const operation = ::new (static_cast<void*>(m_storage)) Operation(sender.connect(std::move(receiver)));
+		m_engaged = true;
+		operation->start();
+	}
+	/// @brief Access the held operation, which must have been started
+	[[nodiscard]] Operation &operation() noexcept { return *std::launder(reinterpret_cast<Operation*>(m_storage)); }
+	/// @brief End the held operation, which must have completed
+	void reset() noexcept
+	{
+		if (std::exchange(m_engaged, false))
+			std::launder(reinterpret_cast<Operation*>(m_storage))->~Operation();
+	}
+
+private:
+	alignas(Operation) std::byte m_storage[sizeof(Operation)];
+	bool m_engaged{};
+};
+
+namespace internal {
+template<class Parent, std::size_t I> struct WhenAllReceiver
+{
+	template<class... Values> void setValue(Values &&...values) noexcept { parent->template setValue<I>(std::forward<Values>(values)...); }
+	void setError(int const error) noexcept { parent->setError(error); }
+	void setStopped() noexcept { parent->setStopped(); }
+	[[nodiscard]] std::stop_token stopToken() const noexcept requires Stoppable<Parent> { return parent->stopToken(); }
+
+	Parent *parent;
+};
+template<class Parent, std::size_t I, class Sender> struct WhenAllChild
+{
+	WhenAllChild(Parent &parent, Sender const &sender) noexcept:
+		operation{sender.connect(WhenAllReceiver<Parent, I>{&parent})} {}
+
+	OperationOf<Sender, WhenAllReceiver<Parent, I>> operation;
+};
+template<class Parent, class Indices, class... Senders> struct WhenAllChildren;
+template<class Parent, std::size_t... I, class... Senders>
+struct WhenAllChildren<Parent, std::index_sequence<I...>, Senders...>: WhenAllChild<Parent, I, Senders>...
+{
+	WhenAllChildren(Parent &parent, std::tuple<Senders...> const &senders) noexcept:
+		WhenAllChild<Parent, I, Senders>{parent, std::get<I>(senders)}... {}
+
+	void start() noexcept { (static_cast<WhenAllChild<Parent, I, Senders>&>(*this).operation.start(), ...); }
+};
+}  // namespace internal
+
+template<class Receiver, class... Senders> struct WhenAllOperation
+{
+	WhenAllOperation(std::tuple<Senders...> const &senders, Receiver receiver) noexcept:
+		m_receiver{std::move(receiver)}, m_children{*this, senders} {}
+
+	/// @brief Non copy-constructible
+	WhenAllOperation(WhenAllOperation const&) = delete;
+	/// @brief Non copy-assignable
+	WhenAllOperation &operator=(WhenAllOperation const&) = delete;
+
+	void start() noexcept { m_children.start(); }
+	/// @brief Stop token of the receiver, passed on to every sender
+	[[nodiscard]] std::stop_token stopToken() const noexcept requires internal::Stoppable<Receiver> { return m_receiver.stopToken(); }
+
+	template<std::size_t I, class... Values> void setValue(Values &&...values) noexcept
+	{
+		std::get<I>(m_values).emplace(std::forward<Values>(values)...);
+		arrive();
+	}
+	void setError(int const error) noexcept
+	{
+		// The first failure decides the outcome
+		int expected{};
+		if (!m_stopped.load(std::memory_order_relaxed))
+			m_error.compare_exchange_strong(expected, error);
+		arrive();
+	}
+	void setStopped() noexcept
+	{
+		if (!m_error.load(std::memory_order_relaxed))
+			m_stopped.store(true, std::memory_order_relaxed);
+		arrive();
+	}
+
+private:
+	void arrive() noexcept
+	{
+		// Children may complete on different threads; the last one completes the parent
+		if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+			return;
+		if (int const error = m_error.load(std::memory_order_relaxed))
+			m_receiver.setError(error);
+		else if (m_stopped.load(std::memory_order_relaxed))
+			m_receiver.setStopped();
+		else
+			std::apply([this](auto &...values)
+			{
+				std::apply([this](auto &&...all) { m_receiver.setValue(std::move(all)...); }, std::tuple_cat(std::move(*values)...));
+			}, m_values);
+	}
+
+	Receiver m_receiver;
+	std::tuple<std::optional<typename Senders::Values>...> m_values{};
+	std::atomic<std::size_t> m_remaining{sizeof...(Senders)};
+	std::atomic<int> m_error{};
+	std::atomic<bool> m_stopped{};
+	internal::WhenAllChildren<WhenAllOperation, std::index_sequence_for<Senders...>, Senders...> m_children;
+};
+/// @brief Completes once all of its senders have, with all of their values in order
+///
+/// If any fails or stops, the first such outcome is reported once all have finished.
+/// A stop token of the receiver stops every sender.
+template<class... Senders> struct WhenAllSender
+{
+	using Values = internal::Concat<typename Senders::Values...>;
+
+	template<class Receiver> [[nodiscard]] WhenAllOperation<Receiver, Senders...> connect(Receiver receiver) const noexcept
+	{
+		return WhenAllOperation<Receiver, Senders...>{senders, std::move(receiver)};
+	}
+
+	std::tuple<Senders...> senders;
+};
+/// @brief Returns sender completing once all given senders have
+template<class... Senders> [[nodiscard]] WhenAllSender<Senders...> whenAll(Senders const &...senders) noexcept
+{
+	return WhenAllSender<Senders...>{{senders...}};
+}
+
+namespace internal {
+template<class Values> struct SyncWaitState
+{
+	std::mutex mutex{};
+	std::condition_variable finished{};
+	std::optional<Values> values{};
+	std::stop_token token{};
+	int error{};
+	bool done{};
+};
+template<class Values> struct SyncWaitReceiver
+{
+	template<class... Arguments> void setValue(Arguments &&...arguments) noexcept
+	{
+		state->values.emplace(std::forward<Arguments>(arguments)...);
+		finish();
+	}
+	void setError(int const error) noexcept
+	{
+		state->error = error;
+		finish();
+	}
+	void setStopped() noexcept { finish(); }
+	[[nodiscard]] std::stop_token stopToken() const noexcept { return state->token; }
+
+	SyncWaitState<Values> *state;
+
+private:
+	void finish() noexcept
+	{
+		// Notified under the lock so the waiter cannot return and end the state first
+		std::scoped_lock const lock{state->mutex};
+		state->done = true;
+		state->finished.notify_one();
+	}
+};
+}  // namespace internal
+
+/// @brief Start a sender and block the calling thread until it completes
+///
+/// @param error Set to the error code if the sender fails
+/// @param token Stops the sender, such as to give up on a connection after a timeout
+/// @return Values of the sender, empty if it failed or stopped
+template<class Sender> [[nodiscard]] std::optional<typename Sender::Values> syncWait(Sender const &sender, int *const error = nullptr,
+																				   std::stop_token token = {})
+{
+	internal::SyncWaitState<typename Sender::Values> state{.token = std::move(token)};
+	auto operation = sender.connect(internal::SyncWaitReceiver<typename Sender::Values>{&state});
+	operation.start();
+
+	std::unique_lock lock{state.mutex};
+	state.finished.wait(lock, [&] { return state.done; });
+	if (error)
+		*error = state.error;
+	return std::move(state.values);
+}
+}  // namespace async
+}  // namespace tcp
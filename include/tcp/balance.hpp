@@ -0,0 +1,189 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <tcp/async.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace tcp {
+namespace async {
+/// @brief Spreads connections over loops by the work measured against each
+///
+/// Connections join as members. Their handlers charge them with the nanoseconds
+/// and bytes their messages cost. Each rebalance compares what the loops were
+/// charged since the last one. If the busiest leads the idlest by more than the
+/// threshold, the member that best evens out the two is moved. Only one member
+/// moves per rebalance, so loads settle over several intervals instead of
+/// swinging back and forth.
+///
+/// A move is dispatched to the member's own loop. There the member stops its
+/// operations. Once none are in flight, it calls arrive and restarts them on
+/// its new loop. Operations completed with setStopped transferred nothing, so
+/// no data is lost or repeated.
+struct Balancer
+{
+	struct Settings
+	{
+		double threshold{0.25};      ///< Lead of the busiest loop over the idlest, as a fraction of the busiest, that warrants a move
+		double nanosecondsPerByte{}; ///< Weight of bytes in the cost of a member, for work not charged in nanoseconds
+	};
+
+	/// @brief Connection able to move between loops
+	struct Member: private internal::Waiter
+	{
+		/// @brief Called on the loop of a member to begin moving it to another
+		using Migrate = void (*)(Member&, Loop &to) noexcept;
+
+		Member(Loop &loop, Migrate const migrate) noexcept:
+			internal::Waiter{&Member::dispatch}, m_migrate{migrate}, m_loop{&loop} {}
+
+		/// @brief Account work done for this member; callable from any thread
+		void charge(std::uint64_t const nanoseconds, std::uint64_t const bytes = 0) noexcept
+		{
+			m_nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+			m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+		}
+		/// @brief Complete a move once no operation is in flight; loop then returns the new loop
+		void arrive() noexcept
+		{
+			m_loop.store(m_target, std::memory_order_release);
+			m_moving.store(false, std::memory_order_release);
+		}
+
+		/// @brief Access loop the member runs on
+		[[nodiscard]] Loop &loop() const noexcept { return *m_loop.load(std::memory_order_acquire); }
+		/// @brief Test whether a move has been dispatched and not yet arrived
+		[[nodiscard]] bool moving() const noexcept { return m_moving.load(std::memory_order_acquire); }
+
+	private:
+		friend Balancer;
+
+		static void dispatch(internal::Waiter &waiter) noexcept
+		{
+			auto &member = static_cast<Member&>(waiter);
+			member.m_migrate(member, *member.m_target);
+		}
+
+		Migrate m_migrate;
+		std::atomic<Loop*> m_loop;
+		Loop *m_target{};
+		std::atomic<bool> m_moving{};
+		std::atomic<std::uint64_t> m_nanoseconds{};
+		std::atomic<std::uint64_t> m_bytes{};
+		double m_cost{}; ///< Total cost at the last measure
+		double m_rate{}; ///< Cost between the last two measures
+	};
+
+	explicit Balancer(std::vector<Loop*> loops) noexcept:
+		Balancer{std::move(loops), Settings{}} {}
+	Balancer(std::vector<Loop*> loops, Settings const &settings) noexcept:
+		m_settings{settings}, m_loops{std::move(loops)}, m_loads(m_loops.size()) {}
+
+	/// @brief Non copy-constructible
+	Balancer(Balancer const&) = delete;
+	/// @brief Non copy-assignable
+	Balancer &operator=(Balancer const&) = delete;
+
+	/// @brief Start weighing a member, which must run on one of the loops
+	void add(Member &member)
+	{
+		std::scoped_lock const lock{m_mutex};
+		m_members.push_back(&member);
+	}
+	/// @brief Stop weighing a member; it must not be moving
+	void remove(Member &member) noexcept
+	{
+		std::scoped_lock const lock{m_mutex};
+		std::erase(m_members, &member);
+	}
+
+	/// @brief Measure the loads since the last measure without moving members
+	void measure() noexcept
+	{
+		std::scoped_lock const lock{m_mutex};
+		update();
+	}
+	/// @brief Measure the loads and move a member if they are uneven; callable from any thread
+	///
+	/// @return Member dispatched to move, nullptr if none
+	Member *rebalance() noexcept
+	{
+		std::scoped_lock const lock{m_mutex};
+		update();
+		if (m_loops.size() < 2)
+			return nullptr;
+
+		auto const [idlest, busiest] = std::minmax_element(m_loads.begin(), m_loads.end());
+		double const gap = *busiest - *idlest;
+		if (gap <= m_settings.threshold * *busiest)
+			return nullptr;
+
+		// Moving half the gap evens the two; anything up to the gap still lowers the busiest
+		Loop *const from = m_loops[std::size_t(busiest - m_loads.begin())];
+		Member *chosen{};
+		for (Member *const member : m_members)
+		{
+			if (&member->loop() != from || member->moving() || member->m_rate <= 0.0 || member->m_rate >= gap)
+				continue;
+			if (!chosen || std::abs(member->m_rate - gap / 2) < std::abs(chosen->m_rate - gap / 2))
+				chosen = member;
+		}
+		if (!chosen)
+			return nullptr;
+
+		chosen->m_target = m_loops[std::size_t(idlest - m_loads.begin())];
+		chosen->m_moving.store(true, std::memory_order_release);
+		++m_moves;
+		from->wait(*chosen);
+		return chosen;
+	}
+
+	/// @brief Access cost charged to each loop between the last two measures
+	[[nodiscard]] std::vector<double> loads() const
+	{
+		std::scoped_lock const lock{m_mutex};
+		return m_loads;
+	}
+	/// @brief Access number of moves dispatched
+	[[nodiscard]] std::uint64_t moves() const noexcept
+	{
+		std::scoped_lock const lock{m_mutex};
+		return m_moves;
+	}
+
+private:
+	void update() noexcept
+	{
+		std::fill(m_loads.begin(), m_loads.end(), 0.0);
+		for (Member *const member : m_members)
+		{
+			double const cost = double(member->m_nanoseconds.load(std::memory_order_relaxed)) +
+				double(member->m_bytes.load(std::memory_order_relaxed)) * m_settings.nanosecondsPerByte;
+			member->m_rate = cost - std::exchange(member->m_cost, cost);
+
+			// A moving member still runs on its old loop
+			auto const loop = std::find(m_loops.begin(), m_loops.end(), &member->loop());
+			if (loop != m_loops.end())
+				m_loads[std::size_t(loop - m_loops.begin())] += member->m_rate;
+		}
+	}
+
+	Settings m_settings;
+	std::vector<Loop*> m_loops;
+	std::vector<double> m_loads;
+	std::vector<Member*> m_members{};
+	std::uint64_t m_moves{};
+	mutable std::mutex m_mutex{};
+};
+}  // namespace async
+}  // namespace tcp
@@ -0,0 +1,193 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace tcp {
+/// @brief Limit on the bytes held in buffers by everything charged to it
+///
+/// Budgets form a tree. A per-loop budget may have the process-wide budget as
+/// its parent, and bytes are taken from a budget and all of its parents at once.
+/// Consumers, such as connections, charge their budget through accounts. The
+/// root keeps every account so that the top consumers can be reported.
+///
+/// Any thread may use a budget and its accounts.
+struct Budget
+{
+	/// @brief Bytes held by one account
+	struct Usage
+	{
+		std::uint64_t id;
+		std::size_t bytes;
+	};
+
+	/// @brief Share of a budget held by one consumer
+	struct Account
+	{
+		/// @param id Identifies the consumer in reports
+		Account(Budget &budget, std::uint64_t const id) noexcept:
+			m_budget{budget}, m_id{id}
+		{
+			Budget &root = m_budget.root();
+			std::scoped_lock const lock{root.m_mutex};
+			m_next = std::exchange(root.m_accounts, this);
+			if (m_next)
+				m_next->m_previous = this;
+		}
+		~Account() noexcept
+		{
+			release(held());
+			Budget &root = m_budget.root();
+			std::scoped_lock const lock{root.m_mutex};
+			(m_previous ? m_previous->m_next : root.m_accounts) = m_next;
+			if (m_next)
+				m_next->m_previous = m_previous;
+		}
+
+		/// @brief Non copy-constructible
+		Account(Account const&) = delete;
+		/// @brief Non copy-assignable
+		Account &operator=(Account const&) = delete;
+
+		/// @brief Take bytes from the budget
+		///
+		/// @return Whether taken; nothing is taken if any budget would exceed its limit
+		[[nodiscard]] bool acquire(std::size_t const bytes) noexcept
+		{
+			if (!m_budget.acquire(bytes))
+				return false;
+			m_held.fetch_add(bytes, std::memory_order_relaxed);
+			return true;
+		}
+		/// @brief Return bytes to the budget
+		void release(std::size_t const bytes) noexcept
+		{
+			m_held.fetch_sub(bytes, std::memory_order_relaxed);
+			m_budget.release(bytes);
+		}
+
+		[[nodiscard]] Budget &budget() const noexcept { return m_budget; }
+		[[nodiscard]] std::uint64_t id() const noexcept { return m_id; }
+		[[nodiscard]] std::size_t held() const noexcept { return m_held.load(std::memory_order_relaxed); }
+
+	private:
+		friend Budget;
+
+		Budget &m_budget;
+		std::uint64_t m_id;
+		std::atomic<std::size_t> m_held{};
+		Account *m_previous{};
+		Account *m_next{};
+	};
+
+	/// @param limit Bytes allowed, zero for no limit
+	/// @param parent Budget also charged with everything charged to this one
+	explicit Budget(std::size_t const limit = 0, Budget *const parent = nullptr) noexcept:
+		m_parent{parent}, m_limit{limit} {}
+
+	/// @brief Non copy-constructible
+	Budget(Budget const&) = delete;
+	/// @brief Non copy-assignable
+	Budget &operator=(Budget const&) = delete;
+
+	/// @brief Take bytes from this budget and its parents
+	///
+	/// @return Whether taken; nothing is taken if any would exceed its limit
+	[[nodiscard]] bool acquire(std::size_t const bytes) noexcept
+	{
+		for (Budget *budget = this; budget; budget = budget->m_parent)
+		{
+			std::size_t const held = budget->m_held.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+			if (budget->m_limit && held > budget->m_limit)
+			{
+				for (Budget *taken = this; taken != budget->m_parent; taken = taken->m_parent)
+					taken->m_held.fetch_sub(bytes, std::memory_order_relaxed);
+				budget->m_rejected.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+		}
+		for (Budget *budget = this; budget; budget = budget->m_parent)
+		{
+			std::size_t const held = budget->m_held.load(std::memory_order_relaxed);
+			std::size_t peak = budget->m_peak.load(std::memory_order_relaxed);
+			while (peak < held && !budget->m_peak.compare_exchange_weak(peak, held, std::memory_order_relaxed))
+				;
+		}
+		return true;
+	}
+	/// @brief Return bytes to this budget and its parents
+	void release(std::size_t const bytes) noexcept
+	{
+		for (Budget *budget = this; budget; budget = budget->m_parent)
+			budget->m_held.fetch_sub(bytes, std::memory_order_relaxed);
+	}
+
+	/// @brief Test whether taking more bytes would exceed the limit of this budget or a parent
+	///
+	/// Readers test this before reading more, so they stop while their output is still queued.
+	[[nodiscard]] bool exhausted(std::size_t const bytes = 1) const noexcept
+	{
+		for (Budget const *budget = this; budget; budget = budget->m_parent)
+			if (budget->m_limit && budget->held() + bytes > budget->m_limit)
+				return true;
+		return false;
+	}
+
+	/// @brief Returns accounts charged to this budget holding the most bytes, most first
+	[[nodiscard]] std::vector<Usage> top(std::size_t const count) const
+	{
+		std::vector<Usage> usages{};
+		Budget const *root = this;
+		while (root->m_parent)
+			root = root->m_parent;
+		{
+			std::scoped_lock const lock{root->m_mutex};
+			for (Account const *account = root->m_accounts; account; account = account->m_next)
+				for (Budget const *budget = &account->m_budget; budget; budget = budget->m_parent)
+					if (budget == this)
+					{
+						usages.push_back(Usage{account->m_id, account->held()});
+						break;
+					}
+		}
+		auto const middle = usages.begin() + std::ptrdiff_t(std::min(count, usages.size()));
+		std::partial_sort(usages.begin(), middle, usages.end(), [](Usage const &left, Usage const &right) { return left.bytes > right.bytes; });
+		usages.erase(middle, usages.end());
+		return usages;
+	}
+
+	[[nodiscard]] std::size_t limit() const noexcept { return m_limit; }
+	/// @brief Access bytes held by everything charged to this budget
+	[[nodiscard]] std::size_t held() const noexcept { return m_held.load(std::memory_order_relaxed); }
+	/// @brief Access most bytes held at once
+	[[nodiscard]] std::size_t peak() const noexcept { return m_peak.load(std::memory_order_relaxed); }
+	/// @brief Access number of acquisitions refused by this budget's limit
+	[[nodiscard]] std::uint64_t rejected() const noexcept { return m_rejected.load(std::memory_order_relaxed); }
+
+private:
+	[[nodiscard]] Budget &root() noexcept
+	{
+		Budget *budget = this;
+		while (budget->m_parent)
+			budget = budget->m_parent;
+		return *budget;
+	}
+
+	Budget *m_parent;
+	std::size_t m_limit;
+	std::atomic<std::size_t> m_held{};
+	std::atomic<std::size_t> m_peak{};
+	std::atomic<std::uint64_t> m_rejected{};
+	mutable std::mutex m_mutex{}; ///< Guards the accounts of a root
+	Account *m_accounts{};
+};
+}  // namespace tcp
@@ -0,0 +1,155 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Time-stamp counter is only used on x86 and can be disabled with TCP_DISABLE_TSC
+#if !defined(TCP_DISABLE_TSC) && (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__))
+# define TCP_HAS_TSC 1
+# ifdef _MSC_VER
+#  include <intrin.h>
+# else
+#  include <cpuid.h>
+#  include <x86intrin.h>
+# endif  // _MSC_VER
+#endif
+
+namespace tcp {
+namespace internal {
+/// @brief Conversion from time-stamp counter ticks to steady nanoseconds
+struct Calibration
+{
+	bool tsc{};             ///< Is the time-stamp counter usable?
+	double nsPerTick{};     ///< Nanoseconds per tick
+	std::uint64_t ticks{};  ///< Tick count at calibration
+	std::int64_t ns{};      ///< Steady nanoseconds at calibration
+};
+
+[[nodiscard]] inline std::int64_t steadyNanoseconds() noexcept
+{
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+/// @brief Test whether the time-stamp counter runs at a constant rate across power states and cores
+[[nodiscard]] inline bool hasInvariantTsc() noexcept
+{
+#ifdef TCP_HAS_TSC
+	unsigned int registers[4]{}; // eax, ebx, ecx, edx
+# ifdef _MSC_VER
+	__cpuid(reinterpret_cast<int*>(registers), 0x80000000);
+	if (registers[0] < 0x80000007)
+		return false;
+	__cpuid(reinterpret_cast<int*>(registers), 0x80000007);
+# else
+	if (!__get_cpuid(0x80000007, &registers[0], &registers[1], &registers[2], &registers[3]))
+		return false;
+# endif  // _MSC_VER
+	return (registers[3] & (1u << 8)) != 0;
+#else
+	return false;
+#endif  // TCP_HAS_TSC
+}
+
+#ifdef TCP_HAS_TSC
+/// @brief Read the steady clock along with the tick count at the middle of the read
+[[nodiscard]] inline std::int64_t sample(std::uint64_t &ticks) noexcept
+{
+	std::uint64_t const before = __rdtsc();
+	std::int64_t const ns = steadyNanoseconds();
+	ticks = before + (__rdtsc() - before) / 2;
+	return ns;
+}
+#endif  // TCP_HAS_TSC
+
+/// @brief Time spent measuring the time-stamp counter frequency
+///
+/// The steady clock ticks every 100ns on Windows. Over 20ms, that leaves an
+/// error of about 5ppm in the frequency.
+constexpr std::int64_t kCalibrationNs{20'000'000};
+
+/// @brief Measure the time-stamp counter frequency against the steady clock
+/// @note Spins for roughly kCalibrationNs
+[[nodiscard]] inline Calibration calibrate() noexcept
+{
+#ifdef TCP_HAS_TSC
+	if (!hasInvariantTsc())
+		return {};
+
+	std::uint64_t beginTicks{};
+	std::int64_t const beginNs = sample(beginTicks);
+
+	std::uint64_t endTicks{};
+	std::int64_t endNs{};
+	do
+		endNs = sample(endTicks);
+	while (endNs - beginNs < kCalibrationNs);
+
+	if (endTicks <= beginTicks)
+		return {};
+	return Calibration{true, double(endNs - beginNs) / double(endTicks - beginTicks), endTicks, endNs};
+#else
+	return {};
+#endif  // TCP_HAS_TSC
+}
+[[nodiscard]] inline Calibration const &calibration() noexcept
+{
+	static Calibration const instance = calibrate();
+	return instance;
+}
+}  // namespace internal
+
+/// @brief Monotonic clock backed by the invariant time-stamp counter
+///
+/// Reading the counter costs a few nanoseconds. The steady clock reads
+/// QueryPerformanceCounter, which is usually in user mode too but costs several
+/// times more. Falls back to std::chrono::steady_clock when no invariant counter
+/// is available.
+///
+/// Readings start from the steady clock's reading at calibration. The measured
+/// frequency is only accurate to a few parts per million, so the two clocks
+/// drift apart by microseconds per second. Take both ends of an interval from
+/// the same clock.
+struct Clock
+{
+	using rep = std::int64_t;
+	using period = std::nano;
+	using duration = std::chrono::duration<rep, period>;
+	using time_point = std::chrono::time_point<Clock>;
+	static constexpr bool is_steady = true;
+
+	/// @brief Current time
+	[[nodiscard]] static time_point now() noexcept
+	{
+		return time_point{duration{nanoseconds()}};
+	}
+	/// @brief Current time in nanoseconds since the steady clock's epoch
+	[[nodiscard]] static std::int64_t nanoseconds() noexcept
+	{
+#ifdef TCP_HAS_TSC
+		internal::Calibration const &calibration = internal::calibration();
+		if (calibration.tsc)
+		{
+			auto const elapsed = static_cast<std::int64_t>(__rdtsc() - calibration.ticks);
+			return calibration.ns + static_cast<std::int64_t>(double(elapsed) * calibration.nsPerTick);
+		}
+#endif  // TCP_HAS_TSC
+		return internal::steadyNanoseconds();
+	}
+	/// @brief Test whether the time-stamp counter is in use
+	[[nodiscard]] static bool usesTsc() noexcept
+	{
+		return internal::calibration().tsc;
+	}
+	/// @brief Calibrate ahead of time
+	/// @note Otherwise the first reading spins for roughly 20ms to calibrate
+	static void calibrate() noexcept
+	{
+		static_cast<void>(internal::calibration());
+	}
+};
+}  // namespace tcp
@@ -0,0 +1,244 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Platform dependencies
+#ifdef _WIN32
+# ifndef _WINSOCKAPI_
+#  define _WINSOCKAPI_
+# endif  // _WINSOCKAPI_
+# include <Windows.h>
+#elif defined(__linux__)
+# define TCP_HAS_PERF_EVENT 1
+# include <linux/perf_event.h>
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif  // _WIN32
+
+namespace tcp {
+/// @brief Hardware and scheduler events counted by Counters
+enum class Counter : std::size_t
+{
+	Cycles,
+	Instructions,
+	CacheMisses,
+	ContextSwitches,
+	Count
+};
+
+/// @brief Counter values at a point in time, or the difference between two points
+struct CounterSample
+{
+	std::array<std::uint64_t, std::size_t(Counter::Count)> values{};
+
+	[[nodiscard]] constexpr std::uint64_t operator[](Counter const counter) const noexcept { return values[std::size_t(counter)]; }
+	[[nodiscard]] constexpr std::uint64_t &operator[](Counter const counter) noexcept { return values[std::size_t(counter)]; }
+
+	[[nodiscard]] constexpr CounterSample operator-(CounterSample const &right) const noexcept
+	{
+		CounterSample result{};
+		for (std::size_t i{}; i != values.size(); ++i)
+			result.values[i] = values[i] - right.values[i];
+		return result;
+	}
+	constexpr CounterSample &operator+=(CounterSample const &right) noexcept
+	{
+		for (std::size_t i{}; i != values.size(); ++i)
+			values[i] += right.values[i];
+		return *this;
+	}
+
+	/// @brief Instructions per cycle
+	[[nodiscard]] constexpr double ipc() const noexcept
+	{
+		return (*this)[Counter::Cycles] ? double((*this)[Counter::Instructions]) / double((*this)[Counter::Cycles]) : 0.0;
+	}
+};
+
+/// @brief Self-monitoring counters of the calling thread
+///
+/// Uses perf_event_open on Linux, counting hardware events in user-space only so
+/// that the default perf_event_paranoid level permits them. Context switches are a
+/// software event, which that level permits in full, and happen in the kernel, so
+/// they are counted there. Counters the kernel refuses are reported as unavailable
+/// and read as zero. On Windows only cycles are available.
+struct Counters
+{
+	/// @brief Open counters for the calling thread
+	/// @note Counters must be read from the thread that opened them
+	[[nodiscard]] static Counters open() noexcept
+	{
+		Counters counters{};
+#ifdef _WIN32
+		counters.m_available[std::size_t(Counter::Cycles)] = true;
+#elif defined(TCP_HAS_PERF_EVENT)
+		constexpr std::array<std::pair<std::uint32_t, std::uint64_t>, std::size_t(Counter::Count)> kEvents{{
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+			{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+		}};
+		for (std::size_t i{}; i != kEvents.size(); ++i)
+		{
+			perf_event_attr attributes{};
+			attributes.size = sizeof(attributes);
+			attributes.type = kEvents[i].first;
+			attributes.config = kEvents[i].second;
+			attributes.disabled = counters.m_leader == -1;
+			attributes.exclude_kernel = kEvents[i].first != PERF_TYPE_SOFTWARE; // Else context switches read zero
+			attributes.exclude_hv = 1;
+			attributes.read_format = PERF_FORMAT_GROUP;
+
+			// Group members are scheduled together and read with a single system call
+			int const fd = static_cast<int>(::syscall(SYS_perf_event_open, &attributes, 0, -1, counters.m_leader, 0));
+			if (fd == -1)
+				continue;
+			if (counters.m_leader == -1)
+				counters.m_leader = fd;
+			counters.m_fds[i] = fd;
+			counters.m_available[i] = true;
+		}
+		if (counters.m_leader != -1)
+			::ioctl(counters.m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif  // _WIN32
+		return counters;
+	}
+
+	constexpr Counters() = default;
+	~Counters() noexcept
+	{
+		close();
+	}
+
+	/// @brief Non copy-constrictible
+	Counters(Counters const&) = delete;
+	/// @brief Non copy-assignable
+	Counters &operator=(Counters const&) = delete;
+
+	/// @brief Move-construction
+	Counters(Counters &&right) noexcept
+	{
+		*this = std::move(right);
+	}
+	/// @brief Move-assignment
+	Counters &operator=(Counters &&right) noexcept
+	{
+		if (this != &right)
+		{
+			close(); // Release existing
+			m_available = std::exchange(right.m_available, {});
+#ifdef TCP_HAS_PERF_EVENT
+			m_fds = std::exchange(right.m_fds, kClosed);
+			m_leader = std::exchange(right.m_leader, -1);
+#endif  // TCP_HAS_PERF_EVENT
+		}
+		return *this;
+	}
+
+	/// @brief Test whether any counter is available
+	[[nodiscard]] constexpr explicit operator bool() const noexcept
+	{
+		for (bool const available : m_available)
+			if (available)
+				return true;
+		return false;
+	}
+	/// @brief Test whether a specific counter is available
+	[[nodiscard]] constexpr bool available(Counter const counter) const noexcept { return m_available[std::size_t(counter)]; }
+
+	/// @brief Read current counter values; subtract two readings to attribute a loop iteration or message
+	[[nodiscard]] CounterSample read() const noexcept
+	{
+		CounterSample sample{};
+#ifdef _WIN32
+		ULONG64 cycles{};
+		if (::QueryThreadCycleTime(::GetCurrentThread(), &cycles))
+			sample[Counter::Cycles] = cycles;
+#elif defined(TCP_HAS_PERF_EVENT)
+		if (m_leader == -1)
+			return sample;
+
+		// PERF_FORMAT_GROUP layout: number of counters followed by their values in opening order
+		std::array<std::uint64_t, std::size_t(Counter::Count) + 1> buffer{};
+		if (::read(m_leader, buffer.data(), sizeof(buffer)) <= 0)
+			return sample;
+
+		std::size_t next{1};
+		for (std::size_t i{}; i != m_fds.size() && next <= buffer[0]; ++i)
+			if (m_fds[i] != -1)
+				sample.values[i] = buffer[next++];
+#endif  // _WIN32
+		return sample;
+	}
+
+	/// @brief Release counters
+	void close() noexcept
+	{
+#ifdef TCP_HAS_PERF_EVENT
+		for (int &fd : m_fds)
+			if (fd != -1)
+				::close(std::exchange(fd, -1));
+		m_leader = -1;
+#endif  // TCP_HAS_PERF_EVENT
+		m_available = {};
+	}
+
+private:
+	std::array<bool, std::size_t(Counter::Count)> m_available{};
+#ifdef TCP_HAS_PERF_EVENT
+	static constexpr std::array<int, std::size_t(Counter::Count)> kClosed{-1, -1, -1, -1};
+
+	std::array<int, std::size_t(Counter::Count)> m_fds{kClosed};
+	int m_leader{-1};
+#endif  // TCP_HAS_PERF_EVENT
+};
+
+/// @brief Running totals of counter deltas, e.g. per loop iteration or per handled message
+struct CounterTotals
+{
+	/// @brief Add the counters spent by one unit of work
+	constexpr void add(CounterSample const &delta) noexcept
+	{
+		total += delta;
+		++count;
+	}
+	/// @brief Mean of a counter per unit of work
+	[[nodiscard]] constexpr double mean(Counter const counter) const noexcept
+	{
+		return count ? double(total[counter]) / double(count) : 0.0;
+	}
+
+	CounterSample total{};
+	std::uint64_t count{};
+};
+
+/// @brief Adds the counters spent between construction and destruction to a CounterTotals
+///
+/// Place one around each loop iteration and one around each message handler
+struct CounterScope
+{
+	CounterScope(Counters const &counters, CounterTotals &totals) noexcept:
+		m_counters{counters}, m_totals{totals}, m_begin{counters.read()}
+	{}
+	~CounterScope() noexcept
+	{
+		m_totals.add(m_counters.read() - m_begin);
+	}
+
+	CounterScope(CounterScope const&) = delete;
+	CounterScope &operator=(CounterScope const&) = delete;
+
+private:
+	Counters const &m_counters;
+	CounterTotals &m_totals;
+	CounterSample m_begin;
+};
+}  // namespace tcp
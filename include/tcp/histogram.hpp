@@ -0,0 +1,154 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+namespace tcp {
+/// @brief Log-linear histogram of non-negative values in the style of HdrHistogram
+///
+/// Every power of two range is split into 128 linear sub-buckets, so recorded
+/// values are resolved to within 1% across the full 64-bit range while
+/// recording costs a handful of instructions and never allocates.
+struct Histogram
+{
+	static constexpr unsigned kSubBucketBits{7};
+	static constexpr std::size_t kSubBuckets{std::size_t{1} << kSubBucketBits};
+	static constexpr std::size_t kBuckets{(65 - kSubBucketBits) << kSubBucketBits};
+
+	Histogram(): m_counts(kBuckets) {}
+
+	/// @brief Record occurrences of a value
+	void record(std::uint64_t const value, std::uint64_t const count = 1) noexcept
+	{
+		m_counts[index(value)] += count;
+		m_count += count;
+		m_sum += value * count;
+		m_min = std::min(m_min, value);
+		m_max = std::max(m_max, value);
+	}
+	/// @brief Add all values recorded by another histogram
+	void merge(Histogram const &right) noexcept
+	{
+		for (std::size_t i{}; i != kBuckets; ++i)
+			m_counts[i] += right.m_counts[i];
+		m_count += right.m_count;
+		m_sum += right.m_sum;
+		m_min = std::min(m_min, right.m_min);
+		m_max = std::max(m_max, right.m_max);
+	}
+	/// @brief Discard all recorded values
+	void reset() noexcept
+	{
+		std::fill(m_counts.begin(), m_counts.end(), 0);
+		m_count = m_sum = m_max = 0;
+		m_min = std::numeric_limits<std::uint64_t>::max();
+	}
+
+	[[nodiscard]] std::uint64_t count() const noexcept { return m_count; }
+	[[nodiscard]] std::uint64_t min() const noexcept { return m_count ? m_min : 0; }
+	[[nodiscard]] std::uint64_t max() const noexcept { return m_max; }
+	[[nodiscard]] double mean() const noexcept { return m_count ? double(m_sum) / double(m_count) : 0.0; }
+	/// @brief Standard deviation, resolved to bucket precision
+	[[nodiscard]] double deviation() const noexcept
+	{
+		if (m_count == 0)
+			return 0.0;
+
+		double const average = mean();
+		double squares{};
+		for (std::size_t i{}; i != kBuckets; ++i)
+			if (m_counts[i])
+			{
+				double const difference = double(highestEquivalent(i)) - average;
+				squares += difference * difference * double(m_counts[i]);
+			}
+		return std::sqrt(squares / double(m_count));
+	}
+
+	/// @brief Value at or below which a percentage of recorded values fall
+	///
+	/// @param percentile 0 to 100
+	/// @return Highest value equivalent to the bucket the percentile falls in
+	[[nodiscard]] std::uint64_t percentile(double const percentile) const noexcept
+	{
+		if (m_count == 0)
+			return 0;
+
+		auto const target = std::max<std::uint64_t>(1, std::uint64_t(percentile / 100.0 * double(m_count) + 0.5));
+		std::uint64_t seen{};
+		for (std::size_t i{}; i != kBuckets; ++i)
+			if ((seen += m_counts[i]) >= target)
+				return std::min(highestEquivalent(i), m_max);
+		return m_max;
+	}
+
+	/// @brief Write the percentile distribution in HdrHistogram's text format
+	///
+	/// The output can be plotted with HdrHistogram's percentile plotter
+	/// @param scale Divisor applied to values, e.g. 1000 to print nanoseconds as microseconds
+	void print(std::ostream &out, double const scale = 1.0) const
+	{
+		out << "       Value     Percentile TotalCount 1/(1-Percentile)\n\n";
+
+		std::uint64_t seen{};
+		for (std::size_t i{}; i != kBuckets; ++i)
+		{
+			if (m_counts[i] == 0)
+				continue;
+			seen += m_counts[i];
+
+			double const fraction = double(seen) / double(m_count);
+			char line[96]{};
+			if (seen == m_count)
+				std::snprintf(line, sizeof(line), "%12.3f %14.12f %10llu\n",
+							  double(std::min(highestEquivalent(i), m_max)) / scale, fraction, static_cast<unsigned long long>(seen));
+			else
+				std::snprintf(line, sizeof(line), "%12.3f %14.12f %10llu %14.2f\n",
+							  double(highestEquivalent(i)) / scale, fraction, static_cast<unsigned long long>(seen), 1.0 / (1.0 - fraction));
+			out << line;
+		}
+
+		char line[160]{};
+		std::snprintf(line, sizeof(line), "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n#[Max     = %12.3f, Total count    = %12llu]\n",
+					  mean() / scale, deviation() / scale, double(m_max) / scale, static_cast<unsigned long long>(m_count));
+		out << line;
+	}
+
+private:
+	[[nodiscard]] static std::size_t index(std::uint64_t const value) noexcept
+	{
+		auto const width = static_cast<unsigned>(std::bit_width(value));
+		if (width <= kSubBucketBits + 1)
+			return static_cast<std::size_t>(value);
+
+		unsigned const shift = width - kSubBucketBits - 1;
+		return (std::size_t(shift + 1) << kSubBucketBits) | std::size_t((value >> shift) & (kSubBuckets - 1));
+	}
+	[[nodiscard]] static std::uint64_t highestEquivalent(std::size_t const index) noexcept
+	{
+		if (index < 2 * kSubBuckets)
+			return index;
+
+		unsigned const shift = unsigned(index >> kSubBucketBits) - 1;
+		std::uint64_t const base = (std::uint64_t(index & (kSubBuckets - 1)) | kSubBuckets) << shift;
+		return base + ((std::uint64_t{1} << shift) - 1);
+	}
+
+	std::vector<std::uint64_t> m_counts;
+	std::uint64_t m_count{};
+	std::uint64_t m_sum{};
+	std::uint64_t m_min{std::numeric_limits<std::uint64_t>::max()};
+	std::uint64_t m_max{};
+};
+}  // namespace tcp
@@ -0,0 +1,376 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <tcp/clock.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace tcp {
+namespace log {
+namespace internal {
+/// @brief Anything printed as an endpoint, e.g. tcp::Endpoint
+template<class T> concept EndpointLike = std::is_trivially_copyable_v<T> && std::default_initializable<T> &&
+	requires(T const &value) { value.ip(); value.port(); };
+
+/// @brief Type an argument is stored as; strings are copied, everything else is stored raw
+template<class T> using Stored = std::conditional_t<std::is_convertible_v<T const&, std::string_view>,
+													std::string_view, std::remove_cvref_t<T>>;
+
+/// @brief Raw argument encoding, formatting is deferred until decode on the background thread
+template<class T> struct Codec
+{
+	static_assert(std::is_trivially_copyable_v<T>, "Log arguments must be trivially copyable or strings");
+
+	[[nodiscard]] static constexpr std::size_t size(T const&) noexcept { return sizeof(T); }
+	static std::byte *encode(std::byte *out, T const &value) noexcept
+	{
+		std::memcpy(out, &value, sizeof(T));
+		return out + sizeof(T);
+	}
+	static std::byte const *decode(std::ostream &out, std::byte const *in)
+	{
+		T value{};
+		std::memcpy(&value, in, sizeof(T));
+
+		if constexpr (EndpointLike<T>)
+			out << value.ip().data() << ':' << value.port();
+		else if constexpr (std::is_same_v<T, bool>)
+			out << (value ? "true" : "false");
+		else if constexpr (std::is_enum_v<T>)
+			out << +static_cast<std::underlying_type_t<T>>(value);
+		else if constexpr (std::is_same_v<T, char>)
+			out << value;
+		else if constexpr (std::is_arithmetic_v<T>)
+			out << +value; // Promote so single-byte integers print as numbers
+		else if constexpr (std::is_pointer_v<T>)
+			out << static_cast<void const*>(value);
+		else
+			out << '?';
+		return in + sizeof(T);
+	}
+};
+template<> struct Codec<std::string_view>
+{
+	[[nodiscard]] static std::size_t size(std::string_view const value) noexcept { return sizeof(std::uint32_t) + value.size(); }
+	static std::byte *encode(std::byte *out, std::string_view const value) noexcept
+	{
+		auto const length = static_cast<std::uint32_t>(value.size());
+		std::memcpy(out, &length, sizeof(length));
+		std::memcpy(out + sizeof(length), value.data(), length);
+		return out + sizeof(length) + length;
+	}
+	static std::byte const *decode(std::ostream &out, std::byte const *in)
+	{
+		std::uint32_t length{};
+		std::memcpy(&length, in, sizeof(length));
+		out.write(reinterpret_cast<char const*>(in + sizeof(length)), length);
+		return in + sizeof(length) + length;
+	}
+};
+
+/// @brief Write format text up to the next "{}" placeholder
+///
+/// @return Text following the placeholder
+inline char const *writeUntilPlaceholder(std::ostream &out, char const *format)
+{
+	char const *placeholder = std::strstr(format, "{}");
+	if (!placeholder)
+	{
+		// More arguments than placeholders; append the rest
+		out << format << ' ';
+		return format + std::strlen(format);
+	}
+	out.write(format, placeholder - format);
+	return placeholder + 2;
+}
+
+using DecodeFn = void(*)(std::ostream&, char const*, std::byte const*);
+
+/// @brief Format a record; instantiated once per argument type list
+template<class... Args> void decode(std::ostream &out, char const *format, std::byte const *args)
+{
+	((format = writeUntilPlaceholder(out, format), args = Codec<Args>::decode(out, args)), ...);
+	out << format;
+}
+
+/// @brief Fixed part of every record in a ring
+struct Header
+{
+	std::uint32_t size;  ///< Size of record including header; zero marks wrap-around
+	DecodeFn decode;     ///< Identifies argument types
+	char const *format;  ///< Identifies format; must have static storage duration
+	std::int64_t time;   ///< Clock nanoseconds
+};
+constexpr std::size_t kAlignment{alignof(Header)};
+
+/// @brief Single-producer, single-consumer byte ring holding encoded records
+struct Ring
+{
+	/// @param capacity Power of two number of bytes
+	explicit Ring(std::uint32_t const id, std::size_t const capacity):
+		id{id}, m_data(std::make_unique<std::byte[]>(capacity)), m_mask{capacity - 1}
+	{}
+
+	std::uint32_t const id;              ///< Sequence number of the owning thread
+	std::atomic<std::uint64_t> dropped{}; ///< Records lost to a full ring since the last drain
+	std::atomic<bool> detached{};         ///< Set once the owning thread has exited
+
+	/// @brief Reserve contiguous space for a record; called by the owning thread only
+	///
+	/// A record that does not fit before the end wraps to the beginning. Nothing
+	/// is published until commit, which covers the wrap marker as well.
+	/// @return Pointer to reserved space, or nullptr if the ring is full
+	[[nodiscard]] std::byte *reserve(std::size_t const size) noexcept
+	{
+		std::size_t const head = m_head.load(std::memory_order_relaxed);
+		std::size_t const offset = head & m_mask;
+		std::size_t const contiguous = m_mask + 1 - offset;
+		std::size_t const needed = size <= contiguous ? size : contiguous + size;
+
+		if (needed > m_mask + 1 - (head - m_cachedTail))
+		{
+			m_cachedTail = m_tail.load(std::memory_order_acquire);
+			if (needed > m_mask + 1 - (head - m_cachedTail))
+				return nullptr;
+		}
+		m_reserved = needed;
+		if (size > contiguous)
+		{
+			// Mark the remainder unused and start at the beginning
+			std::uint32_t const wrap{};
+			std::memcpy(m_data.get() + offset, &wrap, sizeof(wrap));
+			return m_data.get();
+		}
+		return m_data.get() + offset;
+	}
+	/// @brief Publish the record last reserved, along with any wrap marker before it
+	void commit() noexcept
+	{
+		m_head.store(m_head.load(std::memory_order_relaxed) + m_reserved, std::memory_order_release);
+	}
+
+	/// @brief Format all published records; called by the background thread only
+	///
+	/// @return Number of records formatted
+	std::size_t drain(std::ostream &out)
+	{
+		std::size_t const head = m_head.load(std::memory_order_acquire);
+		std::size_t tail = m_tail.load(std::memory_order_relaxed);
+		std::size_t count{};
+		while (tail != head)
+		{
+			std::size_t const offset = tail & m_mask;
+			Header header{};
+			std::memcpy(&header.size, m_data.get() + offset, sizeof(header.size));
+			if (header.size == 0)
+			{
+				tail += m_mask + 1 - offset;
+				continue;
+			}
+			std::memcpy(&header, m_data.get() + offset, sizeof(header));
+
+			out << header.time << " [" << id << "] ";
+			header.decode(out, header.format, m_data.get() + offset + sizeof(header));
+			out << '\n';
+
+			tail += header.size;
+			++count;
+		}
+		m_tail.store(tail, std::memory_order_release);
+		return count;
+	}
+
+private:
+	std::unique_ptr<std::byte[]> m_data;
+	std::size_t const m_mask;
+	alignas(64) std::atomic<std::size_t> m_head{};
+	std::size_t m_cachedTail{};
+	std::size_t m_reserved{}; ///< Bytes the next commit publishes
+	alignas(64) std::atomic<std::size_t> m_tail{};
+};
+
+struct Logger
+{
+	[[nodiscard]] std::shared_ptr<Ring> attach()
+	{
+		std::scoped_lock const lock{mutex};
+		return rings.emplace_back(std::make_shared<Ring>(++threads, capacity.load(std::memory_order_relaxed)));
+	}
+	/// @brief Format pending records of every thread, releasing the rings of exited threads once empty
+	///
+	/// @return Number of records formatted
+	std::size_t drain()
+	{
+		std::vector<std::shared_ptr<Ring>> snapshot;
+		{
+			std::scoped_lock const lock{mutex};
+			snapshot = rings;
+		}
+
+		std::size_t count{};
+		std::vector<Ring const*> released;
+		for (auto const &ring : snapshot)
+		{
+			// Read first, so that every record written before the thread exited is drained below
+			if (ring->detached.load(std::memory_order_acquire))
+				released.push_back(ring.get());
+			count += ring->drain(file);
+			if (std::uint64_t const dropped = ring->dropped.exchange(0, std::memory_order_relaxed))
+				file << Clock::nanoseconds() << " [" << ring->id << "] dropped " << dropped << " records\n";
+		}
+		if (!released.empty())
+		{
+			std::scoped_lock const lock{mutex};
+			std::erase_if(rings, [&released](std::shared_ptr<Ring> const &ring)
+			{
+				return std::find(released.begin(), released.end(), ring.get()) != released.end();
+			});
+		}
+		if (count)
+			file.flush();
+		return count;
+	}
+
+	std::mutex mutex{};
+	std::vector<std::shared_ptr<Ring>> rings{};
+	std::uint32_t threads{}; ///< Threads that have logged, numbering their rings
+	std::atomic<std::size_t> capacity{std::size_t{1} << 20};
+	std::atomic<bool> running{};
+	std::ofstream file{};
+	std::thread thread{};
+};
+[[nodiscard]] inline Logger &logger() noexcept
+{
+	static Logger instance{};
+	return instance;
+}
+/// @brief Holds the ring of a thread, marking it for release when the thread exits
+struct Attachment
+{
+	~Attachment() noexcept
+	{
+		if (ring)
+			ring->detached.store(true, std::memory_order_release);
+	}
+
+	std::shared_ptr<Ring> ring{};
+};
+/// @brief Ring of the calling thread, created on first use
+///
+/// @return nullptr if the ring cannot be allocated
+[[nodiscard]] inline Ring *local() noexcept
+{
+	thread_local Attachment attachment{};
+	if (!attachment.ring)
+	{
+		try
+		{
+			attachment.ring = logger().attach();
+		}
+		catch (...)
+		{
+			return nullptr; // Out of memory; tried again by the next record
+		}
+	}
+	return attachment.ring.get();
+}
+}  // namespace internal
+
+/// @brief Start formatting records to a file on a background thread
+///
+/// @param path Destination file, appended to
+/// @param capacity Bytes buffered per thread, rounded up to a power of two; only affects threads that have not yet logged
+inline bool start(char const *path, std::size_t const capacity = std::size_t{1} << 20)
+{
+	internal::Logger &logger = internal::logger();
+	if (logger.running.load())
+		return false;
+
+	logger.file.open(path, std::ios::app);
+	if (!logger.file)
+		return false;
+
+	std::size_t rounded{256};
+	while (rounded < capacity)
+		rounded <<= 1;
+	logger.capacity.store(rounded, std::memory_order_relaxed);
+
+	logger.running.store(true);
+	logger.thread = std::thread{[&logger]
+	{
+		while (logger.running.load(std::memory_order_relaxed))
+			if (logger.drain() == 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds{1});
+		logger.drain();
+	}};
+	return true;
+}
+/// @brief Format outstanding records, stop the background thread and close the file
+inline void stop()
+{
+	internal::Logger &logger = internal::logger();
+	if (!logger.running.exchange(false))
+		return;
+
+	logger.thread.join();
+	logger.file.close();
+}
+/// @brief Test whether records are being written
+[[nodiscard]] inline bool running() noexcept
+{
+	return internal::logger().running.load(std::memory_order_relaxed);
+}
+
+/// @brief Record an event without formatting it on the calling thread
+///
+/// Only a pointer to the format and the raw argument bytes are copied into the
+/// calling thread's ring; the background thread substitutes each "{}" later.
+/// Records are dropped, and the drop counted, when the ring is full. They are
+/// also dropped if the calling thread's ring cannot be allocated.
+/// @param format String with static storage duration, e.g. a literal
+/// @param args Strings, or trivially copyable values such as integers and tcp::Endpoint
+template<class... Args> void write(char const *format, Args const &...args) noexcept
+{
+	if (!running())
+		return;
+
+	using internal::Codec;
+	using internal::Stored;
+	std::size_t size = sizeof(internal::Header) + (Codec<Stored<Args>>::size(args) + ... + 0);
+	size = (size + internal::kAlignment - 1) & ~(internal::kAlignment - 1);
+
+	internal::Ring *const ring = internal::local();
+	if (!ring)
+		return;
+	std::byte *out = ring->reserve(size);
+	if (!out)
+	{
+		ring->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	internal::Header const header{static_cast<std::uint32_t>(size), &internal::decode<Stored<Args>...>, format, Clock::nanoseconds()};
+	std::memcpy(out, &header, sizeof(header));
+	out += sizeof(header);
+	((out = Codec<Stored<Args>>::encode(out, args)), ...);
+	ring->commit();
+}
+}  // namespace log
+}  // namespace tcp
@@ -0,0 +1,177 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <tcp/async.hpp>
+#include <tcp/budget.hpp>
+
+#include <cstddef>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace tcp {
+namespace async {
+struct DrainSender;
+
+/// @brief Messages queued for sending on one connection, held against a budget
+///
+/// push copies a message and returns at once, and the outbox sends queued bytes
+/// in order on its loop. Bytes are charged to the account from push until they
+/// are sent. A push the budget cannot hold is refused, so a slow peer cannot
+/// grow its queue without bound. A reader that finds the budget exhausted waits
+/// for drained before reading more, which leaves the backlog with the peer's
+/// socket rather than in memory.
+///
+/// Messages fill one buffer while the other is being sent, so an operation in
+/// flight never sees its buffer move. Used on the thread of its loop, and destroyed
+/// there or once the loop has stopped; destroying it drops a send in flight.
+struct Outbox
+{
+	Outbox(Loop &loop, Socket const &socket, Budget::Account &account) noexcept:
+		m_loop{loop}, m_socket{socket}, m_account{account} {}
+	~Outbox() noexcept
+	{
+		// A send still on the loop would otherwise resume into the freed outbox
+		if (m_sending)
+			m_loop.remove(m_send.operation());
+		m_account.release(queued());
+	}
+
+	/// @brief Non copy-constructible
+	Outbox(Outbox const&) = delete;
+	/// @brief Non copy-assignable
+	Outbox &operator=(Outbox const&) = delete;
+
+	/// @brief Queue a message
+	///
+	/// @return Whether queued; false if the budget cannot hold it or sending failed
+	[[nodiscard]] bool push(void const *const data, std::size_t const size)
+	{
+		if (m_error || !m_account.acquire(size))
+			return false;
+		auto const *const bytes = static_cast<char const*>(data);
+		try
+		{
+			m_filling.insert(m_filling.end(), bytes, bytes + size);
+		}
+		catch (...)
+		{
+			m_account.release(size);
+			throw;
+		}
+		if (!m_sending)
+			send();
+		return true;
+	}
+
+	/// @brief Access bytes queued and not yet sent
+	[[nodiscard]] std::size_t queued() const noexcept { return m_flushing.size() - m_sent + m_filling.size(); }
+	/// @brief Access error that ended sending, zero if none
+	[[nodiscard]] int error() const noexcept { return m_error; }
+	/// @brief Access account charged with queued bytes
+	[[nodiscard]] Budget::Account &account() const noexcept { return m_account; }
+
+	/// @brief Returns sender completing on the loop once nothing is queued
+	[[nodiscard]] DrainSender drained() noexcept;
+
+private:
+	template<class Receiver> friend struct DrainOperation;
+
+	struct Sent
+	{
+		void setValue(std::size_t const bytes) noexcept { outbox->sent(bytes); }
+		void setError(int const error) noexcept { outbox->fail(error); }
+		void setStopped() noexcept { outbox->fail(WSAECONNABORTED); }
+
+		Outbox *outbox;
+	};
+
+	/// @brief Send the rest of the flushing buffer, swapping in the filling one once it is done
+	void send() noexcept
+	{
+		if (m_sent == m_flushing.size())
+		{
+			m_flushing.clear();
+			m_sent = 0;
+			std::swap(m_flushing, m_filling);
+		}
+		m_sending = !m_flushing.empty();
+		if (!m_sending)
+		{
+			// Resumed on the loop rather than here, where the caller may be mid-push
+			if (m_drain)
+				m_loop.wait(*std::exchange(m_drain, nullptr));
+			return;
+		}
+		m_send.start(async::send(m_loop, m_socket, m_flushing.data() + m_sent, m_flushing.size() - m_sent), Sent{this});
+	}
+	void sent(std::size_t const bytes) noexcept
+	{
+		m_sent += bytes;
+		m_account.release(bytes);
+		send();
+	}
+	void fail(int const error) noexcept
+	{
+		m_error = error;
+		m_account.release(queued());
+		m_flushing.clear();
+		m_filling.clear();
+		m_sent = 0;
+		m_sending = false;
+		if (m_drain)
+			m_loop.wait(*std::exchange(m_drain, nullptr));
+	}
+
+	Loop &m_loop;
+	Socket const &m_socket;
+	Budget::Account &m_account;
+	std::vector<char> m_flushing{}; ///< Being sent
+	std::vector<char> m_filling{};  ///< Queued behind it
+	std::size_t m_sent{};           ///< Bytes of the flushing buffer sent
+	bool m_sending{};
+	int m_error{};
+	internal::Waiter *m_drain{};
+	Slot<SendSender, Sent> m_send{};
+};
+
+template<class Receiver> struct DrainOperation final: internal::Waiter
+{
+	DrainOperation(Outbox &outbox, Receiver receiver) noexcept:
+		internal::Waiter{&DrainOperation::resume}, m_outbox{outbox}, m_receiver{std::move(receiver)} {}
+
+	void start() noexcept
+	{
+		if (m_outbox.m_sending)
+			m_outbox.m_drain = this;
+		else
+			m_receiver.setValue();
+	}
+
+private:
+	static void resume(internal::Waiter &waiter) noexcept { static_cast<DrainOperation&>(waiter).m_receiver.setValue(); }
+
+	Outbox &m_outbox;
+	Receiver m_receiver;
+};
+/// @brief Completes once an outbox has sent everything queued, or failed; one at a time per outbox
+struct DrainSender
+{
+	using Values = std::tuple<>;
+
+	template<class Receiver> [[nodiscard]] DrainOperation<Receiver> connect(Receiver receiver) const noexcept
+	{
+		return DrainOperation<Receiver>{outbox, std::move(receiver)};
+	}
+
+	Outbox &outbox;
+};
+inline DrainSender Outbox::drained() noexcept
+{
+	return DrainSender{*this};
+}
+}  // namespace async
+}  // namespace tcp
@@ -0,0 +1,325 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace tcp {
+/// @brief Bounded queue with any number of producers and one consumer, which takes items in batches
+///
+/// Each cell carries a sequence number telling producers and the consumer whose
+/// turn it is, so items pass without locks. Producers block while the queue is
+/// full and the consumer blocks while it is empty. Either side only wakes the
+/// other if it is asleep, so a busy queue makes no calls into the system.
+///
+/// Closing sets a bit in the producers' position, so a push either reserves a
+/// cell before the close, and its item is still popped, or fails.
+template<class T> struct Queue
+{
+	/// @param capacity Items held at once, rounded up to a power of two
+	explicit Queue(std::size_t const capacity):
+		m_cells(std::bit_ceil(capacity < 2 ? std::size_t{2} : capacity)), m_mask{m_cells.size() - 1}
+	{
+		for (std::size_t i{}; i != m_cells.size(); ++i)
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	/// @brief Non copy-constructible
+	Queue(Queue const&) = delete;
+	/// @brief Non copy-assignable
+	Queue &operator=(Queue const&) = delete;
+
+	/// @brief Add an item, waiting while the queue is full; callable from any thread
+	///
+	/// @return False if the queue was closed
+	bool push(T &&item) noexcept(std::is_nothrow_move_assignable_v<T>)
+	{
+		std::size_t position = m_tail.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			if (position & kClosed)
+				return false;
+			Cell &cell = m_cells[position & m_mask];
+			auto const lead = std::ptrdiff_t(cell.sequence.load(std::memory_order_acquire) - position);
+			if (lead == 0)
+			{
+				if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					cell.item = std::move(item);
+					cell.sequence.store(position + 1, std::memory_order_release);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					if (m_consumerAsleep.load(std::memory_order_relaxed))
+						signal(m_items);
+					return true;
+				}
+			}
+			else
+			{
+				// Reloaded after waiting too, since the queue may have closed meanwhile
+				if (lead < 0)
+					awaitSpace(cell, position);
+				position = m_tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	/// @brief Take up to max items, waiting while the queue is empty; only the consumer may call this
+	///
+	/// @param batch Items are appended
+	/// @return Number of items taken, zero once the queue is closed and empty
+	std::size_t pop(std::vector<T> &batch, std::size_t const max)
+	{
+		for (;;)
+		{
+			std::size_t count{};
+			for (; count != max && ready(); ++count)
+			{
+				Cell &cell = m_cells[m_head & m_mask];
+				batch.push_back(std::move(cell.item));
+				cell.sequence.store(m_head++ + m_cells.size(), std::memory_order_release);
+			}
+			if (count)
+			{
+				++m_batches;
+				m_popped += count;
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (m_producersAsleep.load(std::memory_order_relaxed))
+					signal(m_space);
+				return count;
+			}
+			if (!awaitItems())
+				return 0;
+		}
+	}
+
+	/// @brief Refuse further items; those already pushed are still popped
+	void close() noexcept
+	{
+		m_tail.fetch_or(kClosed);
+		signal(m_items);
+		signal(m_space);
+	}
+
+	/// @brief Access mean items taken per pop; read once the consumer is done
+	[[nodiscard]] double batching() const noexcept { return m_batches ? double(m_popped) / double(m_batches) : 0.0; }
+
+private:
+	static constexpr std::size_t kClosed{~(~std::size_t{} >> 1)}; ///< Set in m_tail once closed
+
+	struct Cell
+	{
+		std::atomic<std::size_t> sequence;
+		T item{};
+	};
+
+	[[nodiscard]] bool ready() const noexcept
+	{
+		return m_cells[m_head & m_mask].sequence.load(std::memory_order_acquire) == m_head + 1;
+	}
+
+	/// @brief Sleep until the consumer frees a cell or the queue closes
+	void awaitSpace(Cell const &cell, std::size_t const position) noexcept
+	{
+		m_producersAsleep.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::uint32_t const seen = m_space.load();
+		if (std::ptrdiff_t(cell.sequence.load() - position) < 0 && !(m_tail.load() & kClosed))
+			m_space.wait(seen);
+		m_producersAsleep.fetch_sub(1);
+	}
+	/// @brief Sleep until a producer publishes an item or the queue closes
+	///
+	/// @return False once closed with every reserved cell taken
+	[[nodiscard]] bool awaitItems() noexcept
+	{
+		m_consumerAsleep.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		std::uint32_t const seen = m_items.load();
+		// No cell is reserved once closed, but those reserved before may still be published
+		std::size_t const tail = m_tail.load();
+		bool const done = (tail & kClosed) && (tail & ~kClosed) == m_head;
+		if (!done && !ready())
+			m_items.wait(seen);
+		m_consumerAsleep.store(false);
+		return !done;
+	}
+
+	static void signal(std::atomic<std::uint32_t> &event) noexcept
+	{
+		event.fetch_add(1);
+		event.notify_all();
+	}
+
+	std::vector<Cell> m_cells;
+	std::size_t m_mask;
+	alignas(64) std::atomic<std::size_t> m_tail{};        ///< Next position for producers, with kClosed
+	std::atomic<std::uint32_t> m_producersAsleep{};
+	std::atomic<std::uint32_t> m_space{};                 ///< Signalled as cells are freed
+	alignas(64) std::size_t m_head{};                     ///< Next position for the consumer
+	std::atomic<bool> m_consumerAsleep{};
+	std::atomic<std::uint32_t> m_items{};                 ///< Signalled as items are published
+	std::uint64_t m_batches{};
+	std::uint64_t m_popped{};
+};
+
+/// @brief Stages applied to a stream of items in order, spread over threads joined by queues
+///
+/// Each stage names an executor, and each run of adjacent stages naming the same
+/// one gets a thread of its own, fed by a bounded queue. Executors only group
+/// adjacent stages: stages naming the same executor apart from one another run
+/// on separate threads. Leading stages on executor 0 instead run inline in push,
+/// on the thread feeding the pipeline, e.g. one receiving from a socket; a later
+/// run on 0 gets a thread like any other. A thread takes items from its queue in
+/// batches and passes each through its stages before pushing it onward. Once a
+/// batch is through, the stages' flush hooks run, so a final stage can gather
+/// the batch's output and send it in one call. Inline stages have no batches,
+/// so their flush hooks run at the end of every push.
+///
+/// A full queue blocks the thread feeding it, so a slow stage holds back the
+/// stages before it and, in the end, reading from the socket. Items keep their
+/// order, since each stage runs on one thread.
+///
+/// A flush hook returning false fails the pipeline. From then on push returns
+/// false, and the threads discard what they take so that close still returns.
+template<class T> struct Pipeline
+{
+	struct Stage
+	{
+		std::function<bool(T&)> work;  ///< Returns false to drop the item
+		std::size_t executor{1};       ///< Shares a thread with adjacent stages naming the same; 0 runs in push if leading
+		std::function<bool()> flush{}; ///< Called after each batch, or each push if inline, if set; returns false on failure
+	};
+	struct Settings
+	{
+		std::size_t capacity{1024}; ///< Items each queue holds
+		std::size_t batch{64};      ///< Most items taken from a queue at once
+	};
+
+	/// @brief Start a thread for each run of adjacent stages on one executor, other than leading ones on 0
+	explicit Pipeline(std::vector<Stage> stages, Settings const settings = {}):
+		m_settings{settings}
+	{
+		for (Stage &stage : stages)
+		{
+			if (m_groups.empty() && stage.executor == 0)
+			{
+				m_inline.push_back(std::move(stage));
+				continue;
+			}
+			if (m_groups.empty() || m_groups.back()->executor != stage.executor)
+				m_groups.push_back(std::make_unique<Group>(stage.executor, settings.capacity));
+			m_groups.back()->stages.push_back(std::move(stage));
+		}
+		for (std::size_t i{}; i != m_groups.size(); ++i)
+			m_threads.emplace_back(&Pipeline::run, this, std::ref(*m_groups[i]), i + 1 != m_groups.size() ? &m_groups[i + 1]->queue : nullptr);
+	}
+	~Pipeline() noexcept
+	{
+		close();
+	}
+
+	/// @brief Non copy-constructible
+	Pipeline(Pipeline const&) = delete;
+	/// @brief Non copy-assignable
+	Pipeline &operator=(Pipeline const&) = delete;
+
+	/// @brief Pass an item through the inline stages and queue it for the rest
+	///
+	/// @return False if an inline stage dropped it, or the pipeline is closed or failed
+	bool push(T item)
+	{
+		bool const kept = process(m_inline, item);
+		if (!flush(m_inline))
+			m_failed.store(true, std::memory_order_relaxed);
+		return kept && !failed() && (m_groups.empty() || m_groups.front()->queue.push(std::move(item)));
+	}
+
+	/// @brief End the input and wait for every item pushed to pass through
+	void close() noexcept
+	{
+		if (!m_groups.empty())
+			m_groups.front()->queue.close();
+		for (std::thread &thread : m_threads)
+			if (thread.joinable())
+				thread.join();
+	}
+
+	/// @brief Test whether a flush hook has failed
+	[[nodiscard]] bool failed() const noexcept { return m_failed.load(std::memory_order_relaxed); }
+
+	/// @brief Access mean items taken per batch by each thread, in stage order; read once closed
+	[[nodiscard]] std::vector<double> batching() const
+	{
+		std::vector<double> batching{};
+		for (auto const &group : m_groups)
+			batching.push_back(group->queue.batching());
+		return batching;
+	}
+
+private:
+	/// @brief Stages sharing a thread, with the queue feeding it
+	struct Group
+	{
+		Group(std::size_t const executor, std::size_t const capacity): executor{executor}, queue{capacity} {}
+
+		std::size_t executor;
+		std::vector<Stage> stages{};
+		Queue<T> queue;
+	};
+
+	[[nodiscard]] static bool process(std::vector<Stage> const &stages, T &item)
+	{
+		for (Stage const &stage : stages)
+			if (!stage.work(item))
+				return false;
+		return true;
+	}
+	/// @return False if any hook failed; every hook runs regardless
+	[[nodiscard]] static bool flush(std::vector<Stage> const &stages)
+	{
+		bool flushed{true};
+		for (Stage const &stage : stages)
+			if (stage.flush)
+				flushed &= stage.flush();
+		return flushed;
+	}
+
+	void run(Group &group, Queue<T> *const next)
+	{
+		std::vector<T> batch{};
+		batch.reserve(m_settings.batch);
+		while (group.queue.pop(batch, m_settings.batch))
+		{
+			if (!failed())
+			{
+				for (T &item : batch)
+					if (process(group.stages, item) && next)
+						next->push(std::move(item));
+				if (!flush(group.stages))
+					m_failed.store(true, std::memory_order_relaxed);
+			}
+			batch.clear();
+		}
+		// Drained; the next thread finishes once it has drained too
+		if (next)
+			next->close();
+	}
+
+	Settings m_settings;
+	std::vector<Stage> m_inline{};
+	std::vector<std::unique_ptr<Group>> m_groups{};
+	std::vector<std::thread> m_threads{};
+	std::atomic<bool> m_failed{};
+};
+}  // namespace tcp
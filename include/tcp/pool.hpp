@@ -0,0 +1,139 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <tcp/ring.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace tcp {
+/// @brief Fixed-size buffers in one region, registered once for use by any ring
+///
+/// Registration pins the pages up front, so operations on pool buffers pay no
+/// per-operation locking of memory. Buffers are named by index; a pool is used by
+/// one thread at a time.
+struct BufferPool
+{
+	static constexpr std::uint32_t kNone{std::numeric_limits<std::uint32_t>::max()};
+
+	/// @brief Returns pool, invalid if the memory cannot be allocated or registered
+	///
+	/// @param count Number of buffers
+	/// @param size Bytes per buffer
+	[[nodiscard]] static BufferPool create(std::uint32_t const count, std::uint32_t const size) noexcept
+	{
+		BufferPool pool{};
+		RIO_EXTENSION_FUNCTION_TABLE const *const rio = internal::rio();
+		std::uint64_t const bytes = std::uint64_t{count} * size;
+		if (!rio || !bytes || bytes > std::numeric_limits<DWORD>::max())
+			return pool;
+
+		// Whole pages, so no other allocation shares the pinned memory
+		auto *const data = static_cast<char*>(::VirtualAlloc(nullptr, SIZE_T(bytes), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+		if (!data)
+			return pool;
+		RIO_BUFFERID const id = rio->RIORegisterBuffer(data, DWORD(bytes));
+		if (id == RIO_INVALID_BUFFERID)
+		{
+			::VirtualFree(data, 0, MEM_RELEASE);
+			return pool;
+		}
+
+		pool.m_region = Ring::Region{id, data, std::uint32_t(bytes)};
+		pool.m_size = size;
+		pool.m_free.reserve(count);
+		for (std::uint32_t index = count; index--;)
+			pool.m_free.push_back(index);
+		return pool;
+	}
+
+	BufferPool() = default;
+	~BufferPool() noexcept
+	{
+		close();
+	}
+
+	/// @brief Non copy-constructible
+	BufferPool(BufferPool const&) = delete;
+	/// @brief Non copy-assignable
+	BufferPool &operator=(BufferPool const&) = delete;
+
+	/// @brief Move-construction
+	BufferPool(BufferPool &&right) noexcept:
+		m_region{std::exchange(right.m_region, {})},
+		m_size{std::exchange(right.m_size, 0)},
+		m_free{std::move(right.m_free)}
+	{}
+	/// @brief Move-assignment
+	BufferPool &operator=(BufferPool &&right) noexcept
+	{
+		if (this != &right)
+		{
+			close(); // Release existing
+			m_region = std::exchange(right.m_region, {});
+			m_size = std::exchange(right.m_size, 0);
+			m_free = std::move(right.m_free);
+		}
+		return *this;
+	}
+
+	/// @brief Test validity of pool
+	[[nodiscard]] explicit operator bool() const noexcept { return !!m_region; }
+
+	/// @brief Access bytes per buffer
+	[[nodiscard]] constexpr std::uint32_t size() const noexcept { return m_size; }
+	/// @brief Access number of buffers not acquired
+	[[nodiscard]] constexpr std::size_t available() const noexcept { return m_free.size(); }
+
+	/// @brief Take a buffer
+	///
+	/// @return Index of buffer, kNone if all are taken
+	[[nodiscard]] std::uint32_t acquire() noexcept
+	{
+		if (m_free.empty())
+			return kNone;
+		std::uint32_t const index = m_free.back();
+		m_free.pop_back();
+		return index;
+	}
+	/// @brief Return a buffer once no operation uses it
+	void release(std::uint32_t const index) noexcept
+	{
+		m_free.push_back(index);
+	}
+
+	/// @brief Access memory of a buffer
+	[[nodiscard]] char *data(std::uint32_t const index) const noexcept { return m_region.data + std::size_t{index} * m_size; }
+	/// @brief Describe part of a buffer for a ring operation
+	///
+	/// @param length Number of bytes, clamped to the buffer
+	/// @param offset Offset within the buffer, clamped to its end
+	[[nodiscard]] RIO_BUF slice(std::uint32_t const index, std::uint32_t const length, std::uint32_t offset = 0) const noexcept
+	{
+		offset = std::min(offset, m_size);
+		return m_region.slice(index * m_size + offset, std::min(length, m_size - offset));
+	}
+
+private:
+	void close() noexcept
+	{
+		if (!m_region)
+			return;
+		internal::rio()->RIODeregisterBuffer(m_region.id);
+		::VirtualFree(m_region.data, 0, MEM_RELEASE);
+		m_region = {};
+		m_free.clear();
+	}
+
+	Ring::Region m_region{};
+	std::uint32_t m_size{};
+	std::vector<std::uint32_t> m_free{}; ///< Indices of buffers not acquired, lowest on top
+};
+}  // namespace tcp
@@ -0,0 +1,452 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <tcp/clock.hpp>
+#include <tcp/tcp.hpp>
+
+#include <MSWSock.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <new>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace tcp {
+namespace internal {
+/// @brief Registered I/O extension functions, loaded on first use after startup
+[[nodiscard]] inline RIO_EXTENSION_FUNCTION_TABLE const *rio() noexcept
+{
+	static RIO_EXTENSION_FUNCTION_TABLE const table = []
+	{
+		RIO_EXTENSION_FUNCTION_TABLE functions{};
+		SOCKET const socket = ::WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_REGISTERED_IO);
+		if (socket == INVALID_SOCKET)
+			return functions;
+
+		GUID id = WSAID_MULTIPLE_RIO;
+		DWORD bytes{};
+		if (::WSAIoctl(socket, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &id, sizeof(id),
+					   &functions, sizeof(functions), &bytes, nullptr, nullptr) != 0)
+			functions = {};
+		::closesocket(socket);
+		return functions;
+	}();
+	return table.RIOReceive ? &table : nullptr;
+}
+}  // namespace internal
+
+/// @brief Completion-based socket I/O over Registered I/O, the platform's counterpart of io_uring
+///
+/// Sends and receives are posted to a socket's request queue and complete into the
+/// ring's completion queue. Sockets must come from createSocket, or be accepted from
+/// a listener that did, and data must lie in a region registered with the ring. A
+/// ring and its queues are used by one thread at a time.
+struct Ring
+{
+	/// @brief How completions are awaited
+	enum class Wait
+	{
+		Notified, ///< Sleep on an event armed per wait; two syscalls when the queue is empty
+		Polled,   ///< Spin on the completion queue; no syscalls, one busy core
+	};
+	/// @brief When posted operations reach the kernel
+	enum class Submit
+	{
+		Immediate, ///< One syscall per operation
+		Deferred,  ///< Held until submit, then one syscall per socket and direction
+	};
+
+	struct Settings
+	{
+		std::uint32_t entries{4096}; ///< Completion queue capacity, shared by attached sockets
+		Wait wait{Wait::Notified};
+		Submit submit{Submit::Immediate};
+	};
+	/// @brief Counters for choosing settings under a given load
+	struct Stats
+	{
+		std::uint64_t operations{};  ///< Sends and receives posted
+		std::uint64_t submitCalls{}; ///< Syscalls made to post or commit them
+		std::uint64_t notifyCalls{}; ///< Syscalls arming the completion event
+		std::uint64_t waitCalls{};   ///< Syscalls sleeping on the completion event
+		std::uint64_t completions{};
+		std::uint64_t linked{};      ///< Chain steps issued by the ring after a completion
+
+		/// @brief Submission syscalls avoided by deferring
+		[[nodiscard]] constexpr std::uint64_t submitCallsSaved() const noexcept { return operations - submitCalls; }
+	};
+	struct Completion
+	{
+		void *context;       ///< As given when posting
+		std::uint32_t bytes; ///< Zero for a receive means the peer closed
+		int error;           ///< Zero on success
+	};
+	/// @brief Memory registered with a ring
+	struct Region
+	{
+		[[nodiscard]] explicit operator bool() const noexcept { return id != RIO_INVALID_BUFFERID; }
+
+		/// @brief Describe part of the region for an operation
+		[[nodiscard]] RIO_BUF slice(std::uint32_t const offset, std::uint32_t const length) const noexcept
+		{
+			return RIO_BUF{id, offset, length};
+		}
+
+		RIO_BUFFERID id{RIO_INVALID_BUFFERID};
+		char *data{};
+		std::uint32_t size{};
+	};
+	/// @brief Request queue of an attached socket
+	struct Queue
+	{
+		[[nodiscard]] constexpr explicit operator bool() const noexcept { return handle != RIO_INVALID_RQ; }
+
+		RIO_RQ handle{RIO_INVALID_RQ};
+		std::uint32_t depth{};  ///< Outstanding operations allowed in each direction
+		bool deferredSends{};
+		bool deferredReceives{};
+	};
+	/// @brief A receive whose data the ring sends on without returning to the caller
+	///
+	/// The chain reports one completion: bytes forwarded, or zero if the peer of the
+	/// receiving socket closed. A failed step ends the chain. The link must stay in
+	/// place until the chain completes, and while it is pending its address must not
+	/// be used as the context of another operation.
+	struct Link
+	{
+		Queue *to{};      ///< Request queue of the socket the data is sent on
+		RIO_BUF buffer{}; ///< Registered memory received into and sent from
+		void *context{};  ///< Reported with the completion of the chain
+		bool received{};  ///< Set by the ring once the first step completes
+	};
+
+	/// @brief Returns streaming socket usable with rings
+	[[nodiscard]] static Socket createSocket() noexcept
+	{
+		TCP_COUNT_SYSCALL(Socket);
+		return Socket{::WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO)};
+	}
+	/// @brief Returns ring with default settings, invalid if Registered I/O is unavailable
+	[[nodiscard]] static Ring create() noexcept
+	{
+		return create(Settings{});
+	}
+	/// @brief Returns ring, invalid if Registered I/O is unavailable
+	[[nodiscard]] static Ring create(Settings const &settings) noexcept
+	{
+		Ring ring{};
+		RIO_EXTENSION_FUNCTION_TABLE const *const rio = internal::rio();
+		if (!rio)
+			return ring;
+
+		ring.m_settings = settings;
+		RIO_NOTIFICATION_COMPLETION notification{};
+		if (settings.wait == Wait::Notified)
+		{
+			if (!(ring.m_event = ::CreateEventW(nullptr, TRUE, FALSE, nullptr)))
+				return ring;
+			notification.Type = RIO_EVENT_COMPLETION;
+			notification.Event.EventHandle = ring.m_event;
+			notification.Event.NotifyReset = TRUE;
+		}
+		ring.m_queue = rio->RIOCreateCompletionQueue(settings.entries, settings.wait == Wait::Notified ? &notification : nullptr);
+		ring.m_results.resize(256);
+		return ring;
+	}
+
+	Ring() = default;
+	~Ring() noexcept
+	{
+		close();
+	}
+
+	/// @brief Non copy-constructible
+	Ring(Ring const&) = delete;
+	/// @brief Non copy-assignable
+	Ring &operator=(Ring const&) = delete;
+
+	/// @brief Move-construction
+	Ring(Ring &&right) noexcept
+	{
+		*this = std::move(right);
+	}
+	/// @brief Move-assignment
+	Ring &operator=(Ring &&right) noexcept
+	{
+		if (this != &right)
+		{
+			close(); // Release existing
+			m_settings = right.m_settings;
+			m_queue = std::exchange(right.m_queue, RIO_INVALID_CQ);
+			m_event = std::exchange(right.m_event, nullptr);
+			m_reserved = std::exchange(right.m_reserved, 0);
+			m_regions = std::move(right.m_regions);
+			m_queues = std::move(right.m_queues);
+			m_free = std::move(right.m_free);
+			m_deferred = std::move(right.m_deferred);
+			m_links = std::move(right.m_links);
+			m_results = std::move(right.m_results);
+			m_stats = std::exchange(right.m_stats, {});
+		}
+		return *this;
+	}
+
+	/// @brief Test validity of ring
+	[[nodiscard]] constexpr explicit operator bool() const noexcept { return m_queue != RIO_INVALID_CQ; }
+
+	/// @brief Access counters accumulated since creation
+	[[nodiscard]] constexpr Stats const &stats() const noexcept { return m_stats; }
+	/// @brief Access settings given at creation
+	[[nodiscard]] constexpr Settings const &settings() const noexcept { return m_settings; }
+
+	/// @brief Register memory for use by operations; it must outlive the ring
+	/// @note Prefer a BufferPool for memory used by many operations or rings
+	[[nodiscard]] Region registerRegion(void *const data, std::uint32_t const size) noexcept
+	{
+		Region region{internal::rio()->RIORegisterBuffer(static_cast<char*>(data), size), static_cast<char*>(data), size};
+		if (region)
+			m_regions.push_back(region.id);
+		return region;
+	}
+
+	/// @brief Create the request queue of a socket
+	///
+	/// The socket is resolved once here rather than per operation, as with a table
+	/// of fixed descriptors.
+	/// @param socket Socket from createSocket, or accepted from one
+	/// @param depth Outstanding operations allowed in each direction
+	/// @return Queue owned by the ring, nullptr if the completion queue is full or on error
+	[[nodiscard]] Queue *attach(Socket const &socket, std::uint32_t const depth = 1) noexcept
+	{
+		// Both directions may complete at once, so each socket reserves twice its depth
+		if (m_reserved + 2 * depth > m_settings.entries)
+			return nullptr;
+
+		Queue *queue{};
+		if (m_free.empty())
+			queue = &m_queues.emplace_back();
+		else
+		{
+			queue = m_free.back();
+			m_free.pop_back();
+		}
+
+		*queue = Queue{internal::rio()->RIOCreateRequestQueue(socket.handle(), depth, 1, depth, 1, m_queue, m_queue, nullptr), depth};
+		if (!*queue)
+		{
+			m_free.push_back(queue);
+			return nullptr;
+		}
+		m_reserved += 2 * depth;
+		return queue;
+	}
+	/// @brief Return a queue once its socket is closed and its operations have completed
+	void detach(Queue *const queue) noexcept
+	{
+		std::erase(m_deferred, queue);
+		m_reserved -= 2 * queue->depth;
+		*queue = Queue{};
+		m_free.push_back(queue);
+	}
+
+	/// @brief Post a send of part of a registered region
+	///
+	/// @param context Returned with the completion
+	bool send(Queue &queue, RIO_BUF const &buffer, void *const context = nullptr) noexcept
+	{
+		return post(queue, buffer, context, true);
+	}
+	/// @brief Post a receive into part of a registered region
+	///
+	/// @param context Returned with the completion
+	bool receive(Queue &queue, RIO_BUF const &buffer, void *const context = nullptr) noexcept
+	{
+		return post(queue, buffer, context, false);
+	}
+	/// @brief Post the first step of a chain, receiving on one socket to send on another
+	///
+	/// With deferred submission the second step joins the next batch, so a forward
+	/// costs no syscall of its own.
+	bool forward(Queue &from, Link &link) noexcept
+	{
+		link.received = false;
+		try
+		{
+			m_links.insert(&link);
+		}
+		catch (std::bad_alloc const&)
+		{
+			::WSASetLastError(WSAENOBUFS);
+			return false;
+		}
+		if (post(from, link.buffer, &link, false))
+			return true;
+		m_links.erase(&link);
+		return false;
+	}
+	/// @brief Hand deferred operations to the kernel
+	bool submit() noexcept
+	{
+		RIO_EXTENSION_FUNCTION_TABLE const *const rio = internal::rio();
+		bool submitted{true};
+		for (Queue *const queue : m_deferred)
+		{
+			if (std::exchange(queue->deferredSends, false))
+			{
+				++m_stats.submitCalls;
+				TCP_COUNT_SYSCALL(Submit);
+				submitted &= !!rio->RIOSend(queue->handle, nullptr, 0, RIO_MSG_COMMIT_ONLY, nullptr);
+			}
+			if (std::exchange(queue->deferredReceives, false))
+			{
+				++m_stats.submitCalls;
+				TCP_COUNT_SYSCALL(Submit);
+				submitted &= !!rio->RIOReceive(queue->handle, nullptr, 0, RIO_MSG_COMMIT_ONLY, nullptr);
+			}
+		}
+		m_deferred.clear();
+		return submitted;
+	}
+
+	/// @brief Collect completions, submitting deferred operations first
+	///
+	/// @param ms Number of milliseconds to wait for the first, negative to wait indefinitely
+	/// @return Number of completions written, zero on timeout, or SOCKET_ERROR if the completion
+	///         queue is corrupt, after which the ring cannot be used
+	std::size_t complete(Completion *const completions, std::size_t const capacity, int const ms = -1) noexcept
+	{
+		std::int64_t const deadline = Clock::nanoseconds() + std::int64_t{ms} * 1'000'000;
+		for (;;)
+		{
+			// Waiting on operations the kernel has not been given would never end
+			submit();
+			if (std::size_t const count = dequeue(completions, capacity))
+				return count;
+			if (!m_deferred.empty())
+				continue; // Chain steps issued by the dequeue
+			if (ms == 0)
+				return 0;
+
+			DWORD remaining{INFINITE};
+			if (ms > 0)
+			{
+				std::int64_t const left = deadline - Clock::nanoseconds();
+				if (left <= 0)
+					return 0;
+				remaining = DWORD((left + 999'999) / 1'000'000); // Rounded up so the wait does not end early
+			}
+			if (m_settings.wait == Wait::Polled)
+				continue;
+
+			// Arming reports at once if completions arrived since the dequeue
+			++m_stats.notifyCalls;
+			TCP_COUNT_SYSCALL(Notify);
+			internal::rio()->RIONotify(m_queue);
+			++m_stats.waitCalls;
+			TCP_COUNT_SYSCALL(Wait);
+			if (::WaitForSingleObject(m_event, remaining) != WAIT_OBJECT_0)
+				return 0;
+		}
+	}
+
+private:
+	bool post(Queue &queue, RIO_BUF const &buffer, void *const context, bool const send) noexcept
+	{
+		RIO_EXTENSION_FUNCTION_TABLE const *const rio = internal::rio();
+		bool const deferred = m_settings.submit == Submit::Deferred;
+		RIO_BUF data = buffer;
+
+		++m_stats.operations;
+		if (!deferred)
+		{
+			++m_stats.submitCalls;
+			TCP_COUNT_SYSCALL(Submit);
+		}
+		DWORD const flags = deferred ? RIO_MSG_DEFER : 0;
+		bool const posted = send
+			? rio->RIOSend(queue.handle, &data, 1, flags, context)
+			: rio->RIOReceive(queue.handle, &data, 1, flags, context);
+		if (posted && deferred)
+		{
+			if (!queue.deferredSends && !queue.deferredReceives)
+				m_deferred.push_back(&queue);
+			(send ? queue.deferredSends : queue.deferredReceives) = true;
+		}
+		return posted;
+	}
+	std::size_t dequeue(Completion *const completions, std::size_t const capacity) noexcept
+	{
+		ULONG const count = internal::rio()->RIODequeueCompletion(m_queue, m_results.data(), ULONG(std::min(capacity, m_results.size())));
+		if (count == RIO_CORRUPT_CQ)
+		{
+			::WSASetLastError(WSAEINVAL);
+			return static_cast<std::size_t>(SOCKET_ERROR);
+		}
+		m_stats.completions += count;
+
+		std::size_t reported{};
+		for (ULONG i{}; i != count; ++i)
+		{
+			RIORESULT const &result = m_results[i];
+			auto *const context = reinterpret_cast<void*>(static_cast<std::uintptr_t>(result.RequestContext));
+			auto const found = m_links.empty() ? m_links.end() : m_links.find(static_cast<Link*>(context));
+			if (found == m_links.end())
+			{
+				completions[reported++] = Completion{context, result.BytesTransferred, int(result.Status)};
+				continue;
+			}
+
+			Link &link = **found;
+			int error{int(result.Status)};
+			if (!link.received && !error && result.BytesTransferred)
+			{
+				link.received = true;
+				++m_stats.linked;
+				if (post(*link.to, RIO_BUF{link.buffer.BufferId, link.buffer.Offset, result.BytesTransferred}, &link, true))
+					continue;
+				error = ::WSAGetLastError();
+			}
+			m_links.erase(found);
+			completions[reported++] = Completion{link.context, error ? 0 : result.BytesTransferred, error};
+		}
+		return reported;
+	}
+	void close() noexcept
+	{
+		if (m_queue != RIO_INVALID_CQ)
+		{
+			RIO_EXTENSION_FUNCTION_TABLE const *const rio = internal::rio();
+			rio->RIOCloseCompletionQueue(std::exchange(m_queue, RIO_INVALID_CQ));
+			for (RIO_BUFFERID const id : m_regions)
+				rio->RIODeregisterBuffer(id);
+		}
+		if (m_event)
+			::CloseHandle(std::exchange(m_event, nullptr));
+		m_regions.clear();
+		m_queues.clear();
+		m_free.clear();
+		m_deferred.clear();
+		m_links.clear();
+		m_reserved = 0;
+	}
+
+	Settings m_settings{};
+	RIO_CQ m_queue{RIO_INVALID_CQ};
+	HANDLE m_event{};
+	std::uint32_t m_reserved{};            ///< Completion queue entries promised to attached sockets
+	std::vector<RIO_BUFFERID> m_regions{};
+	std::deque<Queue> m_queues{};          ///< Stable addresses for handed-out queues
+	std::vector<Queue*> m_free{};
+	std::vector<Queue*> m_deferred{};      ///< Queues holding operations not yet submitted
+	std::unordered_set<Link*> m_links{};   ///< Links of chains not yet complete, told apart from caller contexts
+	std::vector<RIORESULT> m_results{};
+	Stats m_stats{};
+};
+}  // namespace tcp
@@ -0,0 +1,360 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <tcp/tcp.hpp>
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace tcp {
+namespace internal {
+/// @brief Two chunks handed back and forth between the thread filling them and the thread draining them
+struct Chunks
+{
+	static constexpr std::size_t kHeader{sizeof(std::uint32_t)};
+	static constexpr std::size_t kEmpty{std::numeric_limits<std::size_t>::max()};
+
+	explicit Chunks(std::size_t const size): m_size{size}, m_data(2 * (kHeader + size)) {}
+
+	/// @brief Access bytes a chunk can hold
+	[[nodiscard]] constexpr std::size_t size() const noexcept { return m_size; }
+	/// @brief Access the length prefix of a chunk, followed immediately by its data
+	[[nodiscard]] char *header(std::size_t const index) noexcept { return m_data.data() + index * (kHeader + m_size); }
+	/// @brief Access the data of a chunk
+	[[nodiscard]] char *data(std::size_t const index) noexcept { return header(index) + kHeader; }
+
+	/// @brief Mark both chunks empty for the next payload
+	void reset() noexcept
+	{
+		std::scoped_lock const lock{m_mutex};
+		m_lengths = {kEmpty, kEmpty};
+		m_cancelled = false;
+	}
+
+	/// @brief Wait until a chunk is empty
+	///
+	/// @return False if cancelled
+	[[nodiscard]] bool awaitEmpty(std::size_t const index) noexcept
+	{
+		std::unique_lock lock{m_mutex};
+		m_changed.wait(lock, [this, index] { return m_cancelled || m_lengths[index] == kEmpty; });
+		return !m_cancelled;
+	}
+	/// @brief Hand a chunk holding length bytes to the draining thread
+	void fill(std::size_t const index, std::size_t const length) noexcept
+	{
+		update(index, length);
+	}
+
+	/// @brief Wait until a chunk is filled
+	///
+	/// @return Bytes in the chunk, kEmpty if cancelled
+	[[nodiscard]] std::size_t awaitFilled(std::size_t const index) noexcept
+	{
+		std::unique_lock lock{m_mutex};
+		m_changed.wait(lock, [this, index] { return m_cancelled || m_lengths[index] != kEmpty; });
+		return m_cancelled ? kEmpty : m_lengths[index];
+	}
+	/// @brief Hand a chunk back to the filling thread
+	void drain(std::size_t const index) noexcept
+	{
+		update(index, kEmpty);
+	}
+
+	/// @brief Wake and fail both threads
+	void cancel() noexcept
+	{
+		{
+			std::scoped_lock const lock{m_mutex};
+			m_cancelled = true;
+		}
+		m_changed.notify_all();
+	}
+
+private:
+	void update(std::size_t const index, std::size_t const length) noexcept
+	{
+		{
+			std::scoped_lock const lock{m_mutex};
+			m_lengths[index] = length;
+		}
+		m_changed.notify_all();
+	}
+
+	std::size_t m_size;
+	std::vector<char> m_data;
+	std::mutex m_mutex{};
+	std::condition_variable m_changed{};
+	std::array<std::size_t, 2> m_lengths{kEmpty, kEmpty}; ///< Bytes in each chunk, kEmpty while it is being filled
+	bool m_cancelled{};
+};
+}  // namespace internal
+
+/// @brief Sends and receives payloads of any length in fixed chunks, holding no more than two at a time
+///
+/// A payload is produced and consumed in chunks through callbacks, so it never
+/// has to exist in memory at once. On the wire each chunk is prefixed by its
+/// length, and a zero length ends the payload, so neither side needs to know
+/// the total in advance.
+///
+/// Callbacks run on the calling thread, while a helper thread moves chunks over
+/// the socket. The helper starts with the first call and serves every later one
+/// until the stream is destroyed. Each side works on one chunk while the other
+/// works on the second, so producing, sending, receiving and consuming overlap.
+/// The socket must be blocking and must not be used by anything else during a
+/// call. A failed call shuts the connection down, since its peer is left part
+/// way through a payload.
+struct Stream
+{
+	static constexpr std::size_t kDefaultChunk{std::size_t{1} << 20};
+	/// @brief Returned by a producer to abandon the payload
+	static constexpr std::size_t kAbort{std::numeric_limits<std::size_t>::max()};
+
+	/// @param chunk Bytes per chunk; the memory used is twice this
+	explicit Stream(Socket const &socket, std::size_t const chunk = kDefaultChunk):
+		m_socket{socket}, m_chunks{std::clamp<std::size_t>(chunk, 1, std::numeric_limits<std::uint32_t>::max())} {}
+	~Stream() noexcept
+	{
+		if (!m_helper.joinable())
+			return;
+		{
+			std::scoped_lock const lock{m_mutex};
+			m_stopping = true;
+		}
+		m_changed.notify_all();
+		m_helper.join();
+	}
+
+	/// @brief Non copy-constructible
+	Stream(Stream const&) = delete;
+	/// @brief Non copy-assignable
+	Stream &operator=(Stream const&) = delete;
+
+	/// @brief Send a payload
+	///
+	/// @param produce Called as produce(char *data, std::size_t capacity) until it returns zero;
+	///                returns bytes written to data, or kAbort
+	/// @return Whether the whole payload was sent
+	template<class Producer> requires std::is_invocable_r_v<std::size_t, Producer&, char*, std::size_t>
+	bool send(Producer &&produce)
+	{
+		m_bytes = 0;
+		m_chunks.reset();
+		Transfer transfer{*this, &Stream::transmit};
+		for (std::size_t index{};; index ^= 1)
+		{
+			if (!m_chunks.awaitEmpty(index))
+				return false;
+			std::size_t const length = produce(m_chunks.data(index), m_chunks.size());
+			if (length > m_chunks.size())
+				return false;
+			m_chunks.fill(index, length);
+			if (length == 0)
+				return transfer.finish();
+			m_bytes += length;
+		}
+	}
+
+	/// @brief Receive a payload
+	///
+	/// @param consume Called as consume(char const *data, std::size_t size) for each piece, in order;
+	///                returns false to abandon the payload
+	/// @return Whether the whole payload was received and consumed
+	template<class Consumer> requires std::is_invocable_r_v<bool, Consumer&, char const*, std::size_t>
+	bool receive(Consumer &&consume)
+	{
+		m_bytes = 0;
+		m_chunks.reset();
+		Transfer transfer{*this, &Stream::collect};
+		for (std::size_t index{};; index ^= 1)
+		{
+			std::size_t const length = m_chunks.awaitFilled(index);
+			if (length == internal::Chunks::kEmpty)
+				return false;
+			if (length == 0)
+				return transfer.finish();
+			if (!consume(static_cast<char const*>(m_chunks.data(index)), length))
+				return false;
+			m_bytes += length;
+			m_chunks.drain(index);
+		}
+	}
+
+	/// @brief Access payload bytes passed through the callbacks by the last call
+	[[nodiscard]] constexpr std::uint64_t bytes() const noexcept { return m_bytes; }
+	/// @brief Access bytes per chunk
+	[[nodiscard]] constexpr std::size_t chunk() const noexcept { return m_chunks.size(); }
+
+private:
+	using Job = bool (Stream::*)() noexcept;
+
+	/// @brief Work of the helper for one call, awaited on every way out of it
+	struct Transfer
+	{
+		Transfer(Stream &stream, Job const job): m_stream{stream}
+		{
+			m_stream.begin(job);
+		}
+		~Transfer() noexcept
+		{
+			if (m_finished)
+				return;
+			// Abandoned by the caller; the helper may be blocked on the socket rather than the chunks
+			m_stream.m_chunks.cancel();
+			::shutdown(m_stream.m_socket.handle(), SD_BOTH);
+			static_cast<void>(m_stream.await());
+		}
+
+		Transfer(Transfer const&) = delete;
+		Transfer &operator=(Transfer const&) = delete;
+
+		/// @brief Wait for the helper to finish the payload
+		[[nodiscard]] bool finish() noexcept
+		{
+			m_finished = true;
+			return m_stream.await();
+		}
+
+	private:
+		Stream &m_stream;
+		bool m_finished{};
+	};
+
+	/// @brief Hand a job to the helper, starting it on first use
+	void begin(Job const job)
+	{
+		if (!m_helper.joinable())
+			m_helper = std::thread{&Stream::serve, this};
+		{
+			std::scoped_lock const lock{m_mutex};
+			m_job = job;
+		}
+		m_changed.notify_all();
+	}
+	/// @brief Wait for the helper to finish its job
+	///
+	/// @return Whether the job succeeded
+	[[nodiscard]] bool await() noexcept
+	{
+		std::unique_lock lock{m_mutex};
+		m_changed.wait(lock, [this] { return !m_job; });
+		return m_succeeded;
+	}
+	/// @brief Body of the helper, running jobs until the stream is destroyed
+	void serve() noexcept
+	{
+		std::unique_lock lock{m_mutex};
+		for (;;)
+		{
+			m_changed.wait(lock, [this] { return m_stopping || m_job; });
+			if (m_stopping)
+				return;
+			Job const job = m_job;
+			lock.unlock();
+			bool const succeeded = (this->*job)();
+			lock.lock();
+			m_succeeded = succeeded;
+			m_job = nullptr;
+			m_changed.notify_all();
+		}
+	}
+
+	/// @brief Send filled chunks, each with its length, until the empty one ending the payload
+	bool transmit() noexcept
+	{
+		for (std::size_t index{};; index ^= 1)
+		{
+			std::size_t const length = m_chunks.awaitFilled(index);
+			if (length == internal::Chunks::kEmpty)
+				return false;
+			auto const header = internal::swapBytes(static_cast<std::uint32_t>(length));
+			std::memcpy(m_chunks.header(index), &header, sizeof(header));
+			if (!sendAll(m_chunks.header(index), internal::Chunks::kHeader + length))
+				return fail();
+			if (length == 0)
+				return true;
+			m_chunks.drain(index);
+		}
+	}
+	/// @brief Receive chunks of the peer's size into chunks of this one until an empty one ends the payload
+	bool collect() noexcept
+	{
+		std::uint32_t remaining{};
+		for (std::size_t index{};; index ^= 1)
+		{
+			if (!m_chunks.awaitEmpty(index))
+				return false;
+			if (!remaining)
+			{
+				std::uint32_t header{};
+				if (!receiveAll(&header, sizeof(header)))
+					return fail();
+				if ((remaining = internal::swapBytes(header)) == 0)
+				{
+					m_chunks.fill(index, 0);
+					return true;
+				}
+			}
+			std::size_t const length = std::min<std::size_t>(remaining, m_chunks.size());
+			if (!receiveAll(m_chunks.data(index), length))
+				return fail();
+			remaining -= static_cast<std::uint32_t>(length);
+			m_chunks.fill(index, length);
+		}
+	}
+	bool fail() noexcept
+	{
+		m_chunks.cancel();
+		return false;
+	}
+
+	bool sendAll(char const *data, std::size_t size) const noexcept
+	{
+		while (size)
+		{
+			std::size_t const sent = m_socket.send(data, size);
+			if (sent == static_cast<std::size_t>(SOCKET_ERROR))
+				return false;
+			data += sent;
+			size -= sent;
+		}
+		return true;
+	}
+	bool receiveAll(void *const buffer, std::size_t size) const noexcept
+	{
+		auto *data = static_cast<char*>(buffer);
+		while (size)
+		{
+			std::size_t const received = m_socket.receive(data, size);
+			if (received == 0 || received == static_cast<std::size_t>(SOCKET_ERROR))
+				return false;
+			data += received;
+			size -= received;
+		}
+		return true;
+	}
+
+	Socket const &m_socket;
+	internal::Chunks m_chunks;
+	std::uint64_t m_bytes{};
+
+	std::mutex m_mutex{};
+	std::condition_variable m_changed{}; ///< Signalled as jobs are handed over and finished
+	Job m_job{};                         ///< Job of the current call, null once finished
+	bool m_succeeded{};
+	bool m_stopping{};
+	std::thread m_helper{};
+};
+}  // namespace tcp
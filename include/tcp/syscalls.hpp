@@ -0,0 +1,176 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace tcp {
+namespace syscalls {
+/// @brief Kinds of system call issued by the library
+enum class Call : std::size_t
+{
+	Socket,
+	Close,
+	Bind,
+	Connect,
+	Listen,
+	Accept,
+	Send,
+	Receive,
+	Control, ///< ioctlsocket
+	Option,  ///< setsockopt
+	Poll,    ///< WSAPoll
+	Submit,  ///< Registered I/O send, receive or commit
+	Notify,  ///< Registered I/O completion notification
+	Wait,    ///< Sleep on a completion event
+	Count
+};
+[[nodiscard]] constexpr char const *name(Call const call) noexcept
+{
+	constexpr std::array<char const*, std::size_t(Call::Count)> kNames{
+		"socket", "close", "bind", "connect", "listen", "accept", "send", "receive", "control", "option", "poll",
+		"submit", "notify", "wait"};
+	return kNames[std::size_t(call)];
+}
+
+/// @brief Number of calls of each kind, at a point in time or between two points
+struct Counts
+{
+	std::array<std::uint64_t, std::size_t(Call::Count)> values{};
+
+	[[nodiscard]] constexpr std::uint64_t operator[](Call const call) const noexcept { return values[std::size_t(call)]; }
+	[[nodiscard]] constexpr std::uint64_t &operator[](Call const call) noexcept { return values[std::size_t(call)]; }
+
+	[[nodiscard]] constexpr Counts operator-(Counts const &right) const noexcept
+	{
+		Counts result{};
+		for (std::size_t i{}; i != values.size(); ++i)
+			result.values[i] = values[i] - right.values[i];
+		return result;
+	}
+	constexpr Counts &operator+=(Counts const &right) noexcept
+	{
+		for (std::size_t i{}; i != values.size(); ++i)
+			values[i] += right.values[i];
+		return *this;
+	}
+
+	/// @brief Calls of every kind
+	[[nodiscard]] constexpr std::uint64_t total() const noexcept
+	{
+		std::uint64_t sum{};
+		for (std::uint64_t const value : values)
+			sum += value;
+		return sum;
+	}
+};
+
+namespace internal {
+/// @brief Counters written only by their owning thread and read by any
+struct Block
+{
+	std::array<std::atomic<std::uint64_t>, std::size_t(Call::Count)> values{};
+
+	[[nodiscard]] Counts read() const noexcept
+	{
+		Counts counts{};
+		for (std::size_t i{}; i != values.size(); ++i)
+			counts.values[i] = values[i].load(std::memory_order_relaxed);
+		return counts;
+	}
+};
+
+struct Registry
+{
+	[[nodiscard]] std::unique_ptr<Block> attach()
+	{
+		auto block = std::make_unique<Block>();
+		std::scoped_lock const lock{mutex};
+		blocks.push_back(block.get());
+		return block;
+	}
+	/// @brief Fold the counts of an exiting thread into the running total before its block is freed
+	void detach(Block const &block) noexcept
+	{
+		std::scoped_lock const lock{mutex};
+		retired += block.read();
+		std::erase(blocks, &block);
+	}
+
+	std::mutex mutex{};
+	std::vector<Block const*> blocks{}; ///< Of threads still running
+	Counts retired{};                   ///< Calls of threads that have exited
+};
+[[nodiscard]] inline Registry &registry() noexcept
+{
+	static Registry instance{};
+	return instance;
+}
+/// @brief Detaches the block of its thread on exit
+struct Attachment
+{
+	~Attachment() noexcept
+	{
+		if (block)
+			registry().detach(*block);
+	}
+
+	std::unique_ptr<Block> block{};
+};
+/// @brief Counters of the calling thread, created on first use
+///
+/// @return nullptr if the block cannot be allocated
+[[nodiscard]] inline Block *local() noexcept
+{
+	thread_local Attachment attachment{};
+	if (!attachment.block)
+	{
+		try
+		{
+			attachment.block = registry().attach();
+		}
+		catch (...)
+		{
+			return nullptr; // Out of memory; tried again by the next call
+		}
+	}
+	return attachment.block.get();
+}
+}  // namespace internal
+
+/// @brief Count one call on the calling thread; dropped if its counters cannot be allocated
+inline void count(Call const call) noexcept
+{
+	internal::Block *const block = internal::local();
+	if (!block)
+		return;
+	// Single writer, so a plain load and store suffice and avoid a locked add
+	std::atomic<std::uint64_t> &value = block->values[std::size_t(call)];
+	value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+/// @brief Calls made so far by the calling thread
+[[nodiscard]] inline Counts local() noexcept
+{
+	internal::Block const *const block = internal::local();
+	return block ? block->read() : Counts{};
+}
+/// @brief Calls made so far by all threads, including those that have exited
+[[nodiscard]] inline Counts total()
+{
+	internal::Registry &registry = internal::registry();
+	std::scoped_lock const lock{registry.mutex};
+	Counts counts = registry.retired;
+	for (internal::Block const *const block : registry.blocks)
+		counts += block->read();
+	return counts;
+}
+}  // namespace syscalls
+}  // namespace tcp
@@ -24,6 +24,41 @@ static_assert(false, // TODO:
 			  "Linux/Unix/OSX support for this library is yet to be implemented");
 #endif  // _WIN32
 
+// Instrumentation
+#ifdef TCP_ENABLE_TRACING
+# include <tcp/trace.hpp>
+# define TCP_TRACE_SPAN(name) ::tcp::trace::Scope tcpTraceSpan{name}
+// A failed call records its socket error rather than a byte count
+# define TCP_TRACE_BYTES(bytes) ((bytes) == static_cast<std::size_t>(SOCKET_ERROR) \
+	? tcpTraceSpan.setError(::WSAGetLastError()) : tcpTraceSpan.setBytes(bytes))
+#else
+# define TCP_TRACE_SPAN(name) static_cast<void>(0)
+# define TCP_TRACE_BYTES(bytes) static_cast<void>(0)
+#endif  // TCP_ENABLE_TRACING
+#ifdef TCP_ENABLE_LOGGING
+# include <tcp/log.hpp>
+# define TCP_LOG(...) ::tcp::log::write(__VA_ARGS__)
+#else
+# define TCP_LOG(...) static_cast<void>(0)
+#endif  // TCP_ENABLE_LOGGING
+#ifdef TCP_ENABLE_SYSCALL_COUNTING
+# include <tcp/syscalls.hpp>
+# define TCP_COUNT_SYSCALL(call) ::tcp::syscalls::count(::tcp::syscalls::Call::call)
+#else
+# define TCP_COUNT_SYSCALL(call) static_cast<void>(0)
+#endif  // TCP_ENABLE_SYSCALL_COUNTING
+
+// Static probes for bpftrace/perf/systemtap (provider "tcp"); a single nop each when untraced
+#if !defined(TCP_DISABLE_PROBES) && defined(__has_include)
+# if __has_include(<sys/sdt.h>)
+#  include <sys/sdt.h>
+#  define TCP_PROBE(name, ...) STAP_PROBEV(tcp, name, __VA_ARGS__)
+# endif
+#endif
+#ifndef TCP_PROBE
+# define TCP_PROBE(name, ...) static_cast<void>(0)
+#endif  // TCP_PROBE
+
 namespace tcp {
 namespace internal {
 /// @brief Swap endianness of integral between big-endian and little-endian
@@ -156,6 +191,7 @@ struct Socket
 	/// @brief Returns streaming socket
 	[[nodiscard]] static Socket create() noexcept
 	{
+		TCP_COUNT_SYSCALL(Socket);
 		return Socket{::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)};
 	}
 
@@ -191,6 +227,9 @@ struct Socket
 	/// @brief Test validity of socket
 	[[nodiscard]] constexpr explicit operator bool() const noexcept { return m_socket != INVALID_SOCKET; }
 
+	/// @brief Access the platform socket, e.g. to register it with a poller
+	[[nodiscard]] constexpr SOCKET handle() const noexcept { return m_socket; }
+
 	/// @brief Release semantic ownership of socket
 	[[nodiscard]] constexpr SOCKET release() noexcept
 	{
@@ -199,6 +238,10 @@ struct Socket
 	/// @brief Invalidate socket
 	void close() noexcept
 	{
+		if (m_socket == INVALID_SOCKET)
+			return; // Nothing to close, so no call is made or counted
+		TCP_PROBE(close, m_socket);
+		TCP_COUNT_SYSCALL(Close);
 		::closesocket(release());
 	}
 
@@ -208,7 +251,7 @@ struct Socket
 	/// @return Number of bytes sent
 	std::size_t send(auto const &data) const noexcept
 	{
-		return ::send(m_socket, reinterpret_cast<const char*>(&data), sizeof(data), 0);
+		return send(&data, sizeof(data));
 	}
 	/// @brief Send data along connected socket
 	/// 
@@ -217,7 +260,13 @@ struct Socket
 	/// @return Number of bytes sent
 	std::size_t send(auto const *data, std::size_t const size) const noexcept
 	{
-		return ::send(m_socket, reinterpret_cast<const char*>(data), size, 0);
+		TCP_TRACE_SPAN("send");
+		TCP_PROBE(send__entry, m_socket, size);
+		TCP_COUNT_SYSCALL(Send);
+		std::size_t const sent = ::send(m_socket, reinterpret_cast<const char*>(data), size, 0);
+		TCP_PROBE(send__return, m_socket, sent);
+		TCP_TRACE_BYTES(sent);
+		return sent;
 	}
 
 	/// @brief Receive data from connected socket
@@ -226,7 +275,7 @@ struct Socket
 	/// @return Number of bytes received
 	std::size_t receive(auto &data) const noexcept
 	{
-		return ::recv(m_socket, reinterpret_cast<char*>(&data), sizeof(data), 0);
+		return receive(&data, sizeof(data));
 	}
 	/// @brief Receive data from connected socket
 	/// 
@@ -235,22 +284,36 @@ struct Socket
 	/// @return Number of bytes received
 	std::size_t receive(auto *data, std::size_t const size) const noexcept
 	{
-		return ::recv(m_socket, reinterpret_cast<char*>(data), size, 0);
+		TCP_TRACE_SPAN("receive");
+		TCP_PROBE(receive__entry, m_socket, size);
+		TCP_COUNT_SYSCALL(Receive);
+		std::size_t const received = ::recv(m_socket, reinterpret_cast<char*>(data), size, 0);
+		TCP_PROBE(receive__return, m_socket, received);
+		TCP_TRACE_BYTES(received);
+		return received;
 	}
 
 	/// @brief Bind to local endpoint
 	bool bind(Endpoint const &endpoint) const noexcept
 	{
+		TCP_COUNT_SYSCALL(Bind);
 		return ::bind(m_socket, &endpoint.raw(), sizeof(endpoint.raw())) == 0;
 	}
 	/// @brief Connect to remote endpoint
 	bool connect(Endpoint const &endpoint) const noexcept
 	{
-		return ::connect(m_socket, &endpoint.raw(), sizeof(endpoint.raw())) == 0;
+		TCP_TRACE_SPAN("connect");
+		TCP_PROBE(connect__entry, m_socket, endpoint.address(), endpoint.port());
+		TCP_COUNT_SYSCALL(Connect);
+		bool const connected = ::connect(m_socket, &endpoint.raw(), sizeof(endpoint.raw())) == 0;
+		TCP_PROBE(connect__return, m_socket, connected);
+		TCP_LOG("connect {} to {}: {}", m_socket, endpoint, connected);
+		return connected;
 	}
 	/// @brief Allow socket to listen for incoming connections
 	bool listen(int const backlog = SOMAXCONN) const noexcept
 	{
+		TCP_COUNT_SYSCALL(Listen);
 		return ::listen(m_socket, backlog) == 0;
 	}
 	/// @brief Permit incoming connection attempt
@@ -259,8 +322,13 @@ struct Socket
 	/// @param endpoint Connection endpoint
 	bool accept(Socket &socket, Endpoint &endpoint) const noexcept
 	{
+		TCP_TRACE_SPAN("accept");
+		TCP_PROBE(accept__entry, m_socket);
 		int endpointSize{sizeof(endpoint.raw())};
+		TCP_COUNT_SYSCALL(Accept);
 		socket = Socket{::accept(m_socket, &endpoint.raw(), &endpointSize)};
+		TCP_PROBE(accept__return, m_socket, socket.m_socket, endpoint.address(), endpoint.port());
+		TCP_LOG("accept {} from {} on {}", socket.m_socket, endpoint, m_socket);
 		return !!socket; // Explicit cast
 	}
 	/// @brief Sets the blocking mode of the socket
@@ -269,13 +337,26 @@ struct Socket
 	bool setShouldBlock(bool const block = true) const noexcept
 	{
 		unsigned long mode = block ? 0 : 1;
+		TCP_COUNT_SYSCALL(Control);
 		return ::ioctlsocket(m_socket, FIONBIO, &mode) == 0;
 	}
+	/// @brief Wait until the socket is ready for any of the given events
+	///
+	/// @param events POLLRDNORM and/or POLLWRNORM
+	/// @param ms Number of milliseconds, negative to wait indefinitely
+	/// @return False on error or timeout
+	bool wait(short const events, int const ms = -1) const noexcept
+	{
+		TCP_COUNT_SYSCALL(Poll);
+		WSAPOLLFD descriptor{m_socket, events, 0};
+		return ::WSAPoll(&descriptor, 1, ms) > 0;
+	}
 	/// @brief Sets the timeout of blocking receive calls
 	/// 
 	/// @param Number of milliseconds
 	bool setReceiveTimeout(std::uint32_t const ms) const noexcept
 	{
+		TCP_COUNT_SYSCALL(Option);
 		return ::setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&ms), sizeof(ms)) == 0;
 	}
 	/// @brief Sets the timeout of blocking send calls
@@ -283,8 +364,34 @@ struct Socket
 	/// @param Number of milliseconds
 	bool setSendTimeout(std::uint32_t const ms) const noexcept
 	{
+		TCP_COUNT_SYSCALL(Option);
 		return ::setsockopt(m_socket, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&ms), sizeof(ms)) == 0;
 	}
+	/// @brief Sets the size of the kernel send buffer
+	///
+	/// @param bytes Number of bytes
+	bool setSendBufferSize(int const bytes) const noexcept
+	{
+		TCP_COUNT_SYSCALL(Option);
+		return ::setsockopt(m_socket, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&bytes), sizeof(bytes)) == 0;
+	}
+	/// @brief Sets the size of the kernel receive buffer
+	///
+	/// @param bytes Number of bytes
+	bool setReceiveBufferSize(int const bytes) const noexcept
+	{
+		TCP_COUNT_SYSCALL(Option);
+		return ::setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&bytes), sizeof(bytes)) == 0;
+	}
+	/// @brief Sets whether small sends are coalesced (Nagle's algorithm)
+	///
+	/// @param noDelay Should sends be transmitted immediately?
+	bool setNoDelay(bool const noDelay = true) const noexcept
+	{
+		int const value = noDelay ? 1 : 0;
+		TCP_COUNT_SYSCALL(Option);
+		return ::setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&value), sizeof(value)) == 0;
+	}
 
 private:
 	SOCKET m_socket{INVALID_SOCKET};
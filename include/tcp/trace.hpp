@@ -0,0 +1,326 @@
+// Copyright© 2022, Ted Pena <https://github.com/int047h>
+// All rights reserved.
+//
+// This file is part of tcp <https://github.com/int047h/tcp>
+#pragma once
+
+#include <tcp/clock.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace tcp {
+namespace trace {
+/// @brief Completed span of work recorded on a single thread
+struct Span
+{
+	char const *name{};   ///< Static string naming the operation
+	std::int64_t begin{}; ///< Start timestamp in nanoseconds
+	std::int64_t end{};   ///< End timestamp in nanoseconds
+	std::int64_t bytes{-1}; ///< Bytes transferred, negative if not applicable
+	std::int32_t error{};   ///< Error the operation failed with, zero if none
+};
+
+namespace internal {
+/// @brief Timestamp in nanoseconds used for all spans
+[[nodiscard]] inline std::int64_t now() noexcept
+{
+	return Clock::nanoseconds();
+}
+
+/// @brief Fixed-capacity span storage written by a single thread
+/// @note Overwrites the oldest spans once full
+///
+/// The writer takes no lock. It announces each slot before overwriting it, so
+/// a snapshot taken meanwhile discards any slot that may have changed under it.
+struct Buffer
+{
+	explicit Buffer(std::uint32_t const id, std::size_t const capacity):
+		m_slots(capacity), m_id{id}
+	{}
+
+	/// @brief Record a span; called by the owning thread only
+	void push(Span const &span) noexcept
+	{
+		std::size_t const count = m_count.load(std::memory_order_relaxed);
+		m_begun.store(count + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		Slot &slot = m_slots[count % m_slots.size()];
+		slot.name.store(span.name, std::memory_order_relaxed);
+		slot.begin.store(span.begin, std::memory_order_relaxed);
+		slot.end.store(span.end, std::memory_order_relaxed);
+		slot.bytes.store(span.bytes, std::memory_order_relaxed);
+		slot.error.store(span.error, std::memory_order_relaxed);
+		m_count.store(count + 1, std::memory_order_release);
+	}
+	/// @brief Copy out recorded spans, oldest first; callable from any thread
+	[[nodiscard]] std::vector<Span> snapshot() const
+	{
+		std::size_t const count = m_count.load(std::memory_order_acquire);
+		std::size_t const first = std::max(m_cleared.load(std::memory_order_relaxed), count < m_slots.size() ? 0 : count - m_slots.size());
+
+		std::vector<Span> spans;
+		spans.reserve(count - std::min(first, count));
+		for (std::size_t i = first; i < count; ++i)
+		{
+			Slot const &slot = m_slots[i % m_slots.size()];
+			spans.push_back(Span{slot.name.load(std::memory_order_relaxed), slot.begin.load(std::memory_order_relaxed),
+								 slot.end.load(std::memory_order_relaxed), slot.bytes.load(std::memory_order_relaxed),
+								 slot.error.load(std::memory_order_relaxed)});
+		}
+
+		// Drop the oldest spans if the writer has since begun overwriting them
+		std::atomic_thread_fence(std::memory_order_acquire);
+		std::size_t const begun = m_begun.load(std::memory_order_relaxed);
+		if (begun > m_slots.size() && begun - m_slots.size() > first)
+			spans.erase(spans.begin(), spans.begin() + std::ptrdiff_t(std::min(begun - m_slots.size() - first, spans.size())));
+		return spans;
+	}
+	/// @brief Discard recorded spans; callable from any thread
+	void clear() noexcept
+	{
+		m_cleared.store(m_count.load(std::memory_order_acquire), std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] std::uint32_t id() const noexcept { return m_id.load(std::memory_order_relaxed); }
+	[[nodiscard]] char const *name() const noexcept { return m_name.load(std::memory_order_relaxed); }
+	void setName(char const *const name) noexcept { m_name.store(name, std::memory_order_relaxed); }
+
+	/// @brief Hand the buffer to a new thread, discarding the spans of the last
+	void reuse(std::uint32_t const id) noexcept
+	{
+		clear();
+		m_id.store(id, std::memory_order_relaxed);
+		m_name.store(nullptr, std::memory_order_relaxed);
+	}
+
+	bool attached{}; ///< Owned by a live thread; guarded by the registry
+
+private:
+	struct Slot
+	{
+		std::atomic<char const*> name{};
+		std::atomic<std::int64_t> begin{};
+		std::atomic<std::int64_t> end{};
+		std::atomic<std::int64_t> bytes{};
+		std::atomic<std::int32_t> error{};
+	};
+
+	std::vector<Slot> m_slots;
+	std::atomic<std::size_t> m_count{};   ///< Spans written
+	std::atomic<std::size_t> m_begun{};   ///< Spans whose writing has begun
+	std::atomic<std::size_t> m_cleared{}; ///< Spans written before the last clear
+	std::atomic<std::uint32_t> m_id;
+	std::atomic<char const*> m_name{};
+};
+
+struct Registry
+{
+	/// @brief Take a buffer for the calling thread, reusing one left by an exited thread if any
+	[[nodiscard]] std::shared_ptr<Buffer> attach()
+	{
+		std::scoped_lock const lock{mutex};
+		std::uint32_t const id = ++threads;
+		for (auto const &buffer : buffers)
+			if (!buffer->attached)
+			{
+				buffer->reuse(id);
+				buffer->attached = true;
+				return buffer;
+			}
+		auto const &buffer = buffers.emplace_back(std::make_shared<Buffer>(id, capacity.load(std::memory_order_relaxed)));
+		buffer->attached = true;
+		return buffer;
+	}
+	/// @brief Release the buffer of an exiting thread; its spans stay until it is reused
+	void detach(Buffer &buffer) noexcept
+	{
+		std::scoped_lock const lock{mutex};
+		buffer.attached = false;
+	}
+
+	std::mutex mutex{};
+	std::vector<std::shared_ptr<Buffer>> buffers{};
+	std::uint32_t threads{}; ///< Threads that have recorded, numbering their buffers
+	std::atomic<std::size_t> capacity{std::size_t{1} << 16};
+	std::atomic<bool> enabled{};
+};
+[[nodiscard]] inline Registry &registry() noexcept
+{
+	static Registry instance{};
+	return instance;
+}
+/// @brief Holds the buffer of a thread, releasing it for reuse when the thread exits
+struct Attachment
+{
+	~Attachment() noexcept
+	{
+		if (buffer)
+			registry().detach(*buffer);
+	}
+
+	std::shared_ptr<Buffer> buffer{};
+};
+/// @brief Buffer of the calling thread, created on first use
+///
+/// @return nullptr if the buffer cannot be allocated
+[[nodiscard]] inline Buffer *local() noexcept
+{
+	// Buffers outlive their thread until exported or reused, so at most one per live thread is kept
+	thread_local Attachment attachment{};
+	if (!attachment.buffer)
+	{
+		try
+		{
+			attachment.buffer = registry().attach();
+		}
+		catch (...)
+		{
+			return nullptr; // Out of memory; tried again by the next span
+		}
+	}
+	return attachment.buffer.get();
+}
+
+inline void writeEscaped(std::ostream &out, char const *text)
+{
+	for (; *text; ++text)
+	{
+		if (*text == '"' || *text == '\\')
+			out.put('\\');
+		out.put(*text);
+	}
+}
+/// @brief Write nanoseconds as fractional microseconds
+inline void writeMicroseconds(std::ostream &out, std::int64_t const ns)
+{
+	char const fraction[]{char('0' + ns / 100 % 10), char('0' + ns / 10 % 10), char('0' + ns % 10), '\0'};
+	out << ns / 1000 << '.' << fraction;
+}
+}  // namespace internal
+
+/// @brief Start or stop recording spans
+///
+/// @param enable Should spans be recorded?
+/// @param capacity Spans kept per thread; only affects threads that have not yet recorded
+inline void enable(bool const enable = true, std::size_t const capacity = std::size_t{1} << 16) noexcept
+{
+	internal::registry().capacity.store(capacity ? capacity : 1, std::memory_order_relaxed);
+	internal::registry().enabled.store(enable, std::memory_order_relaxed);
+}
+/// @brief Test whether spans are being recorded
+[[nodiscard]] inline bool enabled() noexcept
+{
+	return internal::registry().enabled.load(std::memory_order_relaxed);
+}
+/// @brief Discard all recorded spans
+inline void clear() noexcept
+{
+	std::scoped_lock const lock{internal::registry().mutex};
+	for (auto const &buffer : internal::registry().buffers)
+		buffer->clear();
+}
+/// @brief Name the calling thread in exported traces
+///
+/// @param name Static string, e.g. "io-0"
+/// @return False if the thread's buffer cannot be allocated
+inline bool setThreadName(char const *name) noexcept
+{
+	internal::Buffer *const buffer = internal::local();
+	if (buffer)
+		buffer->setName(name);
+	return buffer != nullptr;
+}
+
+/// @brief Records a span from construction until destruction on the calling thread
+///
+/// Wrap handler execution in a Scope to see it alongside the library's own spans
+struct Scope
+{
+	/// @param name Static string naming the operation
+	explicit Scope(char const *name) noexcept:
+		m_name{enabled() ? name : nullptr}, m_begin{m_name ? internal::now() : 0}
+	{}
+	~Scope() noexcept
+	{
+		// Dropped if the thread's buffer cannot be allocated
+		if (internal::Buffer *const buffer = m_name ? internal::local() : nullptr)
+			buffer->push(Span{m_name, m_begin, internal::now(), m_bytes, m_error});
+	}
+
+	Scope(Scope const&) = delete;
+	Scope &operator=(Scope const&) = delete;
+
+	/// @brief Attach number of bytes transferred to the span
+	void setBytes(std::size_t const bytes) noexcept { m_bytes = static_cast<std::int64_t>(bytes); }
+	/// @brief Mark the span as failed with an error code
+	void setError(int const error) noexcept { m_error = error; }
+
+private:
+	char const *m_name;
+	std::int64_t m_begin;
+	std::int64_t m_bytes{-1};
+	std::int32_t m_error{};
+};
+
+/// @brief Write recorded spans of all threads as Chrome trace-event JSON
+///
+/// The output loads in chrome://tracing and https://ui.perfetto.dev
+/// @param out Destination stream
+inline bool exportChrome(std::ostream &out)
+{
+	std::vector<std::shared_ptr<internal::Buffer>> buffers;
+	{
+		std::scoped_lock const lock{internal::registry().mutex};
+		buffers = internal::registry().buffers;
+	}
+
+	out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	char const *separator = "\n";
+	for (auto const &buffer : buffers)
+	{
+		if (char const *const name = buffer->name())
+		{
+			out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id()
+				<< ",\"args\":{\"name\":\"";
+			internal::writeEscaped(out, name);
+			out << "\"}}";
+			separator = ",\n";
+		}
+		for (Span const &span : buffer->snapshot())
+		{
+			out << separator << "{\"name\":\"";
+			internal::writeEscaped(out, span.name);
+			out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id() << ",\"ts\":";
+			internal::writeMicroseconds(out, span.begin);
+			out << ",\"dur\":";
+			internal::writeMicroseconds(out, span.end - span.begin);
+			if (span.error)
+				out << ",\"args\":{\"error\":" << span.error << '}';
+			else if (span.bytes >= 0)
+				out << ",\"args\":{\"bytes\":" << span.bytes << '}';
+			out << '}';
+			separator = ",\n";
+		}
+	}
+	out << "\n]}\n";
+	return bool(out);
+}
+/// @brief Write recorded spans of all threads as Chrome trace-event JSON
+///
+/// @param path Destination file, overwritten if it exists
+inline bool exportChrome(char const *path)
+{
+	std::ofstream file{path, std::ios::trunc};
+	return file && exportChrome(file);
+}
+}  // namespace trace
+}  // namespace tcp